@@ -11,6 +11,7 @@
 
 
 #include <iostream>
+#include <cstdlib>	// strtoull
 
 #include "../src/ThreadedServer.hpp"
 #include "../src/HttpProtocol.hpp"
@@ -31,25 +32,38 @@ int main(int argc, char* argv[])
 
 	// configure Websocket protocol
 	ams::WebsocketProtocol websocket;
+	websocket.keepHistory("chat", 100);	// the last 100 messages, for people who join late or drop out for a moment
+	websocket.addSubprotocol("ams");	// the pages ask for it, browsers give up on a server that doesn't agree to it
+
+	// send a chat message, numbered so clients can ask for what they missed
+	auto say = [&websocket](const string & text)
+		{
+			websocket.publish("chat", std::to_string(websocket.getNextSequence("chat")) + "|" + text);
+		};
+
 	// set function to be called when the connection is made
-	websocket.setOnConnect([](ams::ProtocolBase * protocol, ams::Connection & connection)
+	websocket.setOnConnect([say](ams::ProtocolBase * protocol, ams::Connection & connection)
 		{
-			string msg = std::to_string(connection.sock) + " has joined to the server";
-			protocol->broadcast(msg);
+			say(std::to_string(connection.sock) + " has joined to the server");
 		});
 
 	// set function to be called when data is received by the websocket
-	websocket.setOnReceive([](ams::ProtocolBase * protocol, ams::Connection & connection, const string & data)
+	websocket.setOnReceive([&websocket, say](ams::ProtocolBase * protocol, ams::Connection & connection, const string & data)
 		{
-			string msg = std::to_string(connection.sock) + " : " + data;
-			protocol->broadcast(msg);
+			if (data.compare(0, 8, "/resume ") == 0)	// the client tells us the last message it saw
+			{
+				// catch up, then receive new messages as they come, nothing can be published in between
+				websocket.replay(connection, "chat", std::strtoull(data.c_str() + 8, nullptr, 10));
+				websocket.subscribe(connection, "chat");
+				return;
+			}
+			say(std::to_string(connection.sock) + " : " + data);
 		});
 
 	// set the function to be called when the websocket disconnects
-	websocket.setOnDisconnect([](ams::ProtocolBase * protocol, ams::Connection & connection)
+	websocket.setOnDisconnect([say](ams::ProtocolBase * protocol, ams::Connection & connection)
 		{
-			string msg = std::to_string(connection.sock) + " has left the server";
-			protocol->broadcast(msg);
+			say(std::to_string(connection.sock) + " has left the server");
 		});
 
 	http.addUpgradeProtocol("websocket", &websocket);
@@ -12,65 +12,65 @@
 #ifndef AMS_BASE64_HPP
 #define AMS_BASE64_HPP
 
+#include <stdint.h>
+#include <cstddef>
 #include <string>
 
 namespace ams
 {
-	/// convert a string of 8-bit data to 64-bit encoding
+	/// Number of characters needed to encode some data
+	/// @param size Number of bytes to be encoded
+	/// @return Encoded length, including padding
+	constexpr size_t getBase64Length(const size_t size)
+	{
+		return (size + 2) / 3 * 4;
+	}
+
+	/// Encode data straight into a caller's buffer, no allocations
 	/// @param data Character buffer containing the data to encode
 	/// @param size Number of bytes to be encoded
-	static const std::string encodeBase64(const uint8_t * data, const int size)
+	/// @param output [out] Room for getBase64Length(size) characters, not null-terminated
+	/// @return Number of characters written
+	inline size_t writeBase64(const uint8_t * data, const size_t size, char * output)
 	{
 		// As per RFC-4648
-		std::string charSet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		static const char charSet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		const uint8_t mask6Bit = 63;
 
-		std::string result;
-		uint8_t mask6Bit = 63;
-		int i = 0;
-		while (i < size)
+		char * position = output;
+		size_t i = 0;
+		for (; i + 3 <= size; i += 3)	// whole quanta
 		{
-			uint32_t quantum = 0;
-
-			quantum = data[i] << 16;
-
-			i++;
-
-			if (i < size)
-			{
-				quantum += data[i] << 8;
-
-				i++;
-				if (i < size)
-				{
-					quantum += data[i];
-					i++;
-				}
-			}
-
-			uint8_t temp;
-			temp = (quantum >> 18) & mask6Bit;
-			result += charSet[temp];
-
-			temp = (quantum >> 12) & mask6Bit;
-			result += charSet[temp];
-
-			temp = (quantum >> 6) & mask6Bit;
-			result += charSet[temp];
-
-			temp = (quantum)& mask6Bit;
-			result += charSet[temp];
+			uint32_t quantum = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+			*position++ = charSet[(quantum >> 18) & mask6Bit];
+			*position++ = charSet[(quantum >> 12) & mask6Bit];
+			*position++ = charSet[(quantum >> 6) & mask6Bit];
+			*position++ = charSet[quantum & mask6Bit];
 		}
 
-		if (size % 3 >= 1)
+		if (i < size)	// one or two bytes left, pad to a full quantum
 		{
-			result[result.length() - 1] = '=';
-
-			if (size % 3 == 1)
+			uint32_t quantum = data[i] << 16;
+			if (i + 1 < size)
 			{
-				result[result.length() - 2] = '=';
+				quantum |= data[i + 1] << 8;
 			}
+			*position++ = charSet[(quantum >> 18) & mask6Bit];
+			*position++ = charSet[(quantum >> 12) & mask6Bit];
+			*position++ = i + 1 < size ? charSet[(quantum >> 6) & mask6Bit] : '=';
+			*position++ = '=';
 		}
 
+		return position - output;
+	}
+
+	/// convert a string of 8-bit data to 64-bit encoding
+	/// @param data Character buffer containing the data to encode
+	/// @param size Number of bytes to be encoded
+	static const std::string encodeBase64(const uint8_t * data, const int size)
+	{
+		std::string result(getBase64Length(size), '\0');
+		writeBase64(data, size, &result[0]);
 		return result;
 	}
 }
@@ -20,4 +20,14 @@ TEST_CASE("Convert to base64")
 		uint8_t data[] = "light work";
 		REQUIRE(ams::encodeBase64(data, 10) == "bGlnaHQgd29yaw==");
 	}
-}
\ No newline at end of file
+
+	SECTION("Write into a buffer")
+	{
+		uint8_t data[] = "light work.";
+		char output[16];
+		REQUIRE(ams::getBase64Length(11) == sizeof(output));
+		REQUIRE(ams::writeBase64(data, 11, output) == sizeof(output));
+		REQUIRE(std::string(output, sizeof(output)) == "bGlnaHQgd29yay4=");
+		REQUIRE(ams::writeBase64(data, 0, output) == 0);
+	}
+}
@@ -11,20 +11,38 @@
 #define AMS_CONNECTION_HPP
 
 #include <chrono>
+#include <memory>	// shared_ptr
+#include <string>
+#include <utility>	// forward
 #include "Platforms.hpp"
+#include "OutboundQueue.hpp"
 
 namespace ams
 {
+	/// Limits on how long a connection may take to send its data.
+	/// Stops slow or silent clients from holding a connection slot indefinitely
+	struct ConnectionDeadlines
+	{
+		std::chrono::milliseconds firstByte{ 5000 };	/// time allowed between accepting a connection and its first data
+		std::chrono::milliseconds headers{ 10000 };		/// time allowed between the first byte and the end of the headers, dribbling data doesn't extend it
+		std::chrono::milliseconds rateGracePeriod{ 2000 };	/// time a body may take before the minimum rate is enforced
+		unsigned int minimumBytesPerSecond = 1024;		/// slowest accepted transfer rate while a body is received
+		std::chrono::milliseconds idle{ 0 };			/// time a connection may wait between messages, 0 for no limit
+	};
+
 	/// Represents a single connection between the server and a client
 	class Connection
 	{
 	public:
+		/// What the connection is currently waiting for, determines which deadline applies
+		enum class Phase { AWAITING_FIRST_BYTE, READING_HEADERS, READING_BODY, IDLE };
+
 		/// Default constructor
-		Connection() { updateTime(); };
+		Connection() { updateTime(); setPhase(Phase::AWAITING_FIRST_BYTE, lastUse); };
 
 		/// Constructor
 		/// @param sock The socket used by this connection
-		Connection(SOCKET sock) : sock(sock) { updateTime(); }
+		Connection(SOCKET sock) : sock(sock) { updateTime(); setPhase(Phase::AWAITING_FIRST_BYTE, lastUse); }
 
 		/// Comparison operator, used to search for connections
 		/// @param other The connection being compared
@@ -45,8 +63,105 @@ namespace ams
 			lastUse = std::chrono::steady_clock::now();
 		}
 
+		/// Move the connection to a new phase.
+		/// The phase timer only restarts when the phase actually changes, so deadlines can't be extended by dribbling data
+		/// @param newPhase The phase being entered
+		/// @param now The current time
+		void setPhase(const Phase newPhase, const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now())
+		{
+			if (newPhase != phase)
+			{
+				phase = newPhase;
+				phaseStart = now;
+				phaseBytes = 0;
+			}
+		}
+
+		/// Check if the connection took too long in its current phase
+		/// @param deadlines The limits to check against
+		/// @param now The current time
+		/// @return If the connection should be closed
+		bool isPastDeadline(const ConnectionDeadlines & deadlines, const std::chrono::steady_clock::time_point now) const
+		{
+			auto elapsed = now - phaseStart;
+			switch (phase)
+			{
+				case Phase::AWAITING_FIRST_BYTE:
+					return elapsed > deadlines.firstByte;
+
+				case Phase::READING_HEADERS:
+					return elapsed > deadlines.headers;
+
+				case Phase::READING_BODY:
+				{
+					if (elapsed <= deadlines.rateGracePeriod)
+					{
+						return false;
+					}
+					auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+					return phaseBytes * 1000 < static_cast<uint64_t>(deadlines.minimumBytesPerSecond) * milliseconds;
+				}
+
+				case Phase::IDLE:
+					return deadlines.idle.count() != 0 && now - lastUse > deadlines.idle;
+			}
+			return false;
+		}
+
+		/// Attach application state to the connection, replacing any already attached.
+		/// It is destroyed when the connection closes, so a reused socket never inherits it.
+		/// The state is built in place and never copied or moved, so it may be move-only and pointers to it stay valid
+		/// while the connection is open. Copies of a Connection share the state, the protocols only copy one to hand it over
+		/// @param arguments Passed to the state's constructor
+		/// @return The new state
+		template <typename UserData, typename... Arguments>
+		UserData & setUserData(Arguments &&... arguments)
+		{
+			std::shared_ptr<UserData> data = std::make_shared<UserData>(std::forward<Arguments>(arguments)...);
+			userData = data;
+			userDataType = getUserDataType<UserData>();
+			return *data;
+		}
+
+		/// Get the application state attached with setUserData
+		/// @return The state, nullptr if there is none or it is of a different type
+		template <typename UserData>
+		UserData * getUserData()
+		{
+			return userDataType == getUserDataType<UserData>() ? static_cast<UserData*>(userData.get()) : nullptr;
+		}
+
+		/// Remove the application state
+		void clearUserData()
+		{
+			userData.reset();
+			userDataType = nullptr;
+		}
+
 		SOCKET sock;	/// Socket that this connection uses
 		std::chrono::steady_clock::time_point lastUse;	/// The last time that this connection did something, used for connection expiry
+		Phase phase = Phase::IDLE;	/// what the connection is waiting for
+		std::chrono::steady_clock::time_point phaseStart;	/// when the current phase began
+		uint64_t phaseBytes = 0;	/// bytes received since the current phase began
+		std::string pendingData;	/// received data that is waiting for the rest of its message
+		OutboundQueue outbound;	/// data waiting for the socket to accept it
+		bool isClosingWhenSent = false;	/// close the connection once the outbound queue is empty
+		bool isOverflowed = false;	/// the outbound queue passed its limit, the connection is about to be closed
+		bool isWaitingForDrain = false;	/// a producer was told to stop sending, tell it when the queue drains
+		bool isWriteHeld = false;	/// queued data is waiting for more to join it rather than for the socket, see WriteCoalescing
+		std::chrono::steady_clock::time_point writeHeldSince;	/// when the held data was queued
+
+	private:
+		/// @return An address unique to a type, identifies the type of the state without RTTI
+		template <typename UserData>
+		static const void * getUserDataType()
+		{
+			static const char type = 0;
+			return &type;
+		}
+
+		std::shared_ptr<void> userData;	/// application state, on the heap so it stays put when connections move
+		const void * userDataType = nullptr;	/// type of the state, see getUserDataType
 	};
 }
 
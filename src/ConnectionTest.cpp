@@ -0,0 +1,57 @@
+#include <memory>
+#include <string>
+#include <vector>
+#include "../test/catch.hpp"
+#include "Connection.hpp"
+
+using namespace ams;
+
+TEST_CASE("Connection User Data", "[connection]")
+{
+	struct ChatUser
+	{
+		std::string name;
+		int messageCount = 0;
+	};
+
+	Connection connection(INVALID_SOCKET);
+	REQUIRE(connection.getUserData<ChatUser>() == nullptr);
+
+	SECTION("Attach and replace")
+	{
+		ChatUser & user = connection.setUserData<ChatUser>(ChatUser{ "alex", 0 });
+		user.messageCount++;
+		REQUIRE(connection.getUserData<ChatUser>()->name == "alex");
+		REQUIRE(connection.getUserData<ChatUser>()->messageCount == 1);
+		REQUIRE(connection.getUserData<int>() == nullptr);	// wrong type
+
+		connection.setUserData<int>(7);
+		REQUIRE(connection.getUserData<ChatUser>() == nullptr);
+		REQUIRE(*connection.getUserData<int>() == 7);
+		connection.clearUserData();
+		REQUIRE(connection.getUserData<int>() == nullptr);
+	}
+
+	SECTION("Move-only state")
+	{
+		connection.setUserData<std::unique_ptr<int>>(std::make_unique<int>(5));
+		REQUIRE(**connection.getUserData<std::unique_ptr<int>>() == 5);
+	}
+
+	SECTION("Handed over, not copied")
+	{
+		ChatUser * user = &connection.setUserData<ChatUser>(ChatUser{ "alex", 0 });
+		Connection upgraded = connection;	// as when a connection moves to the websocket protocol
+		REQUIRE(upgraded.getUserData<ChatUser>() == user);
+
+		std::vector<Connection> connections;	// stored, then moved as the table grows and removes entries
+		connections.push_back(upgraded);
+		for (int i = 0; i < 16; i++)
+		{
+			connections.push_back(Connection(INVALID_SOCKET));
+		}
+		connections.front() = std::move(connections.back());
+		connections.back() = std::move(upgraded);
+		REQUIRE(connections.back().getUserData<ChatUser>() == user);	// pointers stay valid
+	}
+}
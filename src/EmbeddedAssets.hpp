@@ -0,0 +1,134 @@
+/******************************
+ * @file EmbeddedAssets.hpp
+ * Alex's MicroServer (AMS)
+ * @author Alex Schlieck
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * Read-only web files that are compiled into the executable.
+ * Packs are generated from a pages directory by tools/AssetPacker.cpp
+ ******************************/
+
+#ifndef AMS_EMBEDDED_ASSETS_HPP
+#define AMS_EMBEDDED_ASSETS_HPP
+
+#include <stdint.h>
+#include <cstring>	// strlen, memcmp
+#include <string>
+#include <vector>
+
+namespace ams
+{
+	/// A single file stored inside the executable
+	struct EmbeddedAsset
+	{
+		const char * path;			/// request path, including leading slash (eg "/index.html")
+		const uint8_t * response;	/// complete HTTP response: status line, headers and file contents
+		size_t responseSize;		/// number of bytes in the response
+		const char * etag;			/// quoted entity tag of the file contents
+		const char * mimeType;		/// content type sent to the client
+	};
+
+	/// Hash used to index embedded assets.
+	/// FNV-1a, mixed with a seed that is chosen by the packer so no two paths share a slot
+	/// @param data Characters to hash
+	/// @param size Number of characters
+	/// @param seed Value used to vary the hash
+	/// @return 32 bit hash of the data
+	constexpr uint32_t hashAssetPath(const char * data, const size_t size, const uint32_t seed)
+	{
+		uint32_t hash = 2166136261u ^ seed;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= static_cast<uint8_t>(data[i]);
+			hash *= 16777619u;
+		}
+		return hash ^ (hash >> 15);
+	}
+
+	/// A set of embedded assets indexed by a perfect hash of their paths
+	struct EmbeddedAssetPack
+	{
+		const EmbeddedAsset * assets;	/// all files in the pack
+		size_t assetCount;				/// number of files
+		const int32_t * slots;			/// hash slot to asset index, -1 for unused slots
+		size_t slotCount;				/// number of slots, always a power of 2
+		uint32_t seed;					/// seed that makes the hash perfect for this set of paths
+
+		/// Find the asset stored for a request path
+		/// @param path The requested path, including leading slash
+		/// @param size Number of characters in the path
+		/// @return Pointer to the asset, nullptr if the pack doesn't contain the path
+		const EmbeddedAsset * find(const char * path, const size_t size) const
+		{
+			if (slotCount == 0)
+			{
+				return nullptr;
+			}
+
+			int32_t index = slots[hashAssetPath(path, size, seed) & (slotCount - 1)];
+			if (index < 0)
+			{
+				return nullptr;
+			}
+
+			// a perfect hash only separates known paths, unknown ones still need to be compared
+			const EmbeddedAsset & asset = assets[index];
+			if (strlen(asset.path) != size || memcmp(asset.path, path, size) != 0)
+			{
+				return nullptr;
+			}
+			return &asset;
+		}
+
+		/// Find the asset stored for a request path
+		/// @param path The requested path, including leading slash
+		/// @return Pointer to the asset, nullptr if the pack doesn't contain the path
+		const EmbeddedAsset * find(const std::string & path) const
+		{
+			return find(path.data(), path.length());
+		}
+	};
+
+	/// Search for a seed that gives every path its own slot.
+	/// Used when generating a pack, not at run time
+	/// @param paths Every path that will be stored in the pack
+	/// @param seed [out] The seed that was found
+	/// @return Slot table mapping each hash slot to the index of its path, -1 for unused slots
+	inline std::vector<int32_t> buildAssetSlots(const std::vector<std::string> & paths, uint32_t & seed)
+	{
+		size_t slotCount = 1;
+		while (slotCount < paths.size() * 2)	// keep the table half empty so a seed is found quickly
+		{
+			slotCount <<= 1;
+		}
+
+		for (seed = 0; ; seed++)
+		{
+			std::vector<int32_t> slots(slotCount, -1);
+			bool isPerfect = true;
+			for (size_t i = 0; i < paths.size() && isPerfect; i++)
+			{
+				int32_t & slot = slots[hashAssetPath(paths[i].data(), paths[i].length(), seed) & (slotCount - 1)];
+				if (slot != -1)	// collision, try the next seed
+				{
+					isPerfect = false;
+				}
+				slot = static_cast<int32_t>(i);
+			}
+
+			if (isPerfect)
+			{
+				return slots;
+			}
+
+			if (seed == 0xffff)	// table too crowded, grow it
+			{
+				slotCount <<= 1;
+				seed = 0;
+			}
+		}
+	}
+}
+
+#endif // !AMS_EMBEDDED_ASSETS_HPP
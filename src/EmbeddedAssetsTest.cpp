@@ -0,0 +1,47 @@
+#include <algorithm>
+#include "../test/catch.hpp"
+#include "EmbeddedAssets.hpp"
+
+using namespace ams;
+
+TEST_CASE("Embedded Assets", "[http],[assets]")
+{
+	std::vector<std::string> paths = { "/index.html", "/test.html", "/test.png", "/favicon.ico", "/altPages/index.html" };
+	const uint8_t data[] = { 'o', 'k' };
+
+	uint32_t seed;
+	std::vector<int32_t> slots = buildAssetSlots(paths, seed);
+
+	std::vector<EmbeddedAsset> assets;
+	for (auto & path : paths)
+	{
+		assets.push_back({ path.c_str(), data, sizeof(data), "\"0\"", "text/plain" });
+	}
+	EmbeddedAssetPack pack = { assets.data(), assets.size(), slots.data(), slots.size(), seed };
+
+	SECTION("Slots are unique")
+	{
+		REQUIRE((slots.size() & (slots.size() - 1)) == 0);	// power of 2
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			REQUIRE(std::count(slots.begin(), slots.end(), static_cast<int32_t>(i)) == 1);
+		}
+	}
+
+	SECTION("Find every path")
+	{
+		for (auto & path : paths)
+		{
+			const EmbeddedAsset * asset = pack.find(path);
+			REQUIRE(asset != nullptr);
+			REQUIRE(path == asset->path);
+		}
+	}
+
+	SECTION("Unknown paths are not found")
+	{
+		REQUIRE(pack.find("/missing.html") == nullptr);
+		REQUIRE(pack.find("/index.htm") == nullptr);
+		REQUIRE(pack.find("") == nullptr);
+	}
+}
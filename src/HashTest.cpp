@@ -1,5 +1,6 @@
 #include "../test/catch.hpp"
 #include "SHA-1.hpp"
+#include "WebsocketAcceptKey.hpp"
 
 using namespace ams;
 
@@ -168,4 +169,32 @@ TEST_CASE("Finish Empty Hash", "[sha1],[finish],[hash]")
 		CHECK(result[0] == 0xa9993e36);
 		CHECK(result[4] == 0x9cd0d89d);
 	}*/
-}
\ No newline at end of file
+}
+
+TEST_CASE("Websocket Accept Key", "[sha1],[websocket],[hash]")
+{
+	SECTION("Example from RFC 6455")
+	{
+		char acceptKey[WEBSOCKET_ACCEPT_LENGTH];
+		writeWebsocketAcceptKey("dGhlIHNhbXBsZSBub25jZQ==", acceptKey);
+		REQUIRE(std::string(acceptKey, sizeof(acceptKey)) == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+	}
+
+	SECTION("Matches the general hash")
+	{
+		SHA1 sha1;
+		for (int i = 0; i < 200; i++)
+		{
+			uint8_t nonce[16];
+			for (int j = 0; j < 16; j++)
+			{
+				nonce[j] = static_cast<uint8_t>(i * 31 + j * 7);
+			}
+			std::string key = encodeBase64(nonce, sizeof(nonce));
+
+			char acceptKey[WEBSOCKET_ACCEPT_LENGTH];
+			writeWebsocketAcceptKey(key.data(), acceptKey);
+			REQUIRE(std::string(acceptKey, sizeof(acceptKey)) == sha1.hashStringAndGetBase64(key + WEBSOCKET_GUID));
+		}
+	}
+}
@@ -12,65 +12,251 @@
 #define AMS_HELPER_FUNCTIONS_HPP
 
 #include <string>
-#include <sstream>
+#include <string_view>
 #include <fstream>
 
 namespace ams
 {
+	/// Tries to find a variable name/value pair from the input without copying any data
+	/// @param variableName The name of the variable being sought
+	/// @param input The text in which to search for the variable
+	/// @param delimiter The character separating tokens (parts of the string)
+	/// @return View into the input of the first chunk after the variable name. Empty if the variable isn't found
+	inline std::string_view readVariableFromView(const std::string_view variableName, const std::string_view input, const char delimiter = ' ')
+	{
+		std::string_view result;
+		std::string_view::size_type lineStart = 0;
+
+		while (lineStart < input.length())	// iterate through all lines of input
+		{
+			std::string_view::size_type lineEnd = input.find('\n', lineStart);
+			if (lineEnd == std::string_view::npos)
+			{
+				lineEnd = input.length();
+			}
+			std::string_view line = input.substr(lineStart, lineEnd - lineStart);
+			lineStart = lineEnd + 1;
+
+			std::string_view::size_type position = line.find(variableName);
+			if (position != std::string_view::npos)	// if found within this line
+			{
+				std::string_view::size_type start = line.find(delimiter, position) + 1;	// go to start of next token, skip delimiter
+				std::string_view::size_type end = line.find(delimiter, start);	// go to end of next token
+				if (end == std::string_view::npos)
+				{
+					end = line.length() - 1;
+				}
+				result = line.substr(start, end - start);	// get the value
+			}
+		}
+		return result;
+	}
+
 	/// Tries to find a variable name/value pair from the input string
 	/// @param variableName The name of the variable being sought
 	/// @param input The string in which to search for the variable
 	/// @param delimiter The character separating tokens (parts of the string)
 	/// @return The first chunk of the string after the variable name. Empty if the variable isn't found
-	std::string readVariableFromString(const std::string & variableName, const std::string & input, const char delimiter = ' ')
+	inline std::string readVariableFromString(const std::string & variableName, const std::string & input, const char delimiter = ' ')
 	{
-		// have to read line by line
-		std::istringstream ss(input);
+		return std::string(readVariableFromView(variableName, input, delimiter));
+	}
 
-		std::string line;
-		std::string result;
+	/// Compare two strings, treating ASCII letters of either case as equal
+	/// @param first One string
+	/// @param second The other string
+	/// @return If they differ in nothing but case
+	inline bool isEqualIgnoringCase(const std::string_view first, const std::string_view second)
+	{
+		if (first.length() != second.length())
+		{
+			return false;
+		}
+		for (std::string_view::size_type i = 0; i < first.length(); i++)
+		{
+			char a = first[i] >= 'A' && first[i] <= 'Z' ? first[i] - 'A' + 'a' : first[i];
+			char b = second[i] >= 'A' && second[i] <= 'Z' ? second[i] - 'A' + 'a' : second[i];
+			if (a != b)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/// Look for a token in a comma-separated header value such as Connection: keep-alive, Upgrade
+	/// @param list The header's value
+	/// @param token The token being sought, matched regardless of case
+	/// @return If the token is one of the list's entries
+	inline bool isTokenInList(const std::string_view list, const std::string_view token)
+	{
+		std::string_view::size_type start = 0;
+		while (start <= list.length())
+		{
+			std::string_view::size_type end = list.find(',', start);
+			if (end == std::string_view::npos)
+			{
+				end = list.length();
+			}
+			std::string_view entry = list.substr(start, end - start);
+			std::string_view::size_type first = entry.find_first_not_of(" \t");
+			if (first != std::string_view::npos
+				&& isEqualIgnoringCase(entry.substr(first, entry.find_last_not_of(" \t") + 1 - first), token))
+			{
+				return true;
+			}
+			start = end + 1;
+		}
+		return false;
+	}
 
-		while (getline(ss, line))	// iterate through all lines of string
+	/// Find a header in a request or response without copying any data.
+	/// Header names are matched regardless of case, as HTTP requires
+	/// @param headerName The name of the header, without the colon
+	/// @param input The headers in which to search
+	/// @param lineStart [in,out] Where to start searching, moved past the line that was found so the search can continue
+	/// @return View into the input of the header's whole value, without surrounding whitespace. Empty if the header isn't found
+	inline std::string_view readHeaderFromView(const std::string_view headerName, const std::string_view input, std::string_view::size_type & lineStart)
+	{
+		while (lineStart < input.length())
 		{
-			std::string::size_type position = line.find(variableName);
-			if (position != std::string::npos)	// if found within this line
+			std::string_view::size_type lineEnd = input.find('\n', lineStart);
+			if (lineEnd == std::string_view::npos)
 			{
-				std::string::size_type start = line.find(delimiter, position) + 1;	// go to start of next token, skip delimiter
-				std::string::size_type end = line.find(delimiter, start);	// go to end of next token
-				if (end == std::string::npos)
+				lineEnd = input.length();
+			}
+			std::string_view line = input.substr(lineStart, lineEnd - lineStart);
+			lineStart = lineEnd + 1;
+
+			if (line.length() > headerName.length() && line[headerName.length()] == ':'
+				&& isEqualIgnoringCase(line.substr(0, headerName.length()), headerName))
+			{
+				std::string_view value = line.substr(headerName.length() + 1);
+				std::string_view::size_type start = value.find_first_not_of(" \t");
+				std::string_view::size_type end = value.find_last_not_of(" \t\r");
+				return start == std::string_view::npos ? std::string_view() : value.substr(start, end - start + 1);
+			}
+		}
+		return std::string_view();
+	}
+
+	/// Find the first line of a header in a request or response without copying any data
+	/// @param headerName The name of the header, without the colon, matched regardless of case
+	/// @param input The headers in which to search
+	/// @return View into the input of the header's whole value, without surrounding whitespace. Empty if the header isn't found
+	inline std::string_view readHeaderFromView(const std::string_view headerName, const std::string_view input)
+	{
+		std::string_view::size_type lineStart = 0;
+		return readHeaderFromView(headerName, input, lineStart);
+	}
+
+	/// Collect a comma-separated header that may be split over several lines, such as Sec-WebSocket-Extensions
+	/// @param headerName The name of the header, without the colon, matched regardless of case
+	/// @param input The headers in which to search
+	/// @return The values of every line, joined with commas as if they had been sent on one. Empty if the header isn't found
+	inline std::string readHeaderList(const std::string_view headerName, const std::string_view input)
+	{
+		std::string list;
+		std::string_view::size_type lineStart = 0;
+		while (lineStart < input.length())
+		{
+			std::string_view value = readHeaderFromView(headerName, input, lineStart);
+			if (!value.empty())
+			{
+				if (!list.empty())
 				{
-					end = line.length() - 1;
+					list += ", ";
 				}
-				result = line.substr(start, end - start);	// get the value
+				list += value;
 			}
 		}
-		return result;
+		return list;
 	}
 
-	/// Try to open a file from disk and write the resulting data into a string
+	/// Check an If-None-Match header against the entity tag of a resource, using weak comparison (RFC 7232 section 3.2).
+	/// The header may list several tags, any of which may be weak (W/"..."), or be * to match any version
+	/// @param ifNoneMatch The header's value
+	/// @param etag The quoted entity tag of the resource
+	/// @return If the client already has this version of the resource
+	inline bool isEntityTagMatch(const std::string_view ifNoneMatch, std::string_view etag)
+	{
+		if (etag.compare(0, 2, "W/") == 0)
+		{
+			etag.remove_prefix(2);
+		}
+
+		std::string_view::size_type position = 0;
+		while (position < ifNoneMatch.length())
+		{
+			position = ifNoneMatch.find_first_not_of(" \t,", position);
+			if (position == std::string_view::npos)
+			{
+				break;
+			}
+			if (ifNoneMatch[position] == '*')
+			{
+				return true;
+			}
+			if (ifNoneMatch.compare(position, 2, "W/") == 0)	// weak comparison ignores the weakness of either tag
+			{
+				position += 2;
+			}
+			if (position >= ifNoneMatch.length() || ifNoneMatch[position] != '"')	// malformed, nothing after it can be trusted
+			{
+				break;
+			}
+			std::string_view::size_type end = ifNoneMatch.find('"', position + 1);
+			if (end == std::string_view::npos)
+			{
+				break;
+			}
+			if (ifNoneMatch.substr(position, end + 1 - position) == etag)
+			{
+				return true;
+			}
+			position = end + 1;
+		}
+		return false;
+	}
+
+	/// Try to open a file from disk and append its contents to a string
 	/// @param filePath Path and name of file to open, relative to the running executable
-	/// @return String containing contents of the file. Can also contain binary data
-	std::string readFile(const std::string & filePath)
+	/// @param result String the contents are appended to. Can be any string type, such as one using an arena allocator
+	/// @return Number of bytes read, 0 if the file couldn't be opened
+	template <typename StringType>
+	size_t appendFile(const char * filePath, StringType & result)
 	{
-		std::string result;
+		std::ifstream file;
+		file.rdbuf()->pubsetbuf(nullptr, 0);	// unbuffered, data is read straight into the result
+		file.open(filePath, std::ios::binary);
+		if (!file.is_open())
+		{
+			return 0;
+		}
 
-		std::ifstream file(filePath, std::ios::binary);
-		if (file.is_open())
+		// go to end of data to calculate size
+		file.seekg(0, std::ios::end);
+		std::streamoff dataSize = file.tellg();
+		if (dataSize <= 0)
 		{
-			int dataSize;
-			// go to end of data to calculate size
-			file.seekg(0, std::ios::end);
-			// TODO: is there a safer way to do this?
-			dataSize = (int)file.tellg();
-
-			// go back to begining of data to begin read
-			file.seekg(0, std::ios::beg);
-			char* buffer = new char[dataSize];
-			file.read(buffer, dataSize);
-			result.assign(buffer, dataSize);
-			file.close();
-			delete[] buffer;
+			return 0;
 		}
+
+		// go back to begining of data to begin read
+		file.seekg(0, std::ios::beg);
+		size_t start = result.length();
+		result.resize(start + static_cast<size_t>(dataSize));
+		file.read(&result[start], dataSize);
+		return static_cast<size_t>(dataSize);
+	}
+
+	/// Try to open a file from disk and write the resulting data into a string
+	/// @param filePath Path and name of file to open, relative to the running executable
+	/// @return String containing contents of the file. Can also contain binary data
+	inline std::string readFile(const std::string & filePath)
+	{
+		std::string result;
+		appendFile(filePath.c_str(), result);
 		return result;
 	}
 
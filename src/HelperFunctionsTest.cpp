@@ -0,0 +1,71 @@
+#include "../test/catch.hpp"
+#include "HelperFunctions.hpp"
+
+using namespace ams;
+
+TEST_CASE("Header Parsing", "[http]")
+{
+	const char * headers = "GET / HTTP/1.1\r\nHost: localhost\r\nif-none-match:  \"a\", W/\"b\" \r\nX-Empty:\r\n\r\n";
+
+	SECTION("Names match regardless of case")
+	{
+		REQUIRE(readHeaderFromView("Host", headers) == "localhost");
+		REQUIRE(readHeaderFromView("HOST", headers) == "localhost");
+		REQUIRE(readHeaderFromView("If-None-Match", headers) == "\"a\", W/\"b\"");	// whole value, trimmed
+	}
+
+	SECTION("Missing and empty headers")
+	{
+		REQUIRE(readHeaderFromView("Hos", headers).empty());	// only whole names match
+		REQUIRE(readHeaderFromView("Accept", headers).empty());
+		REQUIRE(readHeaderFromView("X-Empty", headers).empty());
+	}
+
+	SECTION("Lists split over several lines")
+	{
+		const char * split = "GET / HTTP/1.1\r\nsec-websocket-protocol: a, b\r\nX-Note: Sec-WebSocket-Protocol: c\r\nSec-WebSocket-Protocol:d\r\n\r\n";
+		REQUIRE(readHeaderList("Sec-WebSocket-Protocol", split) == "a, b, d");	// header names only at the start of a line
+		REQUIRE(readHeaderList("Accept", split).empty());
+	}
+}
+
+TEST_CASE("Entity Tag Match", "[http]")
+{
+	SECTION("Single tags")
+	{
+		REQUIRE(isEntityTagMatch("\"abc\"", "\"abc\""));
+		REQUIRE(!isEntityTagMatch("\"abd\"", "\"abc\""));
+		REQUIRE(!isEntityTagMatch("", "\"abc\""));
+	}
+
+	SECTION("Weak comparison")
+	{
+		REQUIRE(isEntityTagMatch("W/\"abc\"", "\"abc\""));
+		REQUIRE(isEntityTagMatch("\"abc\"", "W/\"abc\""));
+	}
+
+	SECTION("Lists and wildcard")
+	{
+		REQUIRE(isEntityTagMatch("\"x\", W/\"abc\"", "\"abc\""));
+		REQUIRE(isEntityTagMatch("\"x\",\"abc\"", "\"abc\""));
+		REQUIRE(!isEntityTagMatch("\"x\", \"y\"", "\"abc\""));
+		REQUIRE(isEntityTagMatch("*", "\"abc\""));
+	}
+
+	SECTION("Malformed lists")
+	{
+		REQUIRE(!isEntityTagMatch("abc", "\"abc\""));	// unquoted
+		REQUIRE(!isEntityTagMatch("\"abc", "\"abc\""));	// unterminated
+		REQUIRE(!isEntityTagMatch("W/", "\"abc\""));
+	}
+}
+
+TEST_CASE("Header Token Lists", "[http]")
+{
+	REQUIRE(isTokenInList("Upgrade", "Upgrade"));
+	REQUIRE(isTokenInList("keep-alive, upgrade", "Upgrade"));	// any case, any position
+	REQUIRE(isTokenInList("keep-alive,Upgrade ", "Upgrade"));
+	REQUIRE(!isTokenInList("keep-alive", "Upgrade"));
+	REQUIRE(!isTokenInList("Upgrade-Insecure", "Upgrade"));	// whole entries only
+	REQUIRE(!isTokenInList("", "Upgrade"));
+}
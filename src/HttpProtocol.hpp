@@ -12,8 +12,12 @@
 #define AMS_HTTP_PROTOCOL_HPP
 
 #include <map>
+#include <string_view>
+#include <memory_resource>	// per-request arena
 #include "ProtocolBase.hpp"
 #include "HelperFunctions.hpp"
+#include "MissingFileCache.hpp"
+#include "EmbeddedAssets.hpp"
 
 using std::string;
 
@@ -25,7 +29,7 @@ namespace ams
 	{
 	public:
 		/// Default Constructor
-		HttpProtocol(int port = 80) : ProtocolBase(10, port), path(DEFAULT_PATH) {}
+		HttpProtocol(int port = 80) : ProtocolBase(10, port), path(DEFAULT_PATH), embeddedAssets(nullptr) {}
 
 		/// Destructor
 		virtual ~HttpProtocol() {}
@@ -53,6 +57,22 @@ namespace ams
 		void setPath(const string & filePath)
 		{
 			path = filePath;
+			missingFiles.clear();	// cached paths refer to the old location
+		}
+
+		/// Serve files from a pack compiled into the executable instead of from disk.
+		/// Once set, the file system is never accessed. Packs are generated by tools/AssetPacker.cpp
+		/// @param pack The pack to serve from, nullptr to go back to serving from disk
+		void setEmbeddedAssets(const EmbeddedAssetPack * pack)
+		{
+			embeddedAssets = pack;
+		}
+
+		/// Forget which files were found to be missing.
+		/// Call when files are added to the served directory so they are found immediately
+		void invalidateFileCache()
+		{
+			missingFiles.clear();
 		}
 
 	protected:
@@ -61,18 +81,62 @@ namespace ams
 		/// @param data String containing data received by connection
 		virtual void receiveData(Connection & connection, const std::string & data) override
 		{
-			gaf::util::Log::debug("HttpProtocol::onReceive\nReceived message\n-----------------\n" + data);
+			// headers can arrive over several reads, hold on to them until they are complete
+			if (connection.pendingData.empty() && isHeaderComplete(data))	// common case, whole request in one read
+			{
+				handleRequest(connection, data);
+				return;
+			}
+
+			if (connection.pendingData.length() + data.length() > MAX_HEADER_SIZE)
+			{
+				gaf::util::Log::warning("HTTP headers too large, closing connection");
+				sendData(connection, HEADERS_TOO_LARGE_RESPONSE);
+				closeWhenSent(connection);
+				return;
+			}
+
+			connection.pendingData += data;
+			if (isHeaderComplete(connection.pendingData))
+			{
+				std::string request = std::move(connection.pendingData);
+				connection.pendingData.clear();
+				handleRequest(connection, request);
+			}
+			else
+			{
+				connection.setPhase(Connection::Phase::READING_HEADERS);	// deadline runs from the first byte, not the latest one
+			}
+		}
+
+	private:
+		/// Respond to a complete request
+		/// @param connection Connection that made the request
+		/// @param data The request, including all headers
+		void handleRequest(Connection & connection, const std::string & data)
+		{
+			gaf::util::Log::debug(data, "HttpProtocol");
+
+			if (isOverloaded())	// shed new work so admitted requests stay fast
+			{
+				countShed();
+				sendServiceUnavailable(connection);
+				closeWhenSent(connection);
+				return;
+			}
 
-			string result;
+			// everything allocated while handling this request comes from the arena,
+			// which is released in one step when the request completes
+			std::pmr::monotonic_buffer_resource arena(requestArena, sizeof(requestArena));
 
 			// check for upgrade
-			string upgrade = readVariableFromString("Upgrade:", data);
+			std::string_view upgrade = readVariableFromView("Upgrade:", data);
 			if (!upgrade.empty())
 			{
 				auto pool = upgradeProtocols.find(upgrade);
 				if (pool != upgradeProtocols.end())
 				{
-					gaf::util::Log::debug("Upgrading to " + upgrade);
+					gaf::util::Log::debug("Upgrading to " + pool->first);
 					// move the connection to the upgrade pool
 					pool->second->addConnection(connection, data);
 					removeConnection(connection);
@@ -80,42 +144,98 @@ namespace ams
 				else
 				{
 					// upgrade failed, close connection
-					gaf::util::Log::warning("HTTP Upgrade to " + upgrade + " not supported by current server configuration");
+					gaf::util::Log::warning("HTTP Upgrade to " + string(upgrade) + " not supported by current server configuration");
 					closeConnection(connection);
 				}
 			}
 			else
 			{
-				string targetFile = readVariableFromString("GET", data);
-				if (targetFile.length() > 1)	// ignore leading slash
+				std::string_view targetFile = readVariableFromView("GET", data);
+				if (targetFile.length() <= 1)	// ignore leading slash
 				{
-					targetFile = path + targetFile;
+					targetFile = DEFAULT_FILE;
 				}
-				else
+
+				if (embeddedAssets != nullptr)
+				{
+					sendEmbeddedAsset(connection, targetFile, data);
+					closeWhenSent(connection);
+					return;
+				}
+
+				std::pmr::string filePath(path, &arena);
+				filePath += targetFile;
+
+				if (missingFiles.contains(filePath))	// known miss, don't touch the disk
 				{
-					targetFile = path + DEFAULT_FILE;
+					sendData(connection, NOT_FOUND_RESPONSE);
+					closeWhenSent(connection);
+					return;
 				}
 
-				result = readFile(targetFile);
-				if (result.empty())
+				std::pmr::string response(OK_RESPONSE_HEADER, &arena);
+				if (appendFile(filePath.c_str(), response) == 0)
 				{
-					result = "HTTP/1.1 404 Not Found\r\n\r\n";
+					missingFiles.add(filePath);
+					sendData(connection, NOT_FOUND_RESPONSE);
 				}
 				else
 				{
-					result = "HTTP/1.1 200 OK\r\n\r\n" + result;
+					sendBuffer(connection, response.data(), response.length());
 				}
 
-				sendData(connection, result);
-				closeConnection(connection);	// TODO: Explore keeping connection open
+				closeWhenSent(connection);	// TODO: Explore keeping connection open
 			}
 		}
 
-	private:
+		/// Tell the client the server is too busy, using the response built when the admission limits were set
+		/// @param connection Connection to respond to
+		void sendServiceUnavailable(Connection & connection)
+		{
+			sendData(connection, getServiceUnavailableResponse());
+		}
+
+		/// Check if the end of the headers has been received
+		/// @param data The data received so far
+		/// @return If the blank line ending the headers is present
+		static bool isHeaderComplete(const std::string & data)
+		{
+			return data.find("\r\n\r\n") != std::string::npos || data.find("\n\n") != std::string::npos;
+		}
+
+		/// Respond to a request with a file from the embedded pack
+		/// @param connection Connection that made the request
+		/// @param targetFile Requested path, including leading slash
+		/// @param request The full request, used to check for cached copies
+		void sendEmbeddedAsset(Connection & connection, const std::string_view targetFile, const string & request)
+		{
+			const EmbeddedAsset * asset = embeddedAssets->find(targetFile.data(), targetFile.length());
+			if (asset == nullptr)
+			{
+				sendData(connection, NOT_FOUND_RESPONSE);
+			}
+			else if (isEntityTagMatch(readHeaderFromView("If-None-Match", request), asset->etag))	// client already has this version
+			{
+				sendData(connection, "HTTP/1.1 304 Not Modified\r\nETag: " + string(asset->etag) + "\r\n\r\n");
+			}
+			else
+			{
+				sendBuffer(connection, reinterpret_cast<const char*>(asset->response), asset->responseSize);
+			}
+		}
+
+		static const size_t MAX_HEADER_SIZE = 16384;	/// largest request accepted, protects against endless headers
+		static const size_t ARENA_SIZE = 32768;	/// bytes available to a request before falling back to the heap
 		const string DEFAULT_PATH = "pages";
 		const string DEFAULT_FILE = "/index.html";
+		const string NOT_FOUND_RESPONSE = "HTTP/1.1 404 Not Found\r\n\r\n";
+		const string HEADERS_TOO_LARGE_RESPONSE = "HTTP/1.1 431 Request Header Fields Too Large\r\n\r\n";
+		const char * OK_RESPONSE_HEADER = "HTTP/1.1 200 OK\r\n\r\n";
 		string path;
-		std::map<string, ProtocolBase *>upgradeProtocols;
+		MissingFileCache missingFiles;	/// paths that recently failed to open
+		const EmbeddedAssetPack * embeddedAssets;	/// files compiled into the executable, nullptr to serve from disk
+		std::map<string, ProtocolBase *, std::less<>>upgradeProtocols;	/// transparent compare, so views can be looked up without a copy
+		alignas(std::max_align_t) char requestArena[ARENA_SIZE];	/// storage used by the per-request arena
 	};
 }
 
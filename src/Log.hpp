@@ -55,7 +55,20 @@ namespace gaf
 			/// @param caller [Optional] Name of the class or function logging this event. Blank if not set
 			static const void debug(const std::string & msg, const std::string & caller = "")
 			{
+#ifndef NDEBUG
 				log(msg, LEVEL::DEBUG_MSG, caller);
+#endif
+			}
+
+			/// Create an event with the level of "DEBUG" from a string literal
+			/// Compiled out of release builds without building a std::string, so it is free on hot paths
+			/// @param msg The message to log
+			/// @param caller [Optional] Name of the class or function logging this event. Blank if not set
+			static const void debug(const char * msg, const char * caller = "")
+			{
+#ifndef NDEBUG
+				log(msg, LEVEL::DEBUG_MSG, caller);
+#endif
 			}
 
 			/// Create an event with the level of "WARNING"
@@ -0,0 +1,111 @@
+/******************************
+ * @file MissingFileCache.hpp
+ * Alex's MicroServer (AMS)
+ * @author Alex Schlieck
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * Remembers which requested files do not exist on disk
+ ******************************/
+
+#ifndef AMS_MISSING_FILE_CACHE_HPP
+#define AMS_MISSING_FILE_CACHE_HPP
+
+#include <string>
+#include <string_view>
+#include <list>			// eviction order
+#include <unordered_map>	// lookup by path
+#include <chrono>			// entry expiry
+
+namespace ams
+{
+	/// @brief Bounded cache of file paths that are known not to exist.
+	/// Lets repeated requests for missing files (scanners, broken links) be answered without touching the disk.
+	/// Entries expire after a set lifespan so files added later are eventually found,
+	/// and the whole cache can be invalidated when the served directory changes.
+	class MissingFileCache
+	{
+	public:
+		/// Constructor
+		/// @param capacity Maximum number of paths remembered, the least recently used are evicted first
+		/// @param secondsToExpire How long a path is considered missing before the disk is checked again
+		MissingFileCache(const size_t capacity = 1024, const unsigned int secondsToExpire = 5)
+			: capacity(capacity), lifespan(secondsToExpire) {}
+
+		/// Check if a path is known not to exist
+		/// @param filePath The resolved path of the file
+		/// @return If the path was recently found to be missing
+		bool contains(const std::string_view filePath)
+		{
+			lookupKey.assign(filePath.data(), filePath.length());	// reuses capacity, no allocation once warm
+			auto entry = missing.find(lookupKey);
+			if (entry == missing.end())
+			{
+				return false;
+			}
+
+			if (std::chrono::steady_clock::now() - entry->second.found >= lifespan)	// expired, check disk again
+			{
+				order.erase(entry->second.position);
+				missing.erase(entry);
+				return false;
+			}
+			order.splice(order.end(), order, entry->second.position);	// most recently used
+			return true;
+		}
+
+		/// Remember that a path does not exist
+		/// @param filePath The resolved path of the file
+		void add(const std::string_view filePath)
+		{
+			if (capacity == 0)
+			{
+				return;
+			}
+
+			auto result = missing.try_emplace(std::string(filePath));
+			result.first->second.found = std::chrono::steady_clock::now();
+			if (!result.second)	// already known, refresh the entry
+			{
+				order.splice(order.end(), order, result.first->second.position);
+				return;
+			}
+
+			result.first->second.position = order.insert(order.end(), &result.first->first);
+			if (order.size() > capacity)	// full, evict the least recently used
+			{
+				missing.erase(*order.front());
+				order.pop_front();
+			}
+		}
+
+		/// Forget every path, used when the served files change
+		void clear()
+		{
+			missing.clear();
+			order.clear();
+		}
+
+		/// @return Number of paths currently remembered
+		size_t size() const
+		{
+			return missing.size();
+		}
+
+	private:
+		size_t capacity;	/// maximum number of entries
+		std::chrono::seconds lifespan;	/// how long an entry stays valid
+		/// When a path was found missing, and its place in the eviction order
+		struct Entry
+		{
+			std::chrono::steady_clock::time_point found;
+			std::list<const std::string*>::iterator position;
+		};
+
+		std::unordered_map<std::string, Entry> missing;	/// path and when it was found missing
+		std::list<const std::string*> order;	/// keys of missing, least recently used first
+		std::string lookupKey;	/// reused buffer for lookups
+	};
+}
+
+#endif // !AMS_MISSING_FILE_CACHE_HPP
@@ -0,0 +1,59 @@
+#include "../test/catch.hpp"
+#include "MissingFileCache.hpp"
+
+using namespace ams;
+
+TEST_CASE("Missing File Cache", "[http],[cache]")
+{
+	MissingFileCache cache(2);
+
+	SECTION("Remember missing path")
+	{
+		REQUIRE(!cache.contains("pages/missing.html"));
+		cache.add("pages/missing.html");
+		REQUIRE(cache.contains("pages/missing.html"));
+		REQUIRE(!cache.contains("pages/index.html"));
+	}
+
+	SECTION("Evict oldest when full")
+	{
+		cache.add("pages/a");
+		cache.add("pages/b");
+		cache.add("pages/c");
+		REQUIRE(cache.size() == 2);
+		REQUIRE(!cache.contains("pages/a"));
+		REQUIRE(cache.contains("pages/b"));
+		REQUIRE(cache.contains("pages/c"));
+	}
+
+	SECTION("Evict least recently used")
+	{
+		cache.add("pages/a");
+		cache.add("pages/b");
+		REQUIRE(cache.contains("pages/a"));	// used, b is now the oldest
+		cache.add("pages/c");
+		REQUIRE(cache.contains("pages/a"));
+		REQUIRE(!cache.contains("pages/b"));
+	}
+
+	SECTION("Clear")
+	{
+		cache.add("pages/a");
+		cache.clear();
+		REQUIRE(!cache.contains("pages/a"));
+		REQUIRE(cache.size() == 0);
+	}
+
+	SECTION("Expire")
+	{
+		MissingFileCache shortCache(2, 0);	// entries expire immediately
+		shortCache.add("pages/a");
+		REQUIRE(!shortCache.contains("pages/a"));
+
+		shortCache.add("pages/a");	// found missing again
+		shortCache.add("pages/b");
+		REQUIRE(shortCache.size() == 2);	// the expired entry left nothing behind to evict the new one
+		shortCache.add("pages/c");
+		REQUIRE(shortCache.size() == 2);
+	}
+}
@@ -0,0 +1,316 @@
+/******************************
+ * @file OutboundQueue.hpp
+ * Alex's MicroServer (AMS)
+ * @author Alex Schlieck
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * Data waiting to be written to a socket
+ ******************************/
+
+#ifndef AMS_OUTBOUND_QUEUE_HPP
+#define AMS_OUTBOUND_QUEUE_HPP
+
+#include <deque>
+#include <memory>	// shared_ptr
+#include <string>
+#include <cstdint>
+#include "Platforms.hpp"
+
+namespace ams
+{
+	/// Immutable buffer that can be queued on many connections without copying
+	using SharedBuffer = std::shared_ptr<const std::string>;
+
+	/// Result of trying to write queued data
+	enum class FlushStatus { DONE, PENDING, FAILED };
+
+	/// @brief Queue of buffers waiting to be written to a socket.
+	/// Buffers are reference counted, so a broadcast frame is stored once no matter how many connections queue it.
+	/// A buffer can be made of pieces, such as the fragments of a large message, and small priority buffers
+	/// are put between pieces so they never wait behind a whole large message
+	class OutboundQueue
+	{
+	public:
+		/// Queue a shared buffer
+		/// @param buffer The buffer to send, kept alive until it has been written
+		/// @param key Identifies buffers that supersede each other, see replace. 0 for none
+		/// @param pieceSize Length of the pieces the buffer is made of, the last may be shorter. Priority buffers may go between them. 0 for one piece
+		void push(const SharedBuffer & buffer, const uint64_t key = 0, const size_t pieceSize = 0)
+		{
+			size_t size = pieceSize == 0 ? buffer->length() : pieceSize;
+			for (size_t start = 0; start < buffer->length(); start += size)
+			{
+				bool isContinued = buffer->length() - start > size;
+				chunks.push_back({ buffer, buffer->data() + start, isContinued ? size : buffer->length() - start, key, false, isContinued });
+			}
+			byteCount += buffer->length();
+		}
+
+		/// Queue a small buffer ahead of everything else, where it can go without breaking a piece.
+		/// It follows the piece being written and any other priority buffers, and is never dropped or replaced
+		/// @param buffer The buffer to send, kept alive until it has been written
+		void pushPriority(const SharedBuffer & buffer)
+		{
+			if (buffer->empty())
+			{
+				return;
+			}
+			auto position = chunks.begin() + (offset == 0 ? 0 : 1);	// a partly written piece must be finished first
+			while (position != chunks.end() && position->isPriority)
+			{
+				++position;
+			}
+			chunks.insert(position, { buffer, buffer->data(), buffer->length(), 0, true, false });
+			byteCount += buffer->length();
+		}
+
+		/// Queue the rest of a shared buffer that was partly written straight to the socket.
+		/// Like any partly written buffer it is never dropped or replaced
+		/// @param buffer The buffer being sent
+		/// @param written Bytes of it already written, the queue must have been empty
+		/// @param pieceSize Length of the pieces the buffer is made of, see push
+		void pushPartlyWritten(const SharedBuffer & buffer, const size_t written, const size_t pieceSize = 0)
+		{
+			push(buffer, 0, pieceSize);
+			release(written);
+		}
+
+		/// Queue a buffer that outlives the queue, such as data compiled into the executable
+		/// @param data Pointer to the bytes to send
+		/// @param size Number of bytes
+		void pushStatic(const char * data, const size_t size)
+		{
+			if (size != 0)
+			{
+				chunks.push_back({ nullptr, data, size, 0, false, false });
+				byteCount += size;
+			}
+		}
+
+		/// Copy data onto the end of the queue.
+		/// Data copied one after the other shares a buffer, so many small messages cost one allocation and one piece of a write
+		/// @param data Pointer to the bytes to send
+		/// @param size Number of bytes
+		void append(const char * data, const size_t size)
+		{
+			if (size == 0)
+			{
+				return;
+			}
+
+			if (chunks.empty() || tail == nullptr || chunks.back().owner != tail || tail->length() + size > MAX_APPEND_SIZE)
+			{
+				tail = std::make_shared<std::string>();
+				tail->reserve(size < MIN_APPEND_CAPACITY ? MIN_APPEND_CAPACITY : size);
+				chunks.push_back({ tail, tail->data(), 0, 0, false, false });
+			}
+
+			Chunk & chunk = chunks.back();
+			tail->append(data, size);
+			chunk.data = tail->data();	// may have moved as it grew
+			chunk.size += size;
+			byteCount += size;
+		}
+
+		/// Write as much queued data as the socket accepts without blocking.
+		/// Queued buffers are gathered into as few calls as possible
+		/// @param sock The socket to write to
+		/// @return DONE if everything was written, PENDING if the socket is full, FAILED if the connection is broken
+		FlushStatus flush(const SOCKET sock)
+		{
+			GATHER_BUFFER buffers[MAX_GATHER];
+			while (!chunks.empty())
+			{
+				size_t count = 0;
+				size_t gathered = 0;
+				for (auto chunk = chunks.begin(); chunk != chunks.end() && count < MAX_GATHER; ++chunk, ++count)
+				{
+					size_t skip = count == 0 ? offset : 0;	// the front chunk may be partly written
+					SET_GATHER_BUFFER(buffers[count], chunk->data + skip, chunk->size - skip);
+					gathered += chunk->size - skip;
+				}
+
+				SSIZE_T sent = SEND_GATHER(sock, buffers, count, count < chunks.size());
+				if (sent < 0)
+				{
+					return IS_WOULD_BLOCK() ? FlushStatus::PENDING : FlushStatus::FAILED;
+				}
+
+				release(static_cast<size_t>(sent));
+				if (static_cast<size_t>(sent) < gathered)	// the socket is full, don't ask again just to be told so
+				{
+					return FlushStatus::PENDING;
+				}
+			}
+			return FlushStatus::DONE;
+		}
+
+		/// Drop the oldest buffers until the queue is small enough.
+		/// A buffer that has been partly written is never dropped, the client would receive half a message.
+		/// The pieces of a buffer are dropped together, and priority buffers are kept
+		/// @param maxBytes Size to shrink the queue to
+		/// @return Number of buffers dropped
+		size_t dropOldest(const size_t maxBytes)
+		{
+			size_t dropped = 0;
+			bool isKeeping = isBufferStarted || (offset != 0 && !chunks.front().isPriority);	// the rest of a started buffer must follow
+			bool isDropping = false;
+			auto kept = chunks.begin();
+			for (auto chunk = chunks.begin(); chunk != chunks.end(); ++chunk)
+			{
+				if (!chunk->isPriority)
+				{
+					if (!isKeeping && !isDropping && byteCount > maxBytes)	// first piece of a buffer
+					{
+						isDropping = true;
+						dropped++;
+					}
+					if (isDropping)
+					{
+						byteCount -= chunk->size;
+					}
+				}
+
+				if (chunk->isPriority || !isDropping)
+				{
+					if (kept != chunk)
+					{
+						*kept = std::move(*chunk);
+					}
+					++kept;
+				}
+				if (!chunk->isPriority && !chunk->isContinued)	// last piece of a buffer
+				{
+					isKeeping = false;
+					isDropping = false;
+				}
+			}
+			chunks.erase(kept, chunks.end());
+			return dropped;
+		}
+
+		/// Drop every buffer that hasn't started being written, keeping priority buffers
+		void dropUnstarted()
+		{
+			auto kept = chunks.begin() + (offset == 0 ? 0 : 1);	// the piece being written must be finished
+			for (auto chunk = kept; chunk != chunks.end(); ++chunk)
+			{
+				if (!chunk->isPriority)
+				{
+					byteCount -= chunk->size;
+					continue;
+				}
+				if (kept != chunk)
+				{
+					*kept = std::move(*chunk);
+				}
+				++kept;
+			}
+			chunks.erase(kept, chunks.end());
+		}
+
+		/// Replace the most recent unwritten buffer with the same key, keeping its place in the queue.
+		/// Only a buffer of one piece is replaced
+		/// @param key Identifies the buffer to replace, must not be 0
+		/// @param buffer The new buffer, sent as one piece
+		/// @return If a buffer was replaced
+		bool replace(const uint64_t key, const SharedBuffer & buffer)
+		{
+			size_t first = offset == 0 ? 0 : 1;	// a partly written buffer can't change
+			for (size_t i = chunks.size(); i > first; i--)
+			{
+				Chunk & chunk = chunks[i - 1];
+				if (chunk.key == key && !chunk.isPriority)
+				{
+					if (chunk.isContinued || isContinuedBefore(i - 1))	// part of a larger buffer
+					{
+						return false;
+					}
+					byteCount = byteCount - chunk.size + buffer->length();
+					chunk = { buffer, buffer->data(), buffer->length(), key, false, false };
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/// Forget all queued data
+		void clear()
+		{
+			chunks.clear();
+			tail.reset();
+			offset = 0;
+			byteCount = 0;
+			isBufferStarted = false;
+		}
+
+		/// @return If there is nothing waiting to be written
+		bool empty() const
+		{
+			return chunks.empty();
+		}
+
+		/// @return Number of bytes waiting to be written
+		size_t size() const
+		{
+			return byteCount;
+		}
+
+	private:
+		/// Part of a buffer waiting to be written
+		struct Chunk
+		{
+			SharedBuffer owner;	/// keeps the data alive, nullptr for static data
+			const char * data;	/// start of the data
+			size_t size;		/// number of bytes
+			uint64_t key;		/// identifies buffers that supersede each other, 0 for none
+			bool isPriority;	/// if it was put ahead of the other buffers
+			bool isContinued;	/// if more pieces of the same buffer follow
+		};
+
+		/// Forget the data that has been written
+		/// @param written Number of bytes written from the front of the queue
+		void release(const size_t written)
+		{
+			byteCount -= written;
+			size_t remaining = offset + written;
+			while (!chunks.empty() && remaining >= chunks.front().size)	// release the chunks that were finished
+			{
+				remaining -= chunks.front().size;
+				if (!chunks.front().isPriority)
+				{
+					isBufferStarted = chunks.front().isContinued;
+				}
+				chunks.pop_front();
+			}
+			offset = remaining;
+		}
+
+		/// @return If the piece at a position follows an earlier piece of the same buffer
+		bool isContinuedBefore(size_t index) const
+		{
+			while (index > 0)
+			{
+				const Chunk & previous = chunks[--index];
+				if (!previous.isPriority)
+				{
+					return previous.isContinued;
+				}
+			}
+			return isBufferStarted;
+		}
+
+		static const size_t MAX_GATHER = 64;	/// most buffers written by one call
+		static const size_t MIN_APPEND_CAPACITY = 1024;	/// room reserved by a new buffer for appended data
+		static const size_t MAX_APPEND_SIZE = 16384;	/// appended data beyond this starts a new buffer, rather than copying a large one as it grows
+
+		std::deque<Chunk> chunks;	/// buffers in the order they are sent
+		std::shared_ptr<std::string> tail;	/// buffer that appended data is copied into, shared with the last chunk while it's there
+		size_t offset = 0;			/// bytes of the front chunk that were already written
+		size_t byteCount = 0;		/// total bytes waiting
+		bool isBufferStarted = false;	/// if pieces of a buffer were written and the rest is still queued
+	};
+}
+
+#endif // !AMS_OUTBOUND_QUEUE_HPP
@@ -0,0 +1,261 @@
+#include "../test/catch.hpp"
+#include "OutboundQueue.hpp"
+#include "ProtocolBase.hpp"
+
+using namespace ams;
+
+TEST_CASE("Outbound Queue", "[socket],[broadcast]")
+{
+	OutboundQueue queue;
+
+	SECTION("Empty")
+	{
+		REQUIRE(queue.empty());
+		REQUIRE(queue.size() == 0);
+		REQUIRE(queue.flush(INVALID_SOCKET) == FlushStatus::DONE);	// nothing to write, socket never used
+	}
+
+	SECTION("Buffers are shared, not copied")
+	{
+		SharedBuffer frame = std::make_shared<const std::string>("broadcast");
+		OutboundQueue other;
+		queue.push(frame);
+		other.push(frame);
+		REQUIRE(frame.use_count() == 3);
+		REQUIRE(queue.size() == 9);
+
+		queue.clear();
+		REQUIRE(queue.empty());
+		REQUIRE(frame.use_count() == 2);
+	}
+
+	SECTION("Static and empty buffers")
+	{
+		static const char data[] = "static";
+		queue.pushStatic(data, 6);
+		queue.push(std::make_shared<const std::string>());	// nothing to send, not queued
+		queue.pushStatic(data, 0);
+		REQUIRE(queue.size() == 6);
+	}
+
+	SECTION("Drop oldest")
+	{
+		queue.push(std::make_shared<const std::string>("aaaa"));
+		queue.push(std::make_shared<const std::string>("bbbb"));
+		queue.push(std::make_shared<const std::string>("cccc"));
+		REQUIRE(queue.dropOldest(5) == 2);
+		REQUIRE(queue.size() == 4);
+		REQUIRE(queue.dropOldest(4) == 0);	// already small enough
+	}
+
+	SECTION("Replace by key")
+	{
+		queue.push(std::make_shared<const std::string>("price=1"), 7);
+		queue.push(std::make_shared<const std::string>("other"), 8);
+		REQUIRE(queue.replace(7, std::make_shared<const std::string>("price=10")));
+		REQUIRE(queue.size() == 13);
+		REQUIRE(!queue.replace(9, std::make_shared<const std::string>("none")));
+	}
+
+	SECTION("Appended data shares a buffer")
+	{
+		queue.append("aaaa", 4);
+		queue.append("bbbb", 4);
+		queue.push(std::make_shared<const std::string>("cccc"));
+		queue.append("dddd", 4);	// after a shared buffer, starts a new one
+		REQUIRE(queue.size() == 16);
+		REQUIRE(queue.dropOldest(8) == 1);	// both appended pieces went together
+		REQUIRE(queue.size() == 8);
+	}
+
+	SECTION("Partly written buffer")
+	{
+		SharedBuffer frame = std::make_shared<const std::string>("0123456789");
+		queue.pushPartlyWritten(frame, 4);
+		queue.push(std::make_shared<const std::string>("abcd"));
+		REQUIRE(queue.size() == 10);
+		REQUIRE(frame.use_count() == 2);	// the rest is sent from the original
+		REQUIRE(queue.dropOldest(0) == 1);	// the rest of the frame must still go
+		REQUIRE(queue.size() == 6);
+	}
+
+	SECTION("Pieces and priority buffers")
+	{
+		SharedBuffer frame = std::make_shared<const std::string>("0123456789");
+		queue.pushPartlyWritten(frame, 5, 4);	// in the middle of the second piece
+		queue.push(std::make_shared<const std::string>("abcd"));
+		queue.pushPriority(std::make_shared<const std::string>("ping"));	// goes after the piece being written
+		REQUIRE(queue.size() == 13);
+		REQUIRE(queue.dropOldest(0) == 1);	// the rest of the started buffer and the priority buffer stay
+		REQUIRE(queue.size() == 9);
+		queue.dropUnstarted();	// only the piece being written and the priority buffer are left
+		REQUIRE(queue.size() == 7);
+	}
+
+	SECTION("Buffers of many pieces aren't replaced")
+	{
+		queue.push(std::make_shared<const std::string>("0123456789"), 7, 4);
+		REQUIRE(!queue.replace(7, std::make_shared<const std::string>("new")));
+		queue.push(std::make_shared<const std::string>("0123"), 8, 4);	// one piece
+		REQUIRE(queue.replace(8, std::make_shared<const std::string>("new")));
+		REQUIRE(queue.size() == 13);
+	}
+
+	SECTION("Broken socket")
+	{
+		queue.push(std::make_shared<const std::string>("data"));
+		REQUIRE(queue.flush(INVALID_SOCKET) == FlushStatus::FAILED);
+		REQUIRE(queue.size() == 4);	// nothing was written
+	}
+}
+
+/// Exposes the queueing functions so the overflow policies can be tested without sockets
+class QueueingProtocol : public ProtocolBase
+{
+public:
+	QueueingProtocol() : ProtocolBase(0) {}
+	virtual void addConnection(Connection connection, const std::string & data) override { connections.push_back(connection); }
+	Connection & getConnection() { return connections.front(); }
+	using ProtocolBase::queueBuffer;
+	using ProtocolBase::sendBuffer;
+	using ProtocolBase::sendSharedBuffer;
+	using ProtocolBase::sendPriorityBuffer;
+
+protected:
+	virtual void receiveData(Connection & connection, const std::string & data) override {}
+};
+
+TEST_CASE("Outbound Overflow Policies", "[socket],[broadcast]")
+{
+	QueueingProtocol protocol;
+	protocol.addConnection(Connection(INVALID_SOCKET), "");
+	Connection & connection = protocol.getConnection();
+	SharedBuffer message = std::make_shared<const std::string>("0123456789");
+	OutboundLimits limits;
+	limits.maxQueuedBytes = 25;
+
+	SECTION("No limit")
+	{
+		protocol.setOutboundLimits(OutboundLimits());
+		for (int i = 0; i < 10; i++)
+		{
+			protocol.queueBuffer(connection, message);
+		}
+		REQUIRE(connection.outbound.size() == 100);
+	}
+
+	SECTION("Disconnect")
+	{
+		protocol.setOutboundLimits(limits);
+		for (int i = 0; i < 3; i++)
+		{
+			protocol.queueBuffer(connection, message);
+		}
+		REQUIRE(connection.isOverflowed);
+		REQUIRE(connection.outbound.empty());
+		REQUIRE(protocol.getOverflowCounters().disconnects == 1);
+		REQUIRE(!protocol.canSend(connection));
+	}
+
+	SECTION("Drop newest")
+	{
+		limits.policy = OverflowPolicy::DROP_NEWEST;
+		protocol.setOutboundLimits(limits);
+		for (int i = 0; i < 3; i++)
+		{
+			protocol.queueBuffer(connection, message);
+		}
+		REQUIRE(connection.outbound.size() == 20);
+		REQUIRE(protocol.getOverflowCounters().droppedNewest == 1);
+	}
+
+	SECTION("Drop oldest")
+	{
+		limits.policy = OverflowPolicy::DROP_OLDEST;
+		protocol.setOutboundLimits(limits);
+		for (int i = 0; i < 4; i++)
+		{
+			protocol.queueBuffer(connection, message);
+		}
+		REQUIRE(connection.outbound.size() == 20);
+		REQUIRE(protocol.getOverflowCounters().droppedOldest == 2);
+	}
+
+	SECTION("Coalesce")
+	{
+		limits.policy = OverflowPolicy::COALESCE;
+		protocol.setOutboundLimits(limits);
+		protocol.queueBuffer(connection, message, 1);
+		protocol.queueBuffer(connection, message, 2);
+		protocol.queueBuffer(connection, std::make_shared<const std::string>("latest"), 1);
+		REQUIRE(connection.outbound.size() == 16);
+		REQUIRE(protocol.getOverflowCounters().coalesced == 1);
+
+		protocol.queueBuffer(connection, message, 3);	// no match, oldest is dropped
+		REQUIRE(connection.outbound.size() == 20);
+		REQUIRE(protocol.getOverflowCounters().droppedOldest == 1);
+	}
+
+	SECTION("Coalesce fragmented message")
+	{
+		limits.policy = OverflowPolicy::COALESCE;
+		protocol.setOutboundLimits(limits);
+		protocol.queueBuffer(connection, message, 1, 4);
+		protocol.queueBuffer(connection, message, 2);
+		protocol.queueBuffer(connection, std::make_shared<const std::string>("latest"), 1);	// can't replace all the fragments, oldest is dropped
+		REQUIRE(connection.outbound.size() == 16);
+		REQUIRE(protocol.getOverflowCounters().coalesced == 0);
+		REQUIRE(protocol.getOverflowCounters().droppedOldest == 1);
+	}
+
+	SECTION("Priority buffers")
+	{
+		limits.policy = OverflowPolicy::DROP_NEWEST;
+		protocol.setOutboundLimits(limits);
+		protocol.queueBuffer(connection, message);
+		protocol.queueBuffer(connection, message);
+		protocol.sendPriorityBuffer(connection, std::make_shared<const std::string>("0123456789"));	// ahead of the queue, never dropped
+		REQUIRE(connection.outbound.size() == 30);
+		REQUIRE(protocol.getOverflowCounters().droppedNewest == 0);
+	}
+
+	SECTION("Can send")
+	{
+		protocol.setOutboundLimits(limits);
+		protocol.queueBuffer(connection, message);
+		protocol.queueBuffer(connection, message);
+		REQUIRE(protocol.canSend(connection));
+		protocol.queueBuffer(connection, std::make_shared<const std::string>("01234"));
+		REQUIRE(!protocol.canSend(connection));
+		REQUIRE(connection.isWaitingForDrain);
+	}
+
+	SECTION("Coalesced writes are held")
+	{
+		WriteCoalescing coalescing;
+		coalescing.isEnabled = true;
+		coalescing.smallWriteSize = 16;
+		protocol.setWriteCoalescing(coalescing);
+		protocol.sendBuffer(connection, "small", 5);	// the broken socket is never touched until the loop flushes
+		protocol.sendBuffer(connection, "small", 5);
+		REQUIRE(connection.outbound.size() == 10);
+		REQUIRE(connection.isWriteHeld);
+
+		protocol.sendBuffer(connection, "large enough to join the queue", 30);	// something is already waiting
+		REQUIRE(connection.outbound.size() == 40);
+
+		connection.outbound.clear();
+		connection.isWriteHeld = false;
+		protocol.sendBuffer(connection, "large enough to go straight out", 31);
+		REQUIRE(connection.outbound.empty());
+		REQUIRE(!connection.isWriteHeld);
+	}
+
+	SECTION("Shared buffers are queued by reference")
+	{
+		protocol.queueBuffer(connection, message);
+		protocol.sendSharedBuffer(connection, message);	// behind other data, the broken socket isn't touched
+		REQUIRE(connection.outbound.size() == 20);
+		REQUIRE(message.use_count() == 3);
+	}
+}
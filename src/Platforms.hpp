@@ -23,15 +23,52 @@
 
 	#pragma comment(lib, "ws2_32.lib")
 	#include <WinSock2.h>
+	#include <WS2tcpip.h>	// getaddrinfo
 
 	inline void CLOSE_SOCKET(SOCKET sock) { closesocket(sock); }
 
+	/// Stop send and recv from blocking the server loop
+	inline void SET_NON_BLOCKING(SOCKET sock) { u_long mode = 1; ioctlsocket(sock, FIONBIO, &mode); }
+
+	/// Check if the last socket call failed only because it would have blocked
+	inline bool IS_WOULD_BLOCK() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+
+	/// Check if a non-blocking connect failed only because it hasn't finished yet
+	inline bool IS_CONNECT_PENDING() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+
+	/// Let a restarted listener bind its port while old connections are still closing. Windows already allows it
+	inline void ALLOW_ADDRESS_REUSE(SOCKET sock) {}
+
+	const int SEND_FLAGS = 0;	/// flags passed to every send
+
+	/// One piece of a gathered write
+	using GATHER_BUFFER = WSABUF;
+
+	/// Point a piece of a gathered write at some data
+	inline void SET_GATHER_BUFFER(GATHER_BUFFER & buffer, const char * data, const size_t size) { buffer.buf = const_cast<char*>(data); buffer.len = static_cast<ULONG>(size); }
+
+	/// Write several buffers with one call. Windows has no way to say more data follows, so isMore is ignored
+	/// @return Bytes sent, or -1 like send
+	inline SSIZE_T SEND_GATHER(SOCKET sock, GATHER_BUFFER * buffers, const size_t count, const bool isMore)
+	{
+		DWORD sent = 0;
+		return WSASend(sock, buffers, static_cast<DWORD>(count), &sent, 0, nullptr, nullptr) == 0 ? static_cast<SSIZE_T>(sent) : -1;
+	}
+
+	/// Turn Nagle's algorithm off (TCP_NODELAY) so small writes aren't held back waiting for acknowledgements
+	inline void SET_NO_DELAY(SOCKET sock, const bool isEnabled) { BOOL value = isEnabled; setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&value), sizeof(value)); }
+
 ////////// Linux / osx //////////
 #elif defined(__unix__) || (defined(__APPLE__) && defined(__MACH__)) // __unix works, still need to test apple
 	#include <sys/socket.h>
 	#include <sys/types.h>
 	#include <netinet/in.h>
+	#include <netinet/tcp.h>	// TCP_NODELAY
+	#include <sys/uio.h>	// iovec
+	#include <netdb.h>	// getaddrinfo
 	#include <unistd.h>
+	#include <fcntl.h>
+	#include <errno.h>
 
 	using SSIZE_T = ssize_t;
 	using SOCKET = int;
@@ -39,6 +76,48 @@
 
 	inline void CLOSE_SOCKET(SOCKET sock) { close(sock); }
 
+	/// Stop send and recv from blocking the server loop
+	inline void SET_NON_BLOCKING(SOCKET sock) { fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK); }
+
+	/// Check if the last socket call failed only because it would have blocked
+	inline bool IS_WOULD_BLOCK() { return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR; }
+
+	/// Check if a non-blocking connect failed only because it hasn't finished yet
+	inline bool IS_CONNECT_PENDING() { return errno == EINPROGRESS; }
+
+	/// Let a restarted listener bind its port while old connections are still closing (TIME_WAIT)
+	inline void ALLOW_ADDRESS_REUSE(SOCKET sock) { int enable = 1; setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)); }
+
+	#ifdef MSG_NOSIGNAL
+		const int SEND_FLAGS = MSG_NOSIGNAL;	/// don't raise SIGPIPE when a client has gone away
+	#else
+		const int SEND_FLAGS = 0;	/// flags passed to every send
+	#endif
+
+	/// One piece of a gathered write
+	using GATHER_BUFFER = iovec;
+
+	/// Point a piece of a gathered write at some data
+	inline void SET_GATHER_BUFFER(GATHER_BUFFER & buffer, const char * data, const size_t size) { buffer.iov_base = const_cast<char*>(data); buffer.iov_len = size; }
+
+	/// Write several buffers with one call, sendmsg rather than writev so SEND_FLAGS still apply
+	/// @param isMore More data follows straight away, so a partly filled packet is held back for it (MSG_MORE, Linux only)
+	/// @return Bytes sent, or -1 like send
+	inline SSIZE_T SEND_GATHER(SOCKET sock, GATHER_BUFFER * buffers, const size_t count, const bool isMore)
+	{
+		msghdr message{};
+		message.msg_iov = buffers;
+		message.msg_iovlen = count;
+	#ifdef MSG_MORE
+		return sendmsg(sock, &message, SEND_FLAGS | (isMore ? MSG_MORE : 0));
+	#else
+		return sendmsg(sock, &message, SEND_FLAGS);
+	#endif
+	}
+
+	/// Turn Nagle's algorithm off (TCP_NODELAY) so small writes aren't held back waiting for acknowledgements
+	inline void SET_NO_DELAY(SOCKET sock, const bool isEnabled) { int value = isEnabled; setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)); }
+
 #endif //!__unix__
 
 
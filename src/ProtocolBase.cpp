@@ -13,8 +13,13 @@ using namespace ams;
 
 ProtocolBase::ProtocolBase(const unsigned int secondsToTimeout, const unsigned int port) : connectionCount(0)
 {
+	receivedMessage.reserve(DEFAULT_BUFFER_SIZE);
 	FD_ZERO(&receivingSockets);
 	secondsUntilConnectionCloses = std::chrono::seconds{ secondsToTimeout };
+	deadlines.idle = secondsUntilConnectionCloses;
+	lastTimerCheck = std::chrono::steady_clock::now();
+	loopTime = lastTimerCheck;
+	setAdmissionLimits(admissionLimits);	// builds the 503 response for the default limits
 
     auto socketType = SOCK_STREAM; // change to SOCK_DGRM for udp
 
@@ -35,6 +40,7 @@ ProtocolBase::ProtocolBase(const unsigned int secondsToTimeout, const unsigned i
 				perror("Unable to create listener socket");
 				throw std::runtime_error("Unable to create listener socket");
 			}
+			ALLOW_ADDRESS_REUSE(listenerSocket);
 
 			if (bind(listenerSocket, (struct sockaddr*)&listeningAddress, sizeof(listeningAddress)) < 0) // bind requires scope operator to prevent calling std::bind
 			{
@@ -64,14 +70,243 @@ ProtocolBase::~ProtocolBase()
 
 const void ProtocolBase::sendData(Connection & connection, const string & data)
 {
-	send(connection.sock, data.data(), static_cast<int>(data.length()), 0);
+	sendBuffer(connection, data.data(), data.length());
+}
+
+void ProtocolBase::sendBuffer(Connection & connection, const char * data, const size_t size)
+{
+	if (writeCoalescing.isEnabled && (!connection.outbound.empty() || size < writeCoalescing.smallWriteSize))
+	{
+		appendBuffer(connection, data, size);
+		return;
+	}
+
+	size_t sent = 0;
+	if (connection.outbound.empty())	// nothing ahead of this data, try to send it straight away
+	{
+		SSIZE_T result = send(connection.sock, data, static_cast<int>(size), SEND_FLAGS);
+		if (result < 0 && !IS_WOULD_BLOCK())
+		{
+			return;	// connection is broken, the next read will close it
+		}
+		sent = result < 0 ? 0 : static_cast<size_t>(result);
+	}
+
+	if (sent == size)
+	{
+		return;
+	}
+
+	SharedBuffer remainder = std::make_shared<const string>(data + sent, size - sent);
+	if (sent == 0)
+	{
+		queueBuffer(connection, remainder);
+	}
+	else	// part of the data has gone, the rest must follow or the client gets a broken message
+	{
+		connection.outbound.push(remainder);
+	}
+}
+
+void ProtocolBase::sendSharedBuffer(Connection & connection, const SharedBuffer & buffer, const size_t pieceSize)
+{
+	if (writeCoalescing.isEnabled && buffer->length() < writeCoalescing.smallWriteSize)
+	{
+		appendBuffer(connection, buffer->data(), buffer->length());
+		return;
+	}
+	if (!connection.outbound.empty())	// behind other data, queued without copying
+	{
+		queueBuffer(connection, buffer, 0, pieceSize);
+		return;
+	}
+
+	SSIZE_T result = send(connection.sock, buffer->data(), static_cast<int>(buffer->length()), SEND_FLAGS);
+	if (result < 0 && !IS_WOULD_BLOCK())
+	{
+		return;	// connection is broken, the next read will close it
+	}
+	size_t sent = result < 0 ? 0 : static_cast<size_t>(result);
+
+	if (sent == 0)
+	{
+		queueBuffer(connection, buffer, 0, pieceSize);
+	}
+	else if (sent < buffer->length())	// part of the data has gone, the rest must follow or the client gets a broken message
+	{
+		connection.outbound.pushPartlyWritten(buffer, sent, pieceSize);
+	}
+}
+
+void ProtocolBase::sendPriorityBuffer(Connection & connection, const SharedBuffer & buffer)
+{
+	if (connection.outbound.empty())	// nothing to get ahead of
+	{
+		sendSharedBuffer(connection, buffer);
+	}
+	else if (!connection.isOverflowed)
+	{
+		connection.outbound.pushPriority(buffer);
+	}
+}
+
+void ProtocolBase::appendBuffer(Connection & connection, const char * data, const size_t size)
+{
+	if (connection.isClosingWhenSent || connection.isOverflowed)
+	{
+		return;
+	}
+
+	if (outboundLimits.maxQueuedBytes != 0 && !connection.outbound.empty() && connection.outbound.size() + size > outboundLimits.maxQueuedBytes)
+	{
+		queueBuffer(connection, std::make_shared<const string>(data, size));	// let the overflow policy decide
+		return;
+	}
+
+	bool wasEmpty = connection.outbound.empty();
+	connection.outbound.append(data, size);
+	if (wasEmpty)
+	{
+		holdWrites(connection);
+	}
+}
+
+void ProtocolBase::holdWrites(Connection & connection)
+{
+	if (writeCoalescing.isEnabled && !connection.isWriteHeld)
+	{
+		connection.isWriteHeld = true;
+		connection.writeHeldSince = loopTime;
+	}
+}
+
+void ProtocolBase::flushHeldConnections()
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	socketList.clear();
+	for (auto & connection : connections)
+	{
+		if (connection.isWriteHeld && now - connection.writeHeldSince >= writeCoalescing.flushWindow)
+		{
+			socketList.push_back(connection.sock);
+		}
+	}
+
+	for (SOCKET sock : socketList)
+	{
+		Connection * connection = findConnection(sock);
+		if (connection != nullptr)
+		{
+			connection->isWriteHeld = false;	// whatever the socket doesn't take now waits for select as usual
+			flushConnection(*connection);
+		}
+	}
 }
 
 const void ProtocolBase::broadcast(const string & data)
 {
-	for (Connection connection : connections)
+	broadcastBuffer(std::make_shared<const string>(data));
+}
+
+void ProtocolBase::broadcastBuffer(const SharedBuffer & buffer)
+{
+	for (auto & connection : connections)
 	{
-		ProtocolBase::sendData(connection, data);
+		queueBuffer(connection, buffer);
+	}
+}
+
+void ProtocolBase::queueBuffer(Connection & connection, const SharedBuffer & buffer, const uint64_t key, const size_t pieceSize)
+{
+	if (connection.isClosingWhenSent || connection.isOverflowed)
+	{
+		return;
+	}
+
+	// an empty queue always takes the buffer, otherwise a message larger than the limit could never be sent
+	if (outboundLimits.maxQueuedBytes != 0 && !connection.outbound.empty() && connection.outbound.size() + buffer->length() > outboundLimits.maxQueuedBytes
+		&& !handleOverflow(connection, buffer, key, pieceSize == 0 || pieceSize >= buffer->length()))
+	{
+		return;
+	}
+
+	bool wasEmpty = connection.outbound.empty();
+	connection.outbound.push(buffer, key, pieceSize);
+	if (wasEmpty)
+	{
+		holdWrites(connection);
+	}
+}
+
+bool ProtocolBase::handleOverflow(Connection & connection, const SharedBuffer & buffer, const uint64_t key, const bool isOnePiece)
+{
+	switch (outboundLimits.policy)
+	{
+		case OverflowPolicy::DISCONNECT:
+		{
+			// can't close here, the caller may be iterating the connections
+			overflowCounters.disconnects++;
+			connection.isOverflowed = true;
+			connection.outbound.clear();
+			overflowedSockets.push_back(connection.sock);
+			return false;
+		}
+
+		case OverflowPolicy::DROP_NEWEST:
+		{
+			overflowCounters.droppedNewest++;
+			return false;
+		}
+
+		case OverflowPolicy::COALESCE:
+		{
+			if (key != 0 && isOnePiece && connection.outbound.replace(key, buffer))
+			{
+				overflowCounters.coalesced++;
+				return false;
+			}
+			[[fallthrough]];	// nothing to replace, make room instead
+		}
+
+		case OverflowPolicy::DROP_OLDEST:
+		{
+			size_t room = buffer->length() < outboundLimits.maxQueuedBytes ? outboundLimits.maxQueuedBytes - buffer->length() : 0;
+			overflowCounters.droppedOldest += connection.outbound.dropOldest(room);
+			if (connection.outbound.size() > room)	// the rest is being written
+			{
+				overflowCounters.droppedNewest++;
+				return false;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+void ProtocolBase::closeOverflowedConnections()
+{
+	for (SOCKET sock : overflowedSockets)
+	{
+		Connection * connection = findConnection(sock);
+		if (connection != nullptr)
+		{
+			gaf::util::Log::warning("Outbound queue full, closing connection");
+			closeConnection(*connection);
+		}
+	}
+	overflowedSockets.clear();
+}
+
+void ProtocolBase::closeWhenSent(Connection & connection)
+{
+	if (connection.outbound.empty())
+	{
+		closeConnection(connection);
+	}
+	else
+	{
+		connection.isClosingWhenSent = true;
+		FD_CLR(connection.sock, &receivingSockets);
 	}
 }
 
@@ -84,48 +319,245 @@ void ProtocolBase::closeConnection(Connection & connection)
 
 void ProtocolBase::run()
 {
+	loopTime = std::chrono::steady_clock::now();
 	fd_set receivingSocketsCopy = receivingSockets;	// make a copy so select doesn't destroy original
-	timeval	selectWaitTime{ 0, 1000 };	// how long the select function waits for data
-	int count = select(0, &receivingSocketsCopy, nullptr, nullptr, &selectWaitTime);
+	fd_set writingSockets;	// connections with data waiting to be sent
+	FD_ZERO(&writingSockets);
+	bool isAnyWriteHeld = false;
+	for (auto & connection : connections)
+	{
+		if (connection.isWriteHeld)	// not waiting for the socket, select would report it writable straight away
+		{
+			isAnyWriteHeld = true;
+		}
+		else if (!connection.outbound.empty())
+		{
+			FD_SET(connection.sock, &writingSockets);
+		}
+	}
+
+	long waitMicroseconds = 1000;
+	if (isAnyWriteHeld && writeCoalescing.flushWindow.count() < waitMicroseconds)	// wake up in time to write the held data
+	{
+		waitMicroseconds = static_cast<long>(writeCoalescing.flushWindow.count());
+	}
+	timeval	selectWaitTime{ 0, waitMicroseconds };	// how long the select function waits for data
+	int count = select(static_cast<int>(getHighestSocket()) + 1, &receivingSocketsCopy, &writingSockets, nullptr, &selectWaitTime);
 
-	// check if there's a new connection to the listening socket
-	if (listenerSocket != 0)	// there is a listener
+	if (count > 0)	// if a socket is waiting
 	{
-		if (FD_ISSET(listenerSocket, &receivingSocketsCopy))	// listener received data
+		// check if there's a new connection to the listening socket
+		if (listenerSocket != 0 && FD_ISSET(listenerSocket, &receivingSocketsCopy))
 		{
-			Connection newConn(accept(listenerSocket, nullptr, nullptr));
+			acceptConnection();
+		}
 
-			gaf::util::Log::debug("New Connection: ");
-			if (isRoomForNewConnection())
+		// handlers can add and remove connections, so collect the ready sockets first
+		socketList.clear();
+		for (auto & connection : connections)
+		{
+			if (FD_ISSET(connection.sock, &receivingSocketsCopy))
 			{
-				connections.push_back(newConn);
-				FD_SET(newConn.sock, &receivingSockets);
-				readReceivedData(newConn);
+				socketList.push_back(connection.sock);
 			}
-			else
+		}
+
+		for (SOCKET sock : socketList)
+		{
+			Connection * connection = findConnection(sock);
+			if (connection != nullptr)
 			{
-				gaf::util::Log::warning("Unable to add connection, limit exceeded");
-				char flushBuffer[DEFAULT_BUFFER_SIZE];
-				recv(newConn.sock, flushBuffer, DEFAULT_BUFFER_SIZE, 0); // flush the socket
-				CLOSE_SOCKET(newConn.sock);	// close connection
+				readReceivedData(*connection);
 			}
 		}
-	}
 
-	// check if any other sockets received data
-	if (count > 0)	// if a socket is waiting
-	{
-		for (auto connection : connections)	// find the correct socket
+		// send queued data to the sockets that can take it
+		socketList.clear();
+		for (auto & connection : connections)
 		{
-			if (FD_ISSET(connection.sock, &receivingSocketsCopy))
+			if (!connection.outbound.empty() && FD_ISSET(connection.sock, &writingSockets))
 			{
-				readReceivedData(connection);
+				socketList.push_back(connection.sock);
+			}
+		}
+
+		for (SOCKET sock : socketList)
+		{
+			Connection * connection = findConnection(sock);
+			if (connection != nullptr)
+			{
+				flushConnection(*connection);
 			}
 		}
 	}
 
-	//TODO: add time-out check
-	//removeExpiredConnections();
+	checkTimers();
+	flushHeldConnections();	// after the timers, so their messages join the same writes
+	closeOverflowedConnections();
+}
+
+void ProtocolBase::beginShutdown()
+{
+	isShuttingDown = true;
+	if (listenerSocket != 0)	// stop accepting
+	{
+		FD_CLR(listenerSocket, &receivingSockets);
+		CLOSE_SOCKET(listenerSocket);
+		listenerSocket = 0;
+		connectionCount--;
+	}
+
+	// connections that haven't sent a request have nothing to finish
+	socketList.clear();
+	for (auto & connection : connections)
+	{
+		if (connection.phase == Connection::Phase::AWAITING_FIRST_BYTE)
+		{
+			socketList.push_back(connection.sock);
+		}
+	}
+	for (SOCKET sock : socketList)
+	{
+		Connection * connection = findConnection(sock);
+		if (connection != nullptr)
+		{
+			closeConnection(*connection);
+		}
+	}
+}
+
+bool ProtocolBase::isDrained() const
+{
+	return connections.empty();
+}
+
+void ProtocolBase::closeAllConnections()
+{
+	while (!connections.empty())
+	{
+		closeConnection(connections.back());
+	}
+}
+
+void ProtocolBase::acceptConnection()
+{
+	Connection newConn(accept(listenerSocket, nullptr, nullptr));
+	if (newConn.sock == INVALID_SOCKET)
+	{
+		return;
+	}
+
+	gaf::util::Log::debug("New Connection: ");
+	if (isRoomForNewConnection())
+	{
+		SET_NON_BLOCKING(newConn.sock);	// a full socket queues its data instead of stalling the loop
+
+		// wait for select to report data rather than blocking on a silent client
+		storeConnection(newConn);
+	}
+	else
+	{
+		gaf::util::Log::warning("Unable to add connection, limit exceeded");
+		CLOSE_SOCKET(newConn.sock);	// close connection
+	}
+}
+
+void ProtocolBase::setDeadlines(const ConnectionDeadlines & newDeadlines)
+{
+	deadlines = newDeadlines;
+}
+
+const ConnectionDeadlines & ProtocolBase::getDeadlines() const
+{
+	return deadlines;
+}
+
+void ProtocolBase::setAdmissionLimits(const AdmissionLimits & newLimits)
+{
+	admissionLimits = newLimits;
+	serviceUnavailableResponse = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: " + std::to_string(admissionLimits.retryAfterSeconds) + "\r\nContent-Length: 0\r\n\r\n";
+}
+
+const AdmissionLimits & ProtocolBase::getAdmissionLimits() const
+{
+	return admissionLimits;
+}
+
+void ProtocolBase::setLoopLag(const std::chrono::microseconds lag)
+{
+	loopLag = lag;
+}
+
+bool ProtocolBase::isOverloaded() const
+{
+	return isShuttingDown
+		|| loopLag > admissionLimits.maxLoopLag
+		|| connectionCount > admissionLimits.maxConnections
+		|| (admissionLimits.maxQueuedBytes != 0 && getQueuedBytes() > admissionLimits.maxQueuedBytes);	// slow clients are falling behind
+}
+
+size_t ProtocolBase::getQueuedBytes() const
+{
+	size_t queued = 0;
+	for (const Connection & connection : connections)
+	{
+		queued += connection.outbound.size();
+	}
+	return queued;
+}
+
+uint64_t ProtocolBase::getShedCount() const
+{
+	return shedCount;
+}
+
+void ProtocolBase::setOutboundLimits(const OutboundLimits & newLimits)
+{
+	outboundLimits = newLimits;
+}
+
+const OutboundLimits & ProtocolBase::getOutboundLimits() const
+{
+	return outboundLimits;
+}
+
+const OverflowCounters & ProtocolBase::getOverflowCounters() const
+{
+	return overflowCounters;
+}
+
+void ProtocolBase::setWriteCoalescing(const WriteCoalescing & newCoalescing)
+{
+	writeCoalescing = newCoalescing;
+}
+
+const WriteCoalescing & ProtocolBase::getWriteCoalescing() const
+{
+	return writeCoalescing;
+}
+
+bool ProtocolBase::canSend(Connection & connection)
+{
+	if (connection.isClosingWhenSent || connection.isOverflowed)
+	{
+		return false;
+	}
+	if (outboundLimits.maxQueuedBytes == 0 || connection.outbound.size() < outboundLimits.maxQueuedBytes)
+	{
+		return true;
+	}
+	connection.isWaitingForDrain = true;
+	return false;
+}
+
+void ProtocolBase::countShed()
+{
+	shedCount++;
+}
+
+const string & ProtocolBase::getServiceUnavailableResponse() const
+{
+	return serviceUnavailableResponse;
 }
 
 bool ProtocolBase::isRoomForNewConnection()
@@ -141,23 +573,62 @@ bool ProtocolBase::isRoomForNewConnection()
 	}
 }
 
+Connection & ProtocolBase::storeConnection(const Connection & connection)
+{
+	if (writeCoalescing.isEnabled && writeCoalescing.isNoDelay)
+	{
+		SET_NO_DELAY(connection.sock, true);
+	}
+	connections.push_back(connection);
+	connectionIndex[connection.sock] = connections.size() - 1;
+	FD_SET(connection.sock, &receivingSockets);
+	return connections.back();
+}
+
+Connection * ProtocolBase::findConnection(const SOCKET sock)
+{
+	auto index = connectionIndex.find(sock);
+	if (index != connectionIndex.end() && index->second < connections.size() && connections[index->second].sock == sock)
+	{
+		return &connections[index->second];
+	}
+
+	// not indexed, the connection may have been added to the collection directly
+	for (size_t i = 0; i < connections.size(); i++)
+	{
+		if (connections[i].sock == sock)
+		{
+			connectionIndex[sock] = i;
+			return &connections[i];
+		}
+	}
+	return nullptr;
+}
+
 void ProtocolBase::removeConnection(Connection & connection)
 {
-	auto i = find(connections.begin(), connections.end(), connection);
-	if (i != connections.end())
+	SOCKET sock = connection.sock;	// connection may refer to the element being removed
+	Connection * stored = findConnection(sock);
+	if (stored != nullptr)
 	{
-		connections.erase(i);
+		// order doesn't matter, so fill the gap with the last connection rather than shifting them all
+		size_t position = stored - connections.data();
+		if (position != connections.size() - 1)
+		{
+			connections[position] = std::move(connections.back());
+			connectionIndex[connections[position].sock] = position;
+		}
+		connections.pop_back();
 	}
-	FD_CLR(connection.sock, &receivingSockets);
+	connectionIndex.erase(sock);
+	FD_CLR(sock, &receivingSockets);
 	connectionCount--;
 }
 
 void ProtocolBase::updateConnectionLife(Connection & connection)
 {
 	// find the vector element containing the connection
-	auto target = find_if(connections.begin(), connections.end(),
-		[&connection](Connection & rhs) {return (connection.sock == rhs.sock); });
-	if (target != connections.end())	// there is a result
+	if (findConnection(connection.sock) != nullptr)	// there is a result
 	{
 		connection.updateTime();
 		// if not at end, move to end
@@ -172,6 +643,11 @@ void ProtocolBase::readReceivedData(Connection & connection)
 	memset(buffer, 0, DEFAULT_BUFFER_SIZE);
 	SSIZE_T bytesIn = recv(connection.sock, buffer, DEFAULT_BUFFER_SIZE, 0);
 
+	if (bytesIn < 0 && IS_WOULD_BLOCK())	// nothing to read after all
+	{
+		return;
+	}
+
 	if (bytesIn <= 0)	// no data, connection closed by client
 	{
 		// TODO: Not getting called
@@ -179,37 +655,91 @@ void ProtocolBase::readReceivedData(Connection & connection)
 	}
 	else // valid data
 	{
+		if (connection.phase == Connection::Phase::AWAITING_FIRST_BYTE)
+		{
+			connection.setPhase(Connection::Phase::IDLE);	// protocols move partial messages into a reading phase
+		}
+		connection.phaseBytes += bytesIn;
 		updateConnectionLife(connection);
-		std::string message(buffer, bytesIn);
-		receiveData(connection, message);
+		receivedMessage.assign(buffer, bytesIn);	// reuses capacity, no allocation per read
+		receiveData(connection, receivedMessage);
+	}
+}
+
+void ProtocolBase::flushConnection(Connection & connection)
+{
+	size_t queued = connection.outbound.size();
+	FlushStatus status = connection.outbound.flush(connection.sock);
+	if (status == FlushStatus::FAILED)
+	{
+		gaf::util::Log::debug("Unable to send queued data");
+		closeConnection(connection);
+		return;
+	}
+
+	if (connection.outbound.size() != queued)	// a client that keeps reading isn't idle
+	{
+		connection.updateTime();
+	}
+
+	if (status == FlushStatus::DONE && connection.isClosingWhenSent)
+	{
+		closeConnection(connection);
+		return;
+	}
+
+	if (connection.isWaitingForDrain && connection.outbound.size() <= outboundLimits.drainedBytes)
+	{
+		connection.isWaitingForDrain = false;
+		onDrain(connection);
 	}
 }
 
-void ProtocolBase::removeExpiredConnections()
+void ProtocolBase::checkTimers()
 {
-	//std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
-	//std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
 	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-	
-	//for (auto current : connections)
-	//for(std::vector<Connection>::iterator it = connections.begin(); it != connections.end();)
-	std::vector<Connection>::iterator it = connections.begin();
-	while (it != connections.end())
+	if (now - lastTimerCheck < TIMER_INTERVAL)
+	{
+		return;
+	}
+	lastTimerCheck = now;
+
+	removeExpiredConnections(now);
+	onTimer(now);
+}
+
+void ProtocolBase::removeExpiredConnections(const std::chrono::steady_clock::time_point now)
+{
+	// closing removes from the collection, so collect the expired sockets first
+	socketList.clear();
+	for (auto & connection : connections)
+	{
+		if (connection.isPastDeadline(deadlines, now))
+		{
+			socketList.push_back(connection.sock);
+		}
+	}
+
+	for (SOCKET sock : socketList)
 	{
-		// we want to know where the next object is so we can delete the current one if needed
-		auto current = it;
-		it++;
-		//see if the connection is expired
-		//if (now - current->lastUse > secondsUntilConnectionCloses)
-		if(current->isAlive(secondsUntilConnectionCloses))	// if this is alive
+		Connection * connection = findConnection(sock);
+		if (connection != nullptr)
 		{
-			// all subsequent connections will still be alive, so stop looking
-			//it = connections.end();	// break out of loop
+			gaf::util::Log::debug("Connection passed its deadline");
+			closeConnection(*connection);
 		}
-		else
+	}
+}
+
+SOCKET ProtocolBase::getHighestSocket() const
+{
+	SOCKET highest = listenerSocket;
+	for (auto & connection : connections)
+	{
+		if (connection.sock > highest)
 		{
-			// close connection
-			closeConnection(*current);
+			highest = connection.sock;
 		}
 	}
+	return highest;
 }
@@ -13,6 +13,7 @@
 #include <exception>
 #include <cstring>          // memset, memcpy
 #include <vector>			// list of connections
+#include <unordered_map>	// connection lookup
 #include <algorithm>		// find_if, rotate
 #include <chrono>			// connection timeout
 #include <time.h>			// select time-out
@@ -25,6 +26,53 @@ using std::string;
 
 namespace ams
 {
+	/// Thresholds beyond which a protocol stops admitting new work,
+	/// so the connections already admitted keep their latency
+	struct AdmissionLimits
+	{
+		std::chrono::milliseconds maxLoopLag{ 100 };	/// longest acceptable server loop iteration (smoothed)
+		unsigned int maxConnections = FD_SETSIZE - FD_SETSIZE / 8;	/// connections beyond which new work is refused
+		size_t maxQueuedBytes = 0;	/// data waiting to be sent to all connections beyond which new work is refused, 0 for no limit
+		unsigned int retryAfterSeconds = 1;	/// how long refused clients are asked to wait
+	};
+
+	/// What to do with a message that would take a connection's outbound queue past its limit
+	enum class OverflowPolicy
+	{
+		DISCONNECT,		/// close the connection, the client can reconnect and catch up
+		DROP_OLDEST,	/// drop queued messages, oldest first, to make room
+		DROP_NEWEST,	/// drop the new message
+		COALESCE		/// replace a queued message with the same key, otherwise drop the oldest
+	};
+
+	/// Bounds on the data waiting to be sent to each connection,
+	/// so a slow client can't make the server's memory grow without limit
+	struct OutboundLimits
+	{
+		size_t maxQueuedBytes = 0;	/// largest outbound queue, 0 for no limit
+		OverflowPolicy policy = OverflowPolicy::DISCONNECT;	/// what happens when the limit is reached
+		size_t drainedBytes = 0;	/// queue size at which producers that were told to wait are called back
+	};
+
+	/// Number of times each overflow policy was applied
+	struct OverflowCounters
+	{
+		uint64_t disconnects = 0;	/// connections closed
+		uint64_t droppedOldest = 0;	/// queued messages dropped
+		uint64_t droppedNewest = 0;	/// new messages dropped
+		uint64_t coalesced = 0;		/// queued messages replaced by newer ones
+	};
+
+	/// How data sent to connections is grouped into system calls and packets.
+	/// Coalescing trades a bounded delay for fewer of both, which suits many small messages such as chat
+	struct WriteCoalescing
+	{
+		bool isEnabled = false;	/// hold data sent during a loop iteration and write it with one call, rather than one call per send
+		std::chrono::microseconds flushWindow{ 0 };	/// how long held data waits for more to join it, 0 for the end of the iteration
+		size_t smallWriteSize = 1024;	/// sends at least this large go straight out when nothing is waiting, they fill packets on their own
+		bool isNoDelay = true;	/// turn off Nagle's algorithm on each connection, held writes are already combined
+	};
+
 	/// A collection of connections that use the same protocol
 	class ProtocolBase
 	{
@@ -58,6 +106,68 @@ namespace ams
 		/// Listen to each connection in the pool and respond to received data
 		void run();
 
+		/// Stop accepting new connections and start closing the existing ones gracefully.
+		/// Connections that haven't sent anything yet are closed straight away
+		virtual void beginShutdown();
+
+		/// @return If every connection has closed
+		bool isDrained() const;
+
+		/// Close every remaining connection immediately
+		void closeAllConnections();
+
+		/// Change how long connections may take to send their data
+		/// @param newDeadlines The limits to apply to every connection of this protocol
+		void setDeadlines(const ConnectionDeadlines & newDeadlines);
+
+		/// @return The limits applied to connections of this protocol
+		const ConnectionDeadlines & getDeadlines() const;
+
+		/// Change when the protocol starts refusing new work
+		/// @param newLimits The thresholds to apply
+		void setAdmissionLimits(const AdmissionLimits & newLimits);
+
+		/// @return The thresholds at which new work is refused
+		const AdmissionLimits & getAdmissionLimits() const;
+
+		/// Tell the protocol how far behind the server loop is running.
+		/// Called by the server after every loop
+		/// @param lag The smoothed duration of a loop iteration
+		void setLoopLag(const std::chrono::microseconds lag);
+
+		/// Check if the protocol is too busy to admit new work
+		/// @return If any of the admission limits is exceeded, or the protocol is shutting down
+		bool isOverloaded() const;
+
+		/// @return Number of bytes waiting to be sent to all connections of this protocol
+		size_t getQueuedBytes() const;
+
+		/// @return Number of requests or connections refused because of load
+		uint64_t getShedCount() const;
+
+		/// Limit how much data may wait to be sent to each connection
+		/// @param newLimits The limits and what to do when they are reached
+		void setOutboundLimits(const OutboundLimits & newLimits);
+
+		/// @return The limits on data waiting to be sent
+		const OutboundLimits & getOutboundLimits() const;
+
+		/// @return How often each overflow policy was applied
+		const OverflowCounters & getOverflowCounters() const;
+
+		/// Change how sent data is grouped into writes
+		/// @param newCoalescing The settings to apply, the no delay option applies to connections added afterwards
+		void setWriteCoalescing(const WriteCoalescing & newCoalescing);
+
+		/// @return How sent data is grouped into writes
+		const WriteCoalescing & getWriteCoalescing() const;
+
+		/// Check if a connection has room for more data, so producers can pace themselves.
+		/// When it doesn't, onDrain is called once its queue has drained
+		/// @param connection The connection to check
+		/// @return If data sent now would be queued without reaching the limit
+		bool canSend(Connection & connection);
+
 		/// Check if adding a connection exceeds the maximum number of FD_SET connections permitted by platform
 		/// If the connection can be added, increment the counter
 		/// @return If the total number of connections exceeds the platform's limit
@@ -75,6 +185,72 @@ namespace ams
 		/// @param connection the connection to remove
 		void removeConnection(Connection & connection);
 
+		/// Send a raw buffer to a socket without any protocol specific encoding.
+		/// Whatever the socket doesn't accept straight away is queued and sent when it becomes writable.
+		/// With write coalescing small buffers are copied into the queue and written at the end of the loop iteration
+		/// @param connection Which connection to send to
+		/// @param data Pointer to the bytes to send
+		/// @param size Number of bytes to send
+		void sendBuffer(Connection & connection, const char * data, const size_t size);
+
+		/// Send an already encoded buffer without copying it.
+		/// Like sendBuffer, except whatever the socket doesn't accept straight away is queued by reference
+		/// @param connection Which connection to send to
+		/// @param buffer The data to send
+		/// @param pieceSize Length of the pieces the buffer is made of, priority buffers may be sent between them. 0 for one piece
+		void sendSharedBuffer(Connection & connection, const SharedBuffer & buffer, const size_t pieceSize = 0);
+
+		/// Send a small buffer ahead of anything queued, at the next boundary between pieces.
+		/// It isn't subject to the outbound limits
+		/// @param connection Which connection to send to
+		/// @param buffer The data to send
+		void sendPriorityBuffer(Connection & connection, const SharedBuffer & buffer);
+
+		/// Queue an already encoded buffer on a connection without copying it.
+		/// The protocol's overflow policy is applied if the queue is full
+		/// @param connection Which connection to send to
+		/// @param buffer The data to send
+		/// @param key Identifies messages that supersede each other, used by OverflowPolicy::COALESCE. 0 for none
+		/// @param pieceSize Length of the pieces the buffer is made of, see sendSharedBuffer
+		void queueBuffer(Connection & connection, const SharedBuffer & buffer, const uint64_t key = 0, const size_t pieceSize = 0);
+
+		/// Queue an already encoded buffer on every connection.
+		/// The buffer is shared rather than copied, and sent as each socket becomes writable,
+		/// so a slow client can't hold up the others
+		/// @param buffer The data to send
+		void broadcastBuffer(const SharedBuffer & buffer);
+
+		/// Close a connection once everything queued for it has been sent.
+		/// No more data is read from the connection
+		/// @param connection The connection to close
+		void closeWhenSent(Connection & connection);
+
+		/// Add a connection to this pool and start listening to it
+		/// @param connection The connection to add
+		/// @return The stored connection
+		Connection & storeConnection(const Connection & connection);
+
+		/// Find a connection of this pool by its socket
+		/// @param sock The socket to look for
+		/// @return The connection, or nullptr if the socket isn't part of this pool
+		Connection * findConnection(const SOCKET sock);
+
+		/// Count a request or connection that was refused because of load
+		void countShed();
+
+		/// @return The 503 response that refuses work because of load, built once when the admission limits are set
+		const string & getServiceUnavailableResponse() const;
+
+		/// Called periodically by the loop's timer, after expired connections have been removed.
+		/// Implemented by inherited classes that need scheduled work
+		/// @param now The current time
+		virtual void onTimer(const std::chrono::steady_clock::time_point now) {}
+
+		/// Called when the queue of a connection that couldn't send has drained.
+		/// Implemented by inherited classes that let producers pace themselves
+		/// @param connection The connection that has room again
+		virtual void onDrain(Connection & connection) {}
+
 		// move to private and create protected accessors?
 		fd_set receivingSockets;	/// a connection set that tracks what sockets have received data
 		std::vector<Connection> connections;	/// structure to hold all connections
@@ -83,16 +259,70 @@ namespace ams
 		/// reset the expiry of the connection
 		void updateConnectionLife(Connection & connection);
 
+		/// Accept a waiting connection from the listener socket
+		void acceptConnection();
+
 		/// Check received data for validity and pass it on to the appropriate handler
 		void readReceivedData(Connection & connection);
 
-		/// Find and remove any connections that have timed-out
-		void removeExpiredConnections();
+		/// Apply the overflow policy to a buffer that doesn't fit in a connection's queue
+		/// @param connection The connection with the full queue
+		/// @param buffer The buffer being queued
+		/// @param key Identifies messages that supersede each other
+		/// @param isOnePiece If the buffer is a single piece, only those can replace another
+		/// @return If the buffer should still be queued
+		bool handleOverflow(Connection & connection, const SharedBuffer & buffer, const uint64_t key, const bool isOnePiece);
+
+		/// Copy data onto a connection's queue, to be written with whatever else is sent to it this loop iteration
+		/// @param connection Which connection to send to
+		/// @param data Pointer to the bytes to send
+		/// @param size Number of bytes to send
+		void appendBuffer(Connection & connection, const char * data, const size_t size);
+
+		/// Hold a connection's newly queued data until the end of the loop iteration or the flush window
+		/// @param connection The connection whose queue was empty before the data arrived
+		void holdWrites(Connection & connection);
+
+		/// Write the held data of every connection whose flush window has passed
+		void flushHeldConnections();
+
+		/// Close the connections whose queues passed their limit
+		void closeOverflowedConnections();
+
+		/// Write queued data to a connection, closing it if the write fails or a close was requested
+		/// @param connection The connection to write to
+		void flushConnection(Connection & connection);
+
+		/// Run scheduled work if the timer interval has passed
+		void checkTimers();
+
+		/// Find and remove any connections that have passed their deadline
+		/// @param now The current time
+		void removeExpiredConnections(const std::chrono::steady_clock::time_point now);
+
+		/// @return The highest socket in use, needed by select
+		SOCKET getHighestSocket() const;
 
 		static const unsigned int DEFAULT_BUFFER_SIZE = 4096;	/// max number of bytes that can be read at once
+		static constexpr std::chrono::milliseconds TIMER_INTERVAL{ 100 };	/// how often deadlines and scheduled work are checked
 		unsigned int connectionCount;
 		SOCKET listenerSocket;	/// the socket that waits for incoming connections
 		std::chrono::seconds secondsUntilConnectionCloses;	/// how many seconds a connection stays alive
+		std::string receivedMessage;	/// holds the data of the last read, kept between reads to avoid allocations
+		ConnectionDeadlines deadlines;	/// limits on how long connections may take
+		AdmissionLimits admissionLimits;	/// when to refuse new work
+		string serviceUnavailableResponse;	/// preformatted 503 response, asks the client to retry after admissionLimits.retryAfterSeconds
+		std::chrono::microseconds loopLag{ 0 };	/// smoothed duration of a server loop iteration
+		uint64_t shedCount = 0;	/// requests refused because of load
+		std::chrono::steady_clock::time_point lastTimerCheck;	/// when scheduled work last ran
+		std::vector<SOCKET> socketList;	/// scratch list of sockets to act on, kept to avoid allocations
+		std::unordered_map<SOCKET, size_t> connectionIndex;	/// position of each socket in connections
+		OutboundLimits outboundLimits;	/// bounds on data waiting to be sent
+		OverflowCounters overflowCounters;	/// how often the overflow policy was applied
+		std::vector<SOCKET> overflowedSockets;	/// connections to close because their queue overflowed
+		bool isShuttingDown = false;	/// if new work is refused because the server is stopping
+		WriteCoalescing writeCoalescing;	/// how sent data is grouped into writes
+		std::chrono::steady_clock::time_point loopTime;	/// when the current loop iteration started, the time held writes are stamped with
 	};
 }
 
@@ -11,11 +11,119 @@
 
 #ifndef AMS_SHA1_HPP
 #define AMS_SHA1_HPP
+#include <stdint.h>
 #include <cstring>
 #include "Base64.hpp"
 
 namespace ams
 {
+	namespace sha1Detail
+	{
+		const unsigned int ROUNDS = 80;
+		constexpr uint32_t INITIAL_DIGEST[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };	// defined by the SHA-1 standard
+
+		constexpr uint32_t rotateLeft(const uint32_t value, const int shift)
+		{
+			// 0 < shift < 32, otherwise there will be problems
+			return value << shift | value >> (32 - shift);
+		}
+
+		/// Extend the 16 words of a block to the 80 words used by the rounds.
+		/// constexpr so blocks known at compile time can be prepared once
+		/// @param wValues First 16 words filled in, the rest are written
+		constexpr void expandSchedule(uint32_t wValues[ROUNDS])
+		{
+			for (unsigned int i = 16; i < ROUNDS; i += 4)	// four at a time, a plain loop gets vectorized into stalled loads
+			{
+				wValues[i] = rotateLeft(wValues[i - 16] ^ wValues[i - 14] ^ wValues[i - 8] ^ wValues[i - 3], 1);
+				wValues[i + 1] = rotateLeft(wValues[i - 15] ^ wValues[i - 13] ^ wValues[i - 7] ^ wValues[i - 2], 1);
+				wValues[i + 2] = rotateLeft(wValues[i - 14] ^ wValues[i - 12] ^ wValues[i - 6] ^ wValues[i - 1], 1);
+				wValues[i + 3] = rotateLeft(wValues[i - 13] ^ wValues[i - 11] ^ wValues[i - 5] ^ wValues[i], 1);
+			}
+		}
+
+		// One round each. Rather than shifting a to e along every round, callers rotate which variable plays
+		// which part, so five rounds in a row leave everything back in place
+		inline void roundChoose(const uint32_t a, uint32_t & b, const uint32_t c, const uint32_t d, uint32_t & e, const uint32_t w)
+		{
+			e += rotateLeft(a, 5) + (d ^ (b & (c ^ d))) + 0x5A827999 + w;	// (b and c) or ((not b) and d)
+			b = rotateLeft(b, 30);
+		}
+
+		inline void roundParity(const uint32_t a, uint32_t & b, const uint32_t c, const uint32_t d, uint32_t & e, const uint32_t w, const uint32_t k)
+		{
+			e += rotateLeft(a, 5) + (b ^ c ^ d) + k + w;
+			b = rotateLeft(b, 30);
+		}
+
+		inline void roundMajority(const uint32_t a, uint32_t & b, const uint32_t c, const uint32_t d, uint32_t & e, const uint32_t w)
+		{
+			e += rotateLeft(a, 5) + ((b & c) | (d & (b | c))) + 0x8F1BBCDC + w;
+			b = rotateLeft(b, 30);
+		}
+
+		/// Run the rounds over a prepared schedule and add the result to the digest
+		/// @param digest Running digest
+		/// @param wValues The block's 80 word schedule
+		inline void compressSchedule(uint32_t digest[5], const uint32_t wValues[ROUNDS])
+		{
+			uint32_t a = digest[0], b = digest[1], c = digest[2], d = digest[3], e = digest[4];
+			const uint32_t * w = wValues;
+			for (unsigned int i = 0; i < 20; i += 5, w += 5)
+			{
+				roundChoose(a, b, c, d, e, w[0]);
+				roundChoose(e, a, b, c, d, w[1]);
+				roundChoose(d, e, a, b, c, w[2]);
+				roundChoose(c, d, e, a, b, w[3]);
+				roundChoose(b, c, d, e, a, w[4]);
+			}
+			for (unsigned int i = 20; i < 40; i += 5, w += 5)
+			{
+				roundParity(a, b, c, d, e, w[0], 0x6ED9EBA1);
+				roundParity(e, a, b, c, d, w[1], 0x6ED9EBA1);
+				roundParity(d, e, a, b, c, w[2], 0x6ED9EBA1);
+				roundParity(c, d, e, a, b, w[3], 0x6ED9EBA1);
+				roundParity(b, c, d, e, a, w[4], 0x6ED9EBA1);
+			}
+			for (unsigned int i = 40; i < 60; i += 5, w += 5)
+			{
+				roundMajority(a, b, c, d, e, w[0]);
+				roundMajority(e, a, b, c, d, w[1]);
+				roundMajority(d, e, a, b, c, w[2]);
+				roundMajority(c, d, e, a, b, w[3]);
+				roundMajority(b, c, d, e, a, w[4]);
+			}
+			for (unsigned int i = 60; i < ROUNDS; i += 5, w += 5)
+			{
+				roundParity(a, b, c, d, e, w[0], 0xCA62C1D6);
+				roundParity(e, a, b, c, d, w[1], 0xCA62C1D6);
+				roundParity(d, e, a, b, c, w[2], 0xCA62C1D6);
+				roundParity(c, d, e, a, b, w[3], 0xCA62C1D6);
+				roundParity(b, c, d, e, a, w[4], 0xCA62C1D6);
+			}
+
+			digest[0] += a;
+			digest[1] += b;
+			digest[2] += c;
+			digest[3] += d;
+			digest[4] += e;
+		}
+
+		/// Process one 64 byte block
+		/// @param digest Running digest
+		/// @param block The block, read as big endian words
+		inline void compressBlock(uint32_t digest[5], const uint8_t block[64])
+		{
+			uint32_t wValues[ROUNDS];
+			for (unsigned int i = 0; i < 16; i++)
+			{
+				wValues[i] = (uint32_t(block[i * 4]) << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+			}
+			expandSchedule(wValues);
+			compressSchedule(digest, wValues);
+		}
+	}
+
 	/// Implementation of the SHA-1 Hash algorithm as defined in RFC-3174
 	class SHA1
 	{
@@ -31,11 +139,7 @@ namespace ams
 		void reset()
 		{
 			// fill digest with starting values defined by SHA1 Standard
-			digest[0] = 0x67452301;
-			digest[1] = 0xEFCDAB89;
-			digest[2] = 0x98BADCFE;
-			digest[3] = 0x10325476;
-			digest[4] = 0xC3D2E1F0;
+			memcpy(digest, sha1Detail::INITIAL_DIGEST, sizeof(digest));
 
 			dataSize = 0;
 			clearBlock();
@@ -148,17 +252,7 @@ namespace ams
 
 		void processBlock()
 		{
-
-			WORD hash[REGISTER_COUNT];
-			fillHashRegisters(hash);
-
-
-			WORD wValues[ROUNDS];
-			fillWValues(block, wValues);
-
-			compress(hash, wValues);
-			addHashToDigest(hash);
-
+			sha1Detail::compressBlock(digest, block);
 			clearBlock();
 		}
 
@@ -204,96 +298,9 @@ namespace ams
 			}
 		}
 
-		inline const void fillHashRegisters(WORD * hash)
-		{
-			for (unsigned int i = 0; i < REGISTER_COUNT; i++)
-			{
-				hash[i] = digest[i];
-			}
-		}
-
-		inline const void fillWValues(const uint8_t * data, WORD * wValues)
-		{
-			const unsigned int WORDS_PER_BLOCK = 16;	// 512 bits per block / 32 bits per word = 16 words
-
-			for (unsigned int i = 0; i < WORDS_PER_BLOCK; i++)
-			{
-				wValues[i] = writeBytesToWord(&(data[i * 4]));
-			}
-			for (unsigned int i = WORDS_PER_BLOCK; i < ROUNDS; i++)
-			{
-				wValues[i] = rotateLeft(wValues[i-16] ^ wValues[i-14] ^ wValues[i-8] ^ wValues[i-3]);
-			}
-		}
-
-		inline const WORD writeBytesToWord(const uint8_t * source)
-		{
-			return (source[0] << 24) + (source[1] << 16) + (source[2] << 8) + source[3];
-		}
-
-		inline const WORD rotateLeft(const uint32_t value, const int shift = 1)
-		{
-			// 0 < shift < 32, otherwise there will be problems
-			return value << shift | value >> (32 - shift);
-		}
-
-		void compress(WORD * hash, WORD * wValues)
-		{
-			const int stage1 = 20;
-			const int stage2 = 40;
-			const int stage3 = 60;
-
-			for (unsigned int round = 0; round < ROUNDS; round++)
-			{
-				WORD temp;
-				WORD k;
-
-				if (round < stage1)	// stage 1
-				{
-					temp = (hash[1] & hash[2]) | ((~hash[1]) & hash[3]); // (b and c) or ((not b) and d)
-					k = 0x5A827999;
-				}
-				else if (round < stage2)
-				{
-					temp = hash[1] ^ hash[2] ^ hash[3];	// b xor c xor d
-					k = 0x6ED9EBA1;
-				}
-				else if (round < stage3)
-				{
-					temp = (hash[1] & hash[2]) | (hash[1] & hash[3]) | (hash[2] & hash[3]);	// (a and b) or (a and c) or (b and c)
-					k = 0x8F1BBCDC;
-				}
-				else
-				{
-					temp = hash[1] ^ hash[2] ^ hash[3];	// b xor c xor d
-					k = 0xCA62C1D6;
-				}
-
-				temp = temp + hash[4];
-				temp = temp + rotateLeft(hash[0], 5);
-				temp = temp + wValues[round];
-				temp = temp + k;
-
-				hash[4] = hash[3];
-				hash[3] = hash[2];
-				hash[2] = rotateLeft(hash[1], 30);
-				hash[1] = hash[0];
-				hash[0] = temp;
-			}
-		}
-
-		inline void addHashToDigest(WORD * hash)
-		{
-			for (unsigned int i = 0; i < REGISTER_COUNT; i++)
-			{
-				digest[i] = digest[i] + hash[i];
-			}
-		}
-
 		// Values defined in the SHA-1 Specs
 		const static unsigned int BYTES_PER_BLOCK = 64;	// 512 bits
 		const static unsigned int REGISTER_COUNT = 5;
-		const static unsigned int ROUNDS = 80;
 		const static unsigned int BYTES_PER_DIGEST = 20;
 
 		WORD digest[REGISTER_COUNT];
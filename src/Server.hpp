@@ -13,6 +13,7 @@
 #define AMS_SERVER_HPP
 
 #include <vector>
+#include <chrono>
 #include "Platforms.hpp"
 #include "ProtocolBase.hpp"
 
@@ -55,14 +56,65 @@ namespace ams
 		/// Can be used to call from an external loop
 		void loop()
 		{
+			auto start = std::chrono::steady_clock::now();
 			for (auto i : protocols)
 			{
 				i->run();
 			}
+
+			// smooth the iteration time so one slow loop doesn't trigger load shedding
+			auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+			loopLag = (loopLag * 7 + duration) / 8;
+			for (auto i : protocols)
+			{
+				i->setLoopLag(loopLag);
+			}
+		}
+
+		/// Stop accepting connections, close the existing ones gracefully and wait for them to finish.
+		/// Connections still open when the time runs out are closed
+		/// @param drainTimeout Longest time to wait for connections to finish
+		void shutdown(const std::chrono::milliseconds drainTimeout)
+		{
+			for (auto i : protocols)
+			{
+				i->beginShutdown();
+			}
+
+			auto deadline = std::chrono::steady_clock::now() + drainTimeout;
+			do	// always loop once, so anything already queued gets a chance to be sent
+			{
+				loop();
+			} while (!isDrained() && std::chrono::steady_clock::now() < deadline);
+
+			for (auto i : protocols)
+			{
+				i->closeAllConnections();
+			}
+		}
+
+		/// @return If every protocol's connections have closed
+		bool isDrained() const
+		{
+			for (auto i : protocols)
+			{
+				if (!i->isDrained())
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/// @return The smoothed duration of a loop iteration
+		std::chrono::microseconds getLoopLag() const
+		{
+			return loopLag;
 		}
 
 	private:
 		std::vector<ProtocolBase*> protocols;
+		std::chrono::microseconds loopLag{ 0 };	/// smoothed duration of a loop iteration, used for admission control
 	};
 }
 #endif // !AMS_SERVER_HPP
@@ -11,6 +11,8 @@
 #define AMS_THREADED_SERVER_HPP
 
 #include <thread>
+#include <atomic>
+#include <chrono>
 #include "Server.hpp"
 
 namespace ams
@@ -20,7 +22,7 @@ namespace ams
 	{
 	public:
 		/// Default Constructor
-		ThreadedServer() : Server() {}
+		ThreadedServer() : Server(), isRunning(false), serverThread(nullptr) {}
 		/// Destructor
 		~ThreadedServer() {}
 		
@@ -32,12 +34,16 @@ namespace ams
 				{ continuousLoop(); });
 		}
 
-		/// Stop server and thread
-		void stop()
+		/// Stop server and thread.
+		/// New connections are refused while the existing ones are closed gracefully
+		/// @param drainTimeout Longest time to wait for connections to finish before they are closed
+		void stop(const std::chrono::milliseconds drainTimeout = std::chrono::milliseconds{ 0 })
 		{
+			this->drainTimeout = drainTimeout;	// published to the server thread by the atomic store below
 			isRunning = false;
 			serverThread->join();
 			delete serverThread;
+			serverThread = nullptr;
 		}
 
 	private:
@@ -47,10 +53,12 @@ namespace ams
 			{
 				loop();
 			}
+			shutdown(drainTimeout);	// on the server thread, the protocols aren't thread safe
 		}
 
-		bool isRunning;
+		std::atomic<bool> isRunning;
 		std::thread * serverThread;
+		std::chrono::milliseconds drainTimeout{ 0 };	/// how long stop waits for connections to finish
 	};
 }
 
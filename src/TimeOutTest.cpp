@@ -74,4 +74,94 @@ TEST_CASE("Connection Time-out")
 		REQUIRE(state == 2);
 	}
 */
-}
\ No newline at end of file
+}
+TEST_CASE("Connection Deadlines")
+{
+	ConnectionDeadlines deadlines;
+	deadlines.firstByte = std::chrono::milliseconds{ 100 };
+	deadlines.headers = std::chrono::milliseconds{ 200 };
+	deadlines.rateGracePeriod = std::chrono::milliseconds{ 1000 };
+	deadlines.minimumBytesPerSecond = 100;
+
+	Connection connection;
+	auto start = connection.phaseStart;
+
+	SECTION("First byte")
+	{
+		REQUIRE(!connection.isPastDeadline(deadlines, start + std::chrono::milliseconds{ 50 }));
+		REQUIRE(connection.isPastDeadline(deadlines, start + std::chrono::milliseconds{ 150 }));
+	}
+
+	SECTION("Dribbled headers don't extend deadline")
+	{
+		connection.setPhase(Connection::Phase::READING_HEADERS, start);
+		connection.setPhase(Connection::Phase::READING_HEADERS, start + std::chrono::milliseconds{ 150 });
+		REQUIRE(connection.isPastDeadline(deadlines, start + std::chrono::milliseconds{ 250 }));
+	}
+
+	SECTION("Minimum body rate")
+	{
+		connection.setPhase(Connection::Phase::READING_BODY, start);
+		REQUIRE(!connection.isPastDeadline(deadlines, start + std::chrono::milliseconds{ 500 }));	// grace period
+
+		connection.phaseBytes = 150;
+		REQUIRE(connection.isPastDeadline(deadlines, start + std::chrono::milliseconds{ 2000 }));	// 75 bytes per second
+
+		connection.phaseBytes = 250;
+		REQUIRE(!connection.isPastDeadline(deadlines, start + std::chrono::milliseconds{ 2000 }));	// 125 bytes per second
+	}
+
+	SECTION("Idle")
+	{
+		connection.setPhase(Connection::Phase::IDLE, start);
+		REQUIRE(!connection.isPastDeadline(deadlines, start + std::chrono::hours{ 1 }));	// no limit by default
+
+		deadlines.idle = std::chrono::milliseconds{ 100 };
+		REQUIRE(connection.isPastDeadline(deadlines, connection.lastUse + std::chrono::milliseconds{ 150 }));
+	}
+}
+
+TEST_CASE("Admission Control")
+{
+	int state = 0;
+	TestProtocol protocol(state);
+
+	SECTION("Loop lag")
+	{
+		REQUIRE(!protocol.isOverloaded());
+		protocol.setLoopLag(std::chrono::milliseconds{ 500 });
+		REQUIRE(protocol.isOverloaded());
+		protocol.setLoopLag(std::chrono::milliseconds{ 1 });
+		REQUIRE(!protocol.isOverloaded());
+	}
+
+	SECTION("Connection count")
+	{
+		AdmissionLimits limits;
+		limits.maxConnections = 1;
+		protocol.setAdmissionLimits(limits);
+		REQUIRE(protocol.isRoomForNewConnection());
+		REQUIRE(!protocol.isOverloaded());
+		REQUIRE(protocol.isRoomForNewConnection());
+		REQUIRE(protocol.isOverloaded());
+	}
+
+	SECTION("Queued data")
+	{
+		AdmissionLimits limits;
+		limits.maxQueuedBytes = 10;
+		protocol.setAdmissionLimits(limits);
+		Connection slow, slower;
+		slow.outbound.push(std::make_shared<const std::string>("hello"));
+		slower.outbound.push(std::make_shared<const std::string>("world"));
+		protocol.addConnection(slow, "");
+		protocol.addConnection(slower, "");
+		REQUIRE(protocol.getQueuedBytes() == 10);
+		REQUIRE(!protocol.isOverloaded());	// at the limit
+
+		slower.outbound.push(std::make_shared<const std::string>("!"));
+		protocol.addConnection(slower, "");
+		REQUIRE(protocol.getQueuedBytes() == 16);
+		REQUIRE(protocol.isOverloaded());	// no single queue is large, together they are
+	}
+}
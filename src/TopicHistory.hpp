@@ -0,0 +1,284 @@
+/******************************
+ * @file TopicHistory.hpp
+ * Alex's MicroServer (AMS)
+ * @author Alex Schlieck
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * Recent frames of a topic, numbered so clients that join late or reconnect can catch up
+ ******************************/
+
+#ifndef AMS_TOPIC_HISTORY_HPP
+#define AMS_TOPIC_HISTORY_HPP
+
+#include <stdint.h>
+#include <cstring>	// memcpy, memcmp
+#include <memory>
+#include <string>
+#include <vector>
+#include "Platforms.hpp"
+#include "OutboundQueue.hpp"	// SharedBuffer
+#ifndef _WIN32
+	#include <sys/mman.h>	// mmap
+	#include <sys/stat.h>	// fstat
+#endif
+
+namespace ams
+{
+	/// @brief A file mapped into memory, so whatever is written to it is kept by the operating system even if the process dies
+	class MappedFile
+	{
+	public:
+		/// Constructor, nothing is mapped until open is called
+		MappedFile() {}
+
+		/// Destructor, unmaps the file
+		~MappedFile()
+		{
+			close();
+		}
+
+		MappedFile(const MappedFile &) = delete;
+		MappedFile & operator = (const MappedFile &) = delete;
+
+		/// Map a file, creating it or changing its size as needed
+		/// @param path The file to map
+		/// @param newSize Number of bytes to map
+		/// @return If the file was mapped
+		bool open(const std::string & path, const size_t newSize)
+		{
+			close();
+#ifdef _WIN32
+			HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(newSize) >> 32), static_cast<DWORD>(newSize), nullptr);	// grows the file to the mapped size
+			void * address = mapping == nullptr ? nullptr : MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, newSize);
+			if (mapping != nullptr)
+			{
+				CloseHandle(mapping);	// the view keeps the mapping open
+			}
+			CloseHandle(file);
+			if (address == nullptr)
+			{
+				return false;
+			}
+#else
+			int file = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+			if (file < 0)
+			{
+				return false;
+			}
+			struct stat status;
+			bool isSized = fstat(file, &status) == 0 && (static_cast<size_t>(status.st_size) == newSize || ftruncate(file, static_cast<off_t>(newSize)) == 0);
+			void * address = isSized ? mmap(nullptr, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0) : MAP_FAILED;
+			::close(file);	// the mapping keeps the file open
+			if (address == MAP_FAILED)
+			{
+				return false;
+			}
+#endif
+			bytes = static_cast<uint8_t*>(address);
+			size = newSize;
+			return true;
+		}
+
+		/// Unmap the file, everything written stays in it
+		void close()
+		{
+			if (bytes != nullptr)
+			{
+#ifdef _WIN32
+				UnmapViewOfFile(bytes);
+#else
+				munmap(bytes, size);
+#endif
+				bytes = nullptr;
+				size = 0;
+			}
+		}
+
+		/// @return Start of the mapped bytes, nullptr if nothing is mapped
+		uint8_t * data() const
+		{
+			return bytes;
+		}
+
+	private:
+		uint8_t * bytes = nullptr;	/// start of the mapping
+		size_t size = 0;	/// number of bytes mapped
+	};
+
+	/// @brief The most recent frames published to a topic, each with a sequence number so a client can ask for the ones it missed.
+	/// Frames are kept already encoded and are shared with the queues they are replayed on, so a replay costs no encoding or copying.
+	/// The frames can also be written to a mapped file, so the history survives a restart
+	class TopicHistory
+	{
+	public:
+		/// Constructor
+		/// @param capacity Number of frames kept, older ones are dropped
+		explicit TopicHistory(const size_t capacity) : frames(capacity == 0 ? 1 : capacity) {}
+
+		/// Keep the frames in a file as well, loading any that a previous run left in it.
+		/// Frames larger than the slot size are only kept in memory, so they are missing after a restart
+		/// @param path File to use, created if it doesn't exist. A file made with a different capacity or slot size is started over
+		/// @param newSlotSize Largest frame written to the file
+		/// @return If the file could be used
+		bool mapFile(const std::string & path, const size_t newSlotSize = DEFAULT_SLOT_SIZE)
+		{
+			slotSize = newSlotSize;
+			if (!file.open(path, HEADER_SIZE + frames.size() * getSlotStride()))
+			{
+				return false;
+			}
+
+			FileHeader header{};
+			memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+			header.capacity = frames.size();
+			header.slotSize = slotSize;
+			if (memcmp(file.data(), &header, sizeof(header)) != 0)	// new, or made for other settings
+			{
+				memset(file.data(), 0, HEADER_SIZE + frames.size() * getSlotStride());
+				memcpy(file.data(), &header, sizeof(header));
+				return true;
+			}
+
+			loadFromFile();
+			return true;
+		}
+
+		/// Store a frame, dropping the oldest if the history is full
+		/// @param frame The encoded frame
+		/// @return The frame's sequence number
+		uint64_t add(const SharedBuffer & frame)
+		{
+			uint64_t sequence = nextSequence++;
+			frames[sequence % frames.size()] = frame;
+			if (nextSequence - oldestSequence > frames.size())
+			{
+				oldestSequence = nextSequence - frames.size();
+			}
+			if (file.data() != nullptr)
+			{
+				writeToFile(sequence, *frame);
+			}
+			return sequence;
+		}
+
+		/// @return Sequence number the next frame will get, the first is 1
+		uint64_t getNextSequence() const
+		{
+			return nextSequence;
+		}
+
+		/// @return Sequence number of the oldest frame kept, equal to getNextSequence when there are none
+		uint64_t getOldestSequence() const
+		{
+			return oldestSequence;
+		}
+
+		/// Call a function with each frame newer than a sequence number, oldest first
+		/// @param lastSequence The last sequence number already seen, 0 for every frame kept
+		/// @param visit Called with each frame
+		/// @return Number of frames visited
+		template <typename Visitor>
+		size_t forEachAfter(const uint64_t lastSequence, Visitor visit) const
+		{
+			size_t count = 0;
+			for (uint64_t sequence = lastSequence < oldestSequence ? oldestSequence : lastSequence + 1; sequence < nextSequence; sequence++)
+			{
+				const SharedBuffer & frame = frames[sequence % frames.size()];
+				if (frame != nullptr)	// missing if it was too large for the file before a restart
+				{
+					visit(frame);
+					count++;
+				}
+			}
+			return count;
+		}
+
+	private:
+		/// Start of the file, identifies the settings its slots were written with
+		struct FileHeader
+		{
+			char magic[8];
+			uint64_t capacity;
+			uint64_t slotSize;
+		};
+
+		/// Start of each slot, followed by the frame
+		struct SlotHeader
+		{
+			uint64_t sequence;	/// 0 while the slot is empty or being written
+			uint64_t length;	/// bytes in the frame
+		};
+
+		size_t getSlotStride() const
+		{
+			return sizeof(SlotHeader) + slotSize;
+		}
+
+		uint8_t * getSlot(const uint64_t sequence) const
+		{
+			return file.data() + HEADER_SIZE + (sequence % frames.size()) * getSlotStride();
+		}
+
+		/// Write a frame to its slot. The sequence number goes in last, so a slot is never read half written.
+		/// A frame too large for the slot only leaves its sequence number, so numbering carries on after a restart
+		void writeToFile(const uint64_t sequence, const std::string & frame)
+		{
+			uint8_t * slot = getSlot(sequence);
+			SlotHeader header{ 0, frame.length() };
+			memcpy(slot, &header, sizeof(header));
+			if (frame.length() <= slotSize)
+			{
+				memcpy(slot + sizeof(header), frame.data(), frame.length());
+			}
+			header.sequence = sequence;
+			memcpy(slot, &header, sizeof(header));
+		}
+
+		/// Rebuild the history from the slots a previous run wrote
+		void loadFromFile()
+		{
+			uint64_t newest = 0;
+			uint64_t oldest = UINT64_MAX;
+			for (size_t i = 0; i < frames.size(); i++)
+			{
+				SlotHeader header;
+				const uint8_t * slot = file.data() + HEADER_SIZE + i * getSlotStride();
+				memcpy(&header, slot, sizeof(header));
+				if (header.sequence == 0 || header.sequence % frames.size() != i)
+				{
+					continue;
+				}
+				if (header.length <= slotSize)
+				{
+					frames[i] = std::make_shared<const std::string>(reinterpret_cast<const char*>(slot + sizeof(header)), static_cast<size_t>(header.length));
+				}
+				newest = header.sequence > newest ? header.sequence : newest;
+				oldest = header.sequence < oldest ? header.sequence : oldest;
+			}
+
+			if (newest != 0)
+			{
+				nextSequence = newest + 1;
+				oldestSequence = newest - oldest >= frames.size() ? nextSequence - frames.size() : oldest;
+			}
+		}
+
+		static constexpr char FILE_MAGIC[8] = { 'A', 'M', 'S', 'H', 'I', 'S', 'T', '1' };
+		static const size_t HEADER_SIZE = 64;	/// bytes before the first slot
+		static const size_t DEFAULT_SLOT_SIZE = 4096;	/// largest frame written to the file by default
+
+		std::vector<SharedBuffer> frames;	/// ring of frames, each at its sequence number modulo the capacity
+		uint64_t nextSequence = 1;	/// sequence number of the next frame, 0 means nothing was seen
+		uint64_t oldestSequence = 1;	/// sequence number of the oldest frame kept
+		MappedFile file;	/// copy of the frames that survives a restart, not mapped if unused
+		size_t slotSize = 0;	/// largest frame the file takes
+	};
+}
+
+#endif // !AMS_TOPIC_HISTORY_HPP
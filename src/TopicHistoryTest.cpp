@@ -0,0 +1,84 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "../test/catch.hpp"
+#include "TopicHistory.hpp"
+
+using namespace ams;
+
+namespace
+{
+	/// Collect the frames after a sequence number
+	std::vector<std::string> getFramesAfter(const TopicHistory & history, const uint64_t lastSequence)
+	{
+		std::vector<std::string> result;
+		history.forEachAfter(lastSequence, [&result](const SharedBuffer & frame) { result.push_back(*frame); });
+		return result;
+	}
+}
+
+TEST_CASE("Topic History", "[websocket],[topic]")
+{
+	TopicHistory history(3);
+
+	SECTION("Sequence numbers")
+	{
+		REQUIRE(history.getNextSequence() == 1);
+		REQUIRE(history.getOldestSequence() == 1);
+		REQUIRE(getFramesAfter(history, 0).empty());
+
+		REQUIRE(history.add(std::make_shared<const std::string>("a")) == 1);
+		REQUIRE(history.add(std::make_shared<const std::string>("b")) == 2);
+		REQUIRE(getFramesAfter(history, 0) == std::vector<std::string>{ "a", "b" });
+		REQUIRE(getFramesAfter(history, 1) == std::vector<std::string>{ "b" });
+		REQUIRE(getFramesAfter(history, 2).empty());	// up to date
+	}
+
+	SECTION("Oldest frames are dropped")
+	{
+		for (const char * frame : { "a", "b", "c", "d", "e" })
+		{
+			history.add(std::make_shared<const std::string>(frame));
+		}
+		REQUIRE(history.getOldestSequence() == 3);
+		REQUIRE(getFramesAfter(history, 0) == std::vector<std::string>{ "c", "d", "e" });
+		REQUIRE(getFramesAfter(history, 1) == std::vector<std::string>{ "c", "d", "e" });	// b was missed, c onwards is all there is
+		REQUIRE(getFramesAfter(history, 4) == std::vector<std::string>{ "e" });
+	}
+
+	SECTION("Frames are shared, not copied")
+	{
+		SharedBuffer frame = std::make_shared<const std::string>("shared");
+		history.add(frame);
+		history.forEachAfter(0, [&frame](const SharedBuffer & stored) { REQUIRE(stored == frame); });
+	}
+
+	SECTION("Survives a restart in a mapped file")
+	{
+		const char * path = "TopicHistoryTest.tmp";
+		std::remove(path);
+		{
+			TopicHistory before(3);
+			REQUIRE(before.mapFile(path, 16));
+			for (const char * frame : { "a", "b", "c", "d" })
+			{
+				before.add(std::make_shared<const std::string>(frame));
+			}
+			before.add(std::make_shared<const std::string>(std::string(17, 'x')));	// too large for the file
+		}
+
+		{
+			TopicHistory after(3);
+			REQUIRE(after.mapFile(path, 16));
+			REQUIRE(after.getNextSequence() == 6);	// numbering carries on past the frame that wasn't written
+			REQUIRE(after.getOldestSequence() == 3);
+			REQUIRE(getFramesAfter(after, 0) == std::vector<std::string>{ "c", "d" });
+			REQUIRE(after.add(std::make_shared<const std::string>("f")) == 6);
+		}
+
+		TopicHistory otherSettings(4);	// can't use the slots, starts over
+		REQUIRE(otherSettings.mapFile(path, 16));
+		REQUIRE(otherSettings.getNextSequence() == 1);
+		std::remove(path);
+	}
+}
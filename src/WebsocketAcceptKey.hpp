@@ -0,0 +1,96 @@
+/******************************
+ * @file WebsocketAcceptKey.hpp
+ * Alex's MicroServer (AMS)
+ * @author Alex Schlieck
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * Works out the Sec-WebSocket-Accept answer to a handshake (RFC 6455 section 4.2.2).
+ * The key and GUID always make a 60 byte message, so the hash is two fixed blocks on the stack
+ * and the second one, holding only padding and the length, is prepared at compile time
+ ******************************/
+
+#ifndef AMS_WEBSOCKET_ACCEPT_KEY_HPP
+#define AMS_WEBSOCKET_ACCEPT_KEY_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include "Base64.hpp"
+#include "SHA-1.hpp"
+
+namespace ams
+{
+	const size_t WEBSOCKET_KEY_LENGTH = 24;	/// Sec-WebSocket-Key, 16 random bytes in base64
+	const size_t WEBSOCKET_ACCEPT_LENGTH = 28;	/// Sec-WebSocket-Accept, a 20 byte digest in base64
+	constexpr char WEBSOCKET_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";	/// appended to the key, defined in RFC 6455
+
+	namespace acceptKeyDetail
+	{
+		const unsigned int KEY_WORDS = WEBSOCKET_KEY_LENGTH / 4;
+
+		struct Schedule
+		{
+			uint32_t wValues[sha1Detail::ROUNDS];
+		};
+
+		/// Words 6 to 15 of the first block: the GUID, then the end of message marker
+		constexpr Schedule makeFirstBlockTail()
+		{
+			Schedule tail{};
+			for (unsigned int i = 0; i < sizeof(WEBSOCKET_GUID) - 1; i++)
+			{
+				tail.wValues[KEY_WORDS + i / 4] |= uint32_t(uint8_t(WEBSOCKET_GUID[i])) << (24 - 8 * (i % 4));
+			}
+			tail.wValues[15] = 0x80000000;	// 10000000 after the last byte
+			return tail;
+		}
+
+		/// The whole schedule of the second block: zeros then the message length
+		constexpr Schedule makePaddingSchedule()
+		{
+			Schedule padding{};
+			padding.wValues[15] = (WEBSOCKET_KEY_LENGTH + sizeof(WEBSOCKET_GUID) - 1) * 8;	// length in bits
+			sha1Detail::expandSchedule(padding.wValues);
+			return padding;
+		}
+
+		constexpr Schedule FIRST_BLOCK_TAIL = makeFirstBlockTail();
+		constexpr Schedule PADDING_SCHEDULE = makePaddingSchedule();
+	}
+
+	/// Work out the answer to a client's handshake key without allocating
+	/// @param key The Sec-WebSocket-Key, exactly WEBSOCKET_KEY_LENGTH characters
+	/// @param output [out] Room for WEBSOCKET_ACCEPT_LENGTH characters, not null-terminated
+	inline void writeWebsocketAcceptKey(const char * key, char * output)
+	{
+		using namespace acceptKeyDetail;
+		uint32_t wValues[sha1Detail::ROUNDS];
+		for (unsigned int i = 0; i < KEY_WORDS; i++)
+		{
+			const uint8_t * bytes = reinterpret_cast<const uint8_t*>(key + i * 4);
+			wValues[i] = (uint32_t(bytes[0]) << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+		}
+		for (unsigned int i = KEY_WORDS; i < 16; i++)
+		{
+			wValues[i] = FIRST_BLOCK_TAIL.wValues[i];
+		}
+		sha1Detail::expandSchedule(wValues);
+
+		uint32_t digest[5] = { sha1Detail::INITIAL_DIGEST[0], sha1Detail::INITIAL_DIGEST[1], sha1Detail::INITIAL_DIGEST[2],
+			sha1Detail::INITIAL_DIGEST[3], sha1Detail::INITIAL_DIGEST[4] };
+		sha1Detail::compressSchedule(digest, wValues);
+		sha1Detail::compressSchedule(digest, PADDING_SCHEDULE.wValues);
+
+		uint8_t bytes[20];
+		for (unsigned int i = 0; i < 5; i++)
+		{
+			bytes[i * 4] = static_cast<uint8_t>(digest[i] >> 24);
+			bytes[i * 4 + 1] = static_cast<uint8_t>(digest[i] >> 16);
+			bytes[i * 4 + 2] = static_cast<uint8_t>(digest[i] >> 8);
+			bytes[i * 4 + 3] = static_cast<uint8_t>(digest[i]);
+		}
+		writeBase64(bytes, sizeof(bytes), output);
+	}
+}
+
+#endif // !AMS_WEBSOCKET_ACCEPT_KEY_HPP
@@ -0,0 +1,157 @@
+/******************************
+ * @file WebsocketClient.hpp
+ * Alex's MicroServer (AMS)
+ * @author Alex Schlieck
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * Opens websockets to other servers from the same event loop as the server side protocols
+ ******************************/
+
+#ifndef AMS_WEBSOCKET_CLIENT_HPP
+#define AMS_WEBSOCKET_CLIENT_HPP
+
+#include <unordered_map>
+#include "Base64.hpp"
+#include "WebsocketProtocol.hpp"
+
+namespace ams
+{
+	/// @brief Client end of websocket connections.
+	/// Add it to a server like any other protocol, then open connections with connect.
+	/// Messages, callbacks, heartbeats and the close handshake work the same as in WebsocketProtocol,
+	/// except that every frame sent is masked with its own key
+	class WebsocketClient : public WebsocketProtocol
+	{
+	public:
+		/// Constructor
+		WebsocketClient() : WebsocketProtocol(true) {}
+
+		/// Start opening a websocket to a server.
+		/// Connecting and the handshake happen in the server loop, onConnect is called once the server accepts.
+		/// onDisconnect is called if the connection fails or is refused.
+		/// Can be called from any callback, such as onDisconnect to reconnect, but the callback's connection may move so it must not be used afterwards
+		/// @param host Address or name of the server. Names are resolved before this returns, so use an address to avoid the lookup
+		/// @param port The server's port
+		/// @param path The resource to request
+		/// @return The socket of the new connection, INVALID_SOCKET if it couldn't be started
+		SOCKET connect(const string & host, const unsigned int port, const string & path = "/")
+		{
+			addrinfo hints{};
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			addrinfo * address = nullptr;
+			if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &address) != 0 || address == nullptr)
+			{
+				gaf::util::Log::warning("Websocket client: unable to resolve " + host);
+				return INVALID_SOCKET;
+			}
+
+			SOCKET sock = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+			bool isStarted = sock != INVALID_SOCKET;
+			if (isStarted)
+			{
+				SET_NON_BLOCKING(sock);	// connect in the background
+				isStarted = ::connect(sock, address->ai_addr, static_cast<int>(address->ai_addrlen)) == 0 || IS_CONNECT_PENDING();
+			}
+			freeaddrinfo(address);
+
+			if (!isStarted || !isRoomForNewConnection())
+			{
+				gaf::util::Log::warning("Websocket client: unable to connect to " + host);
+				if (sock != INVALID_SOCKET)
+				{
+					CLOSE_SOCKET(sock);
+				}
+				return INVALID_SOCKET;
+			}
+
+			// the request waits in the queue, select reports the socket writable once it has connected
+			uint8_t nonce[16];
+			getThreadMaskKeyGenerator().fill(nonce, sizeof(nonce));
+			string key = encodeBase64(nonce, sizeof(nonce));
+			string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + ":" + std::to_string(port)
+				+ "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: " + key + "\r\nSec-WebSocket-Version: 13"
+				+ (getSubprotocolOffer().empty() ? "" : "\r\nSec-WebSocket-Protocol: " + getSubprotocolOffer()) + "\r\n\r\n";
+
+			char acceptKey[WEBSOCKET_ACCEPT_LENGTH];
+			writeWebsocketAcceptKey(key.data(), acceptKey);
+			handshakes[sock] = string(acceptKey, sizeof(acceptKey));	// the answer the server must give
+
+			Connection & stored = storeConnection(Connection(sock));	// the response must arrive before the first byte deadline
+			stored.outbound.push(std::make_shared<const string>(std::move(request)));
+			return sock;
+		}
+
+		/// Close a connection, abandoning its handshake if it hasn't finished
+		/// @param connection The connection to close
+		virtual void closeConnection(Connection & connection) override
+		{
+			handshakes.erase(connection.sock);
+			WebsocketProtocol::closeConnection(connection);
+		}
+
+	protected:
+		/// Check the server's answer to the handshake, then pass anything after it on as frames
+		/// @param connection Connection that received data
+		/// @param data String containing data received by connection
+		void receiveData(Connection & connection, const string & data) override
+		{
+			auto handshake = handshakes.find(connection.sock);
+			if (handshake == handshakes.end())	// already open
+			{
+				WebsocketProtocol::receiveData(connection, data);
+				return;
+			}
+
+			connection.pendingData += data;
+			size_t headerEnd = connection.pendingData.find("\r\n\r\n");
+			if (headerEnd == string::npos)
+			{
+				if (connection.pendingData.length() > MAX_RESPONSE_SIZE)
+				{
+					gaf::util::Log::warning("Websocket client: handshake response too large");
+					closeConnection(connection);
+				}
+				else
+				{
+					connection.setPhase(Connection::Phase::READING_HEADERS);
+				}
+				return;
+			}
+
+			std::string_view response(connection.pendingData.data(), headerEnd + 2);
+			std::string_view subprotocolName = readHeaderFromView("Sec-WebSocket-Protocol", response);
+			auto subprotocol = subprotocolName.empty() ? nullptr : findSubprotocol(subprotocolName);
+			if (response.compare(0, 12, "HTTP/1.1 101") != 0	// RFC 6455 section 4.1, header names in any case
+				|| !isEqualIgnoringCase(readHeaderFromView("Upgrade", response), "websocket")
+				|| !isTokenInList(readHeaderFromView("Connection", response), "Upgrade")
+				|| readHeaderFromView("Sec-WebSocket-Accept", response) != handshake->second
+				|| !readHeaderFromView("Sec-WebSocket-Extensions", response).empty()	// none were offered
+				|| (!subprotocolName.empty() && subprotocol == nullptr))	// only one that was offered may be chosen
+			{
+				gaf::util::Log::warning("Websocket client: handshake refused");
+				closeConnection(connection);
+				return;
+			}
+
+			handshakes.erase(handshake);
+			string frames = connection.pendingData.substr(headerEnd + 4);	// the server may send straight after its answer
+			connection.pendingData.clear();
+			SOCKET sock = connection.sock;
+			openSession(connection, nullptr, subprotocol);
+
+			Connection * stillOpen = findConnection(sock);	// onConnect may have closed it
+			if (stillOpen != nullptr && !frames.empty())
+			{
+				WebsocketProtocol::receiveData(*stillOpen, frames);
+			}
+		}
+
+	private:
+		static const size_t MAX_RESPONSE_SIZE = 8192;	/// largest handshake response accepted
+		std::unordered_map<SOCKET, string> handshakes;	/// accept key expected from each connection still handshaking
+	};
+}
+
+#endif // !AMS_WEBSOCKET_CLIENT_HPP
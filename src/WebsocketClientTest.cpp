@@ -0,0 +1,220 @@
+#include <chrono>
+#include <cstring>	// memcpy
+#include <string>
+#include <vector>
+#include "../test/catch.hpp"
+#include "Server.hpp"
+#include "HttpProtocol.hpp"
+#include "WebsocketProtocol.hpp"
+#include "WebsocketClient.hpp"
+
+using namespace ams;
+
+namespace
+{
+	/// Run the loop until a condition is met or a second has passed
+	template <typename Condition>
+	bool loopUntil(Server & server, Condition condition)
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+		while (!condition() && std::chrono::steady_clock::now() < deadline)
+		{
+			server.loop();
+		}
+		return condition();
+	}
+
+	/// Server that answers every websocket handshake with the same response, so the client's checks can be tested
+	class HandshakeResponder : public ProtocolBase
+	{
+	public:
+		HandshakeResponder(const unsigned int port) : ProtocolBase(5, port) {}
+
+		void addConnection(Connection connection, const std::string & data) override {}
+
+		std::string response;	/// answer to send, {accept} is replaced with the key the client expects
+
+	protected:
+		void receiveData(Connection & connection, const std::string & data) override
+		{
+			std::string key(readHeaderFromView("Sec-WebSocket-Key", data));
+			char accept[WEBSOCKET_ACCEPT_LENGTH];
+			writeWebsocketAcceptKey(key.c_str(), accept);
+			std::string answer = response;
+			answer.replace(answer.find("{accept}"), 8, accept, WEBSOCKET_ACCEPT_LENGTH);
+			sendData(connection, answer);
+		}
+	};
+}
+
+// a single case rather than sections, the listening port can't be bound again straight away
+TEST_CASE("Websocket Client", "[websocket],[client]")
+{
+	const unsigned int port = 8642;
+	Server server;
+	HttpProtocol http(port);
+	WebsocketProtocol websocket;
+	WebsocketClient client;
+	http.addUpgradeProtocol("websocket", &websocket);
+	server.addProtocol(&http);
+	server.addProtocol(&websocket);
+	server.addProtocol(&client);
+	websocket.setFragmentSize(128);	// the 300 byte messages go as fragments both ways
+	client.setFragmentSize(128);
+
+	websocket.setOnReceive([&websocket](ProtocolBase *, Connection & connection, const std::string & data)
+	{
+		websocket.sendData(connection, "echo " + data);
+	});
+
+	int connectCount = 0;
+	int disconnectCount = 0;
+	std::string received;
+	Connection * open = nullptr;
+	client.setOnConnect([&](ProtocolBase *, Connection & connection)
+	{
+		connectCount++;
+		client.sendText(connection, std::string(300, 'a'));	// long enough for an extended length
+	});
+	client.setOnReceive([&](ProtocolBase *, Connection & connection, const std::string & data)
+	{
+		received = data;
+		open = &connection;
+	});
+	client.setOnDisconnect([&](ProtocolBase *, Connection &) { disconnectCount++; });
+
+	// handshake, then a masked message each way
+	REQUIRE(client.connect("127.0.0.1", port) != INVALID_SOCKET);
+	REQUIRE(loopUntil(server, [&]() { return !received.empty(); }));
+	REQUIRE(connectCount == 1);
+	REQUIRE(received == "echo " + std::string(300, 'a'));
+
+	// close handshake started by the client
+	client.close(*open, WebsocketCloseCodes::GOING_AWAY);
+	REQUIRE(loopUntil(server, [&]() { return disconnectCount == 1 && client.isDrained() && websocket.isDrained(); }));
+
+	// refused connection
+	REQUIRE(client.connect("127.0.0.1", 1) != INVALID_SOCKET);	// nothing listens on port 1
+	REQUIRE(loopUntil(server, [&]() { return disconnectCount == 2; }));
+	REQUIRE(connectCount == 1);
+	REQUIRE(client.isDrained());
+
+	// subprotocols, the server picks the first it supports from the client's list
+	REQUIRE(!websocket.addSubprotocol("bad name"));
+	SubprotocolHandlers chat;
+	chat.onReceive = [&websocket](ProtocolBase *, Connection & connection, const std::string & data)
+	{
+		WebsocketFrameBuilder frame = websocket.startFrame();	// written in place rather than copied into a frame
+		frame.append(websocket.getSubprotocol(connection) + " ");
+		frame.append(data);
+		websocket.sendFrame(connection, frame, WebsocketOpCodes::TEXT);
+	};
+	REQUIRE(websocket.addSubprotocol("chat.v1", chat));
+	REQUIRE(websocket.addSubprotocol("telemetry.bin"));
+
+	SubprotocolHandlers clientChat;
+	clientChat.onConnect = [&](ProtocolBase *, Connection & connection)	// replaces the protocol's own
+	{
+		WebsocketFrameBuilder frame = client.startFrame(2);
+		memcpy(frame.extend(2), "hi", 2);
+		client.sendFrame(connection, frame, WebsocketOpCodes::TEXT);	// masked in place
+	};
+	REQUIRE(client.addSubprotocol("chat.v2"));	// not supported by the server
+	REQUIRE(client.addSubprotocol("chat.v1", clientChat));
+	received.clear();
+	REQUIRE(client.connect("127.0.0.1", port) != INVALID_SOCKET);
+	REQUIRE(loopUntil(server, [&]() { return !received.empty(); }));
+	REQUIRE(received == "chat.v1 hi");	// the subprotocol's receive callback answered
+	REQUIRE(client.getSubprotocol(*open) == "chat.v1");
+	REQUIRE(connectCount == 1);	// onReceive and onDisconnect fell back to the client's own
+
+	// spaces around the names are ignored, and a list with nothing supported chooses nothing
+	REQUIRE(chooseSubprotocol("a, b ,chat.v1", [](std::string_view name) { return name == "b" || name == "chat.v1"; }) == "b");
+	REQUIRE(chooseSubprotocol("a", [](std::string_view name) { return name == "b"; }).empty());
+}
+
+TEST_CASE("Websocket Client Reconnect", "[websocket],[client]")
+{
+	const unsigned int port = 8643;
+	Server server;
+	HttpProtocol http(port);
+	WebsocketProtocol websocket;
+	WebsocketClient client;
+	http.addUpgradeProtocol("websocket", &websocket);
+	server.addProtocol(&http);
+	server.addProtocol(&websocket);
+	server.addProtocol(&client);
+
+	websocket.setOnConnect([&websocket](ProtocolBase *, Connection & connection)
+	{
+		websocket.sendText(connection, "one");	// both arrive in one read, the second after the first added a connection
+		websocket.sendText(connection, "two");
+	});
+
+	int connectCount = 0;
+	int disconnectCount = 0;
+	std::vector<std::string> received;
+	client.setOnConnect([&](ProtocolBase *, Connection &) { connectCount++; });
+	client.setOnReceive([&](ProtocolBase *, Connection &, const std::string & data)
+	{
+		received.push_back(data);
+		if (received.size() == 1)
+		{
+			REQUIRE(client.connect("127.0.0.1", port) != INVALID_SOCKET);	// moves the connection whose frames are being read
+		}
+	});
+	client.setOnDisconnect([&](ProtocolBase *, Connection &)
+	{
+		if (disconnectCount++ == 0)
+		{
+			REQUIRE(client.connect("127.0.0.1", port) != INVALID_SOCKET);	// moves the connection being closed
+		}
+	});
+
+	// connecting from onReceive
+	REQUIRE(client.connect("127.0.0.1", port) != INVALID_SOCKET);
+	REQUIRE(loopUntil(server, [&]() { return received.size() == 4; }));
+	REQUIRE(connectCount == 2);
+	REQUIRE(received == std::vector<std::string>{ "one", "two", "one", "two" });
+
+	// reconnecting from onDisconnect when the server goes away
+	websocket.closeAllConnections();
+	REQUIRE(loopUntil(server, [&]() { return disconnectCount == 2 && connectCount == 3; }));
+	REQUIRE(received.size() == 6);	// the new connection was greeted too
+
+	client.closeAllConnections();
+	REQUIRE(loopUntil(server, [&]() { return websocket.isDrained(); }));
+}
+
+TEST_CASE("Websocket Client Handshake Checks", "[websocket],[client]")
+{
+	const unsigned int port = 8650;
+	Server server;
+	HandshakeResponder responder(port);
+	WebsocketClient client;
+	server.addProtocol(&responder);
+	server.addProtocol(&client);
+
+	int connectCount = 0;
+	int disconnectCount = 0;
+	client.setOnConnect([&](ProtocolBase *, Connection &) { connectCount++; });
+	client.setOnDisconnect([&](ProtocolBase *, Connection &) { disconnectCount++; });
+
+	// header names in any case, Upgrade among other connection options
+	responder.response = "HTTP/1.1 101 Switching Protocols\r\nupgrade: WebSocket\r\nCONNECTION: keep-alive, upgrade\r\n"
+		"sec-websocket-accept: {accept}\r\n\r\n";
+	REQUIRE(client.connect("127.0.0.1", port) != INVALID_SOCKET);
+	REQUIRE(loopUntil(server, [&]() { return connectCount == 1; }));
+
+	// no Upgrade header
+	responder.response = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: {accept}\r\n\r\n";
+	REQUIRE(client.connect("127.0.0.1", port) != INVALID_SOCKET);
+	REQUIRE(loopUntil(server, [&]() { return disconnectCount == 1; }));
+
+	// Connection doesn't include Upgrade
+	responder.response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: keep-alive\r\n"
+		"Sec-WebSocket-Accept: {accept}\r\n\r\n";
+	REQUIRE(client.connect("127.0.0.1", port) != INVALID_SOCKET);
+	REQUIRE(loopUntil(server, [&]() { return disconnectCount == 2; }));
+	REQUIRE(connectCount == 1);
+}
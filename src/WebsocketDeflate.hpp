@@ -0,0 +1,401 @@
+/******************************
+ * @file WebsocketDeflate.hpp
+ * Alex's MicroServer (AMS)
+ * @author Alex Schlieck
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * permessage-deflate compression extension (RFC 7692).
+ * Compression needs zlib: define AMS_USE_ZLIB and link against zlib to enable it.
+ * Without it the extension is never negotiated and messages are sent as they are
+ ******************************/
+
+#ifndef AMS_WEBSOCKET_DEFLATE_HPP
+#define AMS_WEBSOCKET_DEFLATE_HPP
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstdlib>	// strtol
+
+#ifdef AMS_USE_ZLIB
+	#include <zlib.h>
+#endif
+
+namespace ams
+{
+	/// How the server compresses messages, set on the protocol
+	struct DeflateSettings
+	{
+		bool isEnabled = true;				/// accept the extension when a client offers it
+		size_t minimumSize = 256;			/// messages smaller than this are sent uncompressed
+		size_t memoryLimit = 256 * 1024;	/// most zlib memory a single connection may use, smaller windows are negotiated to fit
+		bool serverNoContextTakeover = true;	/// compress every message on its own, which lets broadcasts be compressed once for everyone
+	};
+
+	/// Parameters agreed with a client during the handshake
+	struct DeflateParameters
+	{
+		bool serverNoContextTakeover = false;	/// server resets its compressor after every message
+		bool clientNoContextTakeover = false;	/// client resets its compressor after every message
+		int serverWindowBits = 15;			/// window used to compress, 2^bits bytes
+		int clientWindowBits = 15;			/// window the client compresses with, the value answered. 8 is decompressed with 9, see getInflateWindowBits
+		int memoryLevel = 8;				/// zlib compressor memory level, 1-9
+		bool isClientWindowBitsOffered = false;	/// if the client allows the server to choose its window
+	};
+
+	/// Bit in WebsocketFrameHeader::reservedBits that marks a compressed message (RSV1)
+	const uint8_t DEFLATE_RESERVED_BIT = 0x4;
+
+	namespace deflateDetail
+	{
+		/// Smallest window zlib can produce raw deflate data for
+		const int MIN_WINDOW_BITS = 9;
+
+		/// Window used to decompress the client's messages. zlib can't use a raw 8 bit window, a larger one decompresses the same data
+		inline int getInflateWindowBits(const DeflateParameters & parameters)
+		{
+			return parameters.clientWindowBits < MIN_WINDOW_BITS ? MIN_WINDOW_BITS : parameters.clientWindowBits;
+		}
+
+		/// Approximate zlib memory for one connection, from the zlib documentation
+		inline size_t getMemoryUse(const DeflateParameters & parameters)
+		{
+			size_t compressor = (size_t{ 1 } << (parameters.serverWindowBits + 2)) + (size_t{ 1 } << (parameters.memoryLevel + 9));
+			size_t decompressor = (size_t{ 1 } << getInflateWindowBits(parameters)) + 7 * 1024;
+			return compressor + decompressor;
+		}
+
+		/// Remove spaces, tabs and quotes from both ends of a token
+		inline std::string_view trim(std::string_view token)
+		{
+			while (!token.empty() && (token.front() == ' ' || token.front() == '\t' || token.front() == '"'))
+			{
+				token.remove_prefix(1);
+			}
+			while (!token.empty() && (token.back() == ' ' || token.back() == '\t' || token.back() == '"' || token.back() == '\r'))
+			{
+				token.remove_suffix(1);
+			}
+			return token;
+		}
+
+		/// Read a window size parameter
+		/// @return The number of bits, or 0 if the value is invalid
+		inline int readWindowBits(const std::string_view value)
+		{
+			if (value.empty() || value.length() > 2 || value.front() == '0')
+			{
+				return 0;
+			}
+			int bits = static_cast<int>(strtol(std::string(value).c_str(), nullptr, 10));
+			return bits >= 8 && bits <= 15 ? bits : 0;
+		}
+
+		/// Check a single permessage-deflate offer and work out the parameters to accept it with
+		/// @param offer The parameters of the offer, after the extension name
+		/// @param settings The server's settings
+		/// @param accepted Set to the agreed parameters
+		/// @return If the offer can be accepted
+		inline bool readOffer(std::string_view offer, const DeflateSettings & settings, DeflateParameters & accepted)
+		{
+			DeflateParameters parameters;
+			int serverWindowLimit = 15;
+			int clientWindowLimit = 15;
+			bool isServerWindowSeen = false;
+
+			while (!offer.empty())
+			{
+				size_t end = offer.find(';');
+				std::string_view parameter = trim(offer.substr(0, end));
+				offer = end == std::string_view::npos ? std::string_view() : offer.substr(end + 1);
+				if (parameter.empty())
+				{
+					continue;
+				}
+
+				size_t equals = parameter.find('=');
+				std::string_view name = trim(parameter.substr(0, equals));
+				std::string_view value = equals == std::string_view::npos ? std::string_view() : trim(parameter.substr(equals + 1));
+
+				if (name == "server_no_context_takeover" && value.empty() && !parameters.serverNoContextTakeover)
+				{
+					parameters.serverNoContextTakeover = true;
+				}
+				else if (name == "client_no_context_takeover" && value.empty() && !parameters.clientNoContextTakeover)
+				{
+					parameters.clientNoContextTakeover = true;
+				}
+				else if (name == "server_max_window_bits" && !isServerWindowSeen)
+				{
+					serverWindowLimit = readWindowBits(value);
+					if (serverWindowLimit < MIN_WINDOW_BITS)	// invalid, or smaller than zlib can produce
+					{
+						return false;
+					}
+					isServerWindowSeen = true;
+				}
+				else if (name == "client_max_window_bits" && !parameters.isClientWindowBitsOffered)
+				{
+					if (!value.empty())
+					{
+						clientWindowLimit = readWindowBits(value);
+						if (clientWindowLimit == 0)
+						{
+							return false;
+						}
+					}
+					parameters.isClientWindowBitsOffered = true;
+				}
+				else	// unknown or repeated parameter, the offer must be declined
+				{
+					return false;
+				}
+			}
+
+			parameters.serverNoContextTakeover = parameters.serverNoContextTakeover || settings.serverNoContextTakeover;
+			parameters.serverWindowBits = serverWindowLimit;
+			parameters.clientWindowBits = clientWindowLimit;	// the answer may not be larger than the offer (RFC 7692 section 7.1.2.2)
+
+			// shrink the memory level and windows until the connection fits the memory limit
+			while (getMemoryUse(parameters) > settings.memoryLimit)
+			{
+				if (parameters.memoryLevel > 7)
+				{
+					parameters.memoryLevel--;
+				}
+				else if (parameters.isClientWindowBitsOffered && parameters.clientWindowBits > MIN_WINDOW_BITS)
+				{
+					parameters.clientWindowBits--;
+				}
+				else if (parameters.serverWindowBits > MIN_WINDOW_BITS)
+				{
+					parameters.serverWindowBits--;
+				}
+				else if (parameters.memoryLevel > 1)
+				{
+					parameters.memoryLevel--;
+				}
+				else
+				{
+					return false;	// can't fit, send uncompressed
+				}
+			}
+
+			accepted = parameters;
+			return true;
+		}
+	}
+
+	/// Choose the first permessage-deflate offer the server can accept
+	/// @param offers Value of the client's Sec-WebSocket-Extensions header
+	/// @param settings The server's settings
+	/// @param accepted Set to the agreed parameters
+	/// @return If compression was agreed
+	inline bool negotiateDeflate(std::string_view offers, const DeflateSettings & settings, DeflateParameters & accepted)
+	{
+#ifdef AMS_USE_ZLIB
+		if (!settings.isEnabled)
+		{
+			return false;
+		}
+
+		while (!offers.empty())
+		{
+			size_t end = offers.find(',');
+			std::string_view offer = deflateDetail::trim(offers.substr(0, end));
+			offers = end == std::string_view::npos ? std::string_view() : offers.substr(end + 1);
+
+			size_t nameEnd = offer.find(';');
+			if (deflateDetail::trim(offer.substr(0, nameEnd)) == "permessage-deflate"
+				&& deflateDetail::readOffer(nameEnd == std::string_view::npos ? std::string_view() : offer.substr(nameEnd + 1), settings, accepted))
+			{
+				return true;
+			}
+		}
+#endif
+		return false;
+	}
+
+	/// Write the value of the Sec-WebSocket-Extensions header that accepts an offer
+	/// @param parameters The agreed parameters
+	/// @return The header value
+	inline std::string formatDeflateResponse(const DeflateParameters & parameters)
+	{
+		std::string response = "permessage-deflate";
+		if (parameters.serverNoContextTakeover)
+		{
+			response += "; server_no_context_takeover";
+		}
+		if (parameters.clientNoContextTakeover)
+		{
+			response += "; client_no_context_takeover";
+		}
+		if (parameters.serverWindowBits < 15)
+		{
+			response += "; server_max_window_bits=" + std::to_string(parameters.serverWindowBits);
+		}
+		if (parameters.isClientWindowBitsOffered)
+		{
+			response += "; client_max_window_bits=" + std::to_string(parameters.clientWindowBits);
+		}
+		return response;
+	}
+
+	/// @brief Compression state of one connection, or of messages shared by many
+	class DeflateContext
+	{
+	public:
+		/// Constructor
+		/// @param parameters The parameters agreed with the client
+		explicit DeflateContext(const DeflateParameters & parameters) : parameters(parameters)
+		{
+#ifdef AMS_USE_ZLIB
+			compressor = z_stream();
+			decompressor = z_stream();
+			// negative window bits produce raw deflate data, without zlib headers
+			isReady = deflateInit2(&compressor, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -parameters.serverWindowBits, parameters.memoryLevel, Z_DEFAULT_STRATEGY) == Z_OK;
+			if (isReady && inflateInit2(&decompressor, -deflateDetail::getInflateWindowBits(parameters)) != Z_OK)
+			{
+				deflateEnd(&compressor);
+				isReady = false;
+			}
+#endif
+		}
+
+		/// Destructor
+		~DeflateContext()
+		{
+#ifdef AMS_USE_ZLIB
+			if (isReady)
+			{
+				deflateEnd(&compressor);
+				inflateEnd(&decompressor);
+			}
+#endif
+		}
+
+		DeflateContext(const DeflateContext &) = delete;
+		DeflateContext & operator = (const DeflateContext &) = delete;
+
+		/// Compress a whole message
+		/// @param data The message
+		/// @param size Number of bytes
+		/// @param output Replaced by the compressed message
+		/// @return If the message was compressed
+		bool compress(const char * data, const size_t size, std::string & output)
+		{
+#ifdef AMS_USE_ZLIB
+			if (!isReady)
+			{
+				return false;
+			}
+
+			output.resize(deflateBound(&compressor, static_cast<uLong>(size)) + 16);	// room for the sync flush marker
+			compressor.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+			compressor.avail_in = static_cast<uInt>(size);
+			compressor.next_out = reinterpret_cast<Bytef*>(&output[0]);
+			compressor.avail_out = static_cast<uInt>(output.length());
+			int result = deflate(&compressor, Z_SYNC_FLUSH);
+			if (result != Z_OK || compressor.avail_in != 0)
+			{
+				deflateReset(&compressor);
+				return false;
+			}
+			output.resize(output.length() - compressor.avail_out - 4);	// the message ends before the 00 00 ff ff flush marker
+
+			if (parameters.serverNoContextTakeover)
+			{
+				deflateReset(&compressor);
+			}
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		/// Decompress part of a message. The parts of a message must be passed in order
+		/// @param data Compressed data from one frame
+		/// @param size Number of bytes
+		/// @param isFinal If this is the last part of the message
+		/// @param output Replaced by the decompressed data
+		/// @param maxSize Largest decompressed size accepted
+		/// @return If the data was valid and within the size limit
+		bool decompress(const char * data, const size_t size, const bool isFinal, std::string & output, const uint64_t maxSize)
+		{
+			output.clear();
+#ifdef AMS_USE_ZLIB
+			if (!isReady)
+			{
+				return false;
+			}
+
+			static const char FLUSH_MARKER[] = { 0x00, 0x00, char(0xff), char(0xff) };	// removed by the sender, RFC 7692 section 7.2.2
+			if (!inflateInput(data, size, output, maxSize) || (isFinal && !inflateInput(FLUSH_MARKER, 4, output, maxSize)))
+			{
+				inflateReset(&decompressor);
+				return false;
+			}
+
+			if (isFinal && parameters.clientNoContextTakeover)
+			{
+				inflateReset(&decompressor);
+			}
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		/// @return The parameters agreed with the client
+		const DeflateParameters & getParameters() const
+		{
+			return parameters;
+		}
+
+	private:
+#ifdef AMS_USE_ZLIB
+		/// Feed compressed data to the decompressor, appending the result
+		bool inflateInput(const char * data, const size_t size, std::string & output, const uint64_t maxSize)
+		{
+			char buffer[16384];
+			decompressor.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+			decompressor.avail_in = static_cast<uInt>(size);
+			do
+			{
+				decompressor.next_out = reinterpret_cast<Bytef*>(buffer);
+				decompressor.avail_out = sizeof(buffer);
+				int result = inflate(&decompressor, Z_SYNC_FLUSH);
+				if (result == Z_STREAM_END)	// sender ended the stream, anything after it starts a new one
+				{
+					inflateReset(&decompressor);
+				}
+				else if (result != Z_OK && result != Z_BUF_ERROR)	// buffer error only means there was nothing left to do
+				{
+					return false;
+				}
+
+				size_t produced = sizeof(buffer) - decompressor.avail_out;
+				if (output.length() + produced > maxSize)	// stops small messages that expand enormously
+				{
+					return false;
+				}
+				output.append(buffer, produced);
+
+				if (result == Z_BUF_ERROR && produced == 0)	// no progress possible
+				{
+					break;
+				}
+			} while (decompressor.avail_out == 0 || decompressor.avail_in != 0);
+			return true;
+		}
+
+		z_stream compressor;
+		z_stream decompressor;
+		bool isReady = false;	/// if zlib was initialised
+#endif
+		DeflateParameters parameters;	/// what was agreed with the client
+	};
+}
+
+#endif // !AMS_WEBSOCKET_DEFLATE_HPP
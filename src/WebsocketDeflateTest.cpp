@@ -0,0 +1,144 @@
+#include "../test/catch.hpp"
+#include "WebsocketDeflate.hpp"
+
+using namespace ams;
+
+TEST_CASE("Websocket Deflate Negotiation", "[websocket],[deflate]")
+{
+	DeflateSettings settings;
+	settings.memoryLimit = 1024 * 1024;	// room for the largest windows
+	DeflateParameters parameters;
+
+	SECTION("Plain offer")
+	{
+		REQUIRE(deflateDetail::readOffer("", settings, parameters));
+		REQUIRE(parameters.serverNoContextTakeover);	// server default, lets broadcasts share a compressed frame
+		REQUIRE(parameters.serverWindowBits == 15);
+		REQUIRE(parameters.clientWindowBits == 15);
+		REQUIRE(formatDeflateResponse(parameters) == "permessage-deflate; server_no_context_takeover");
+	}
+
+	SECTION("Parameters")
+	{
+		REQUIRE(deflateDetail::readOffer(" client_no_context_takeover; server_max_window_bits=10; client_max_window_bits", settings, parameters));
+		REQUIRE(parameters.clientNoContextTakeover);
+		REQUIRE(parameters.serverWindowBits == 10);
+		REQUIRE(parameters.isClientWindowBitsOffered);
+		REQUIRE(formatDeflateResponse(parameters) == "permessage-deflate; server_no_context_takeover; client_no_context_takeover; server_max_window_bits=10; client_max_window_bits=15");
+	}
+
+	SECTION("Smallest client window")
+	{
+		REQUIRE(deflateDetail::readOffer("client_max_window_bits=8", settings, parameters));
+		REQUIRE(formatDeflateResponse(parameters) == "permessage-deflate; server_no_context_takeover; client_max_window_bits=8");	// never more than offered
+		REQUIRE(deflateDetail::getInflateWindowBits(parameters) == 9);	// the smallest zlib has, decompresses the same data
+	}
+
+	SECTION("Quoted value")
+	{
+		REQUIRE(deflateDetail::readOffer("server_max_window_bits=\"12\"", settings, parameters));
+		REQUIRE(parameters.serverWindowBits == 12);
+	}
+
+	SECTION("Invalid offers")
+	{
+		REQUIRE(!deflateDetail::readOffer("server_max_window_bits=16", settings, parameters));
+		REQUIRE(!deflateDetail::readOffer("server_max_window_bits=08", settings, parameters));
+		REQUIRE(!deflateDetail::readOffer("server_max_window_bits=8", settings, parameters));	// zlib can't produce an 8 bit window
+		REQUIRE(!deflateDetail::readOffer("server_max_window_bits", settings, parameters));
+		REQUIRE(!deflateDetail::readOffer("client_no_context_takeover; client_no_context_takeover", settings, parameters));
+		REQUIRE(!deflateDetail::readOffer("unknown_parameter", settings, parameters));
+	}
+
+	SECTION("Memory limit")
+	{
+		settings.memoryLimit = 64 * 1024;
+		REQUIRE(deflateDetail::readOffer("client_max_window_bits", settings, parameters));
+		REQUIRE(deflateDetail::getMemoryUse(parameters) <= settings.memoryLimit);
+
+		settings.memoryLimit = 1024;	// too small for any window
+		REQUIRE(!deflateDetail::readOffer("", settings, parameters));
+	}
+
+#ifdef AMS_USE_ZLIB
+	SECTION("Choose first acceptable offer")
+	{
+		REQUIRE(negotiateDeflate("x-webkit-deflate-frame, permessage-deflate; server_max_window_bits=8, permessage-deflate; server_max_window_bits=11", settings, parameters));
+		REQUIRE(parameters.serverWindowBits == 11);
+		REQUIRE(!negotiateDeflate("x-webkit-deflate-frame", settings, parameters));
+
+		settings.isEnabled = false;
+		REQUIRE(!negotiateDeflate("permessage-deflate", settings, parameters));
+	}
+#else
+	SECTION("Declined without zlib")
+	{
+		REQUIRE(!negotiateDeflate("permessage-deflate", settings, parameters));
+	}
+#endif
+}
+
+#ifdef AMS_USE_ZLIB
+TEST_CASE("Websocket Deflate Compression", "[websocket],[deflate]")
+{
+	DeflateParameters parameters;
+	DeflateContext sender(parameters);
+	DeflateContext receiver(parameters);
+	std::string message;
+	for (int i = 0; i < 200; i++)
+	{
+		message += "{\"user\":\"someone\",\"text\":\"hello\"}";
+	}
+	std::string compressed;
+	std::string decompressed;
+
+	SECTION("Round trip")
+	{
+		REQUIRE(sender.compress(message.data(), message.length(), compressed));
+		REQUIRE(compressed.length() < message.length() / 3);
+		REQUIRE(receiver.decompress(compressed.data(), compressed.length(), true, decompressed, message.length()));
+		REQUIRE(decompressed == message);
+
+		// context is kept between messages
+		REQUIRE(sender.compress(message.data(), message.length(), compressed));
+		REQUIRE(receiver.decompress(compressed.data(), compressed.length(), true, decompressed, message.length()));
+		REQUIRE(decompressed == message);
+	}
+
+	SECTION("Fragmented")
+	{
+		REQUIRE(sender.compress(message.data(), message.length(), compressed));
+		std::string whole;
+		size_t half = compressed.length() / 2;
+		REQUIRE(receiver.decompress(compressed.data(), half, false, decompressed, message.length()));
+		whole += decompressed;
+		REQUIRE(receiver.decompress(compressed.data() + half, compressed.length() - half, true, decompressed, message.length()));
+		whole += decompressed;
+		REQUIRE(whole == message);
+	}
+
+	SECTION("Size limit")
+	{
+		REQUIRE(sender.compress(message.data(), message.length(), compressed));
+		REQUIRE(!receiver.decompress(compressed.data(), compressed.length(), true, decompressed, message.length() - 1));
+	}
+
+	SECTION("Client window of 8 bits")
+	{
+		DeflateParameters small;
+		small.serverWindowBits = 9;	// as close as zlib gets to a client compressing with 8
+		small.clientWindowBits = 8;
+		DeflateContext smallSender(small);
+		DeflateContext smallReceiver(small);
+		REQUIRE(smallSender.compress(message.data(), message.length(), compressed));
+		REQUIRE(smallReceiver.decompress(compressed.data(), compressed.length(), true, decompressed, message.length()));	// would fail if zlib had refused the window
+		REQUIRE(decompressed == message);
+	}
+
+	SECTION("Invalid data")
+	{
+		const char garbage[] = { char(0xff), char(0xff), char(0xff), char(0xff) };
+		REQUIRE(!receiver.decompress(garbage, sizeof(garbage), true, decompressed, 1024));
+	}
+}
+#endif
@@ -50,15 +50,19 @@ Application data:  y bytes
 
 */
 
-// TODO: add and test support for continued frames
 // TODO: test different type of data
 
 #ifndef AMS_WEBSOCKET_FRAME_HPP
 #define AMS_WEBSOCKET_FRAME_HPP
 
 #include <string>
-#include <time.h>	// use for rand() to generate mask
+#include <string_view>
+#include <cstring>	// memcpy
+#include <cstdint>	// UINT64_MAX, SIZE_MAX
 #include "Endians.hpp"
+#include "WebsocketMask.hpp"
+#include "WebsocketMaskKey.hpp"
+#include "WebsocketUtf8.hpp"
 
 //using namespace std;
 
@@ -66,186 +70,499 @@ namespace ams
 {
 	enum WebsocketOpCodes : uint8_t { CONTINUATION = 0, TEXT = 1, BINARY = 2, CLOSE = 8, PING = 9, PONG = 10 };
 
-	const uint8_t getWebsocketFrameOp(const std::string & dataToRead)
+	/// Status codes sent in close frames (RFC 6455 section 7.4.1)
+	enum WebsocketCloseCodes : uint16_t
 	{
-		const uint8_t OP_MASK = 0b00001111;
-		return dataToRead[0] & OP_MASK;
-	}
+		NORMAL_CLOSURE = 1000, GOING_AWAY = 1001, PROTOCOL_ERROR = 1002, UNSUPPORTED_DATA = 1003,
+		NO_STATUS_RECEIVED = 1005, INVALID_PAYLOAD = 1007, POLICY_VIOLATION = 1008, MESSAGE_TOO_BIG = 1009, INTERNAL_ERROR = 1011
+	};
 
-	/// Take a websocket frame received from the network and extract data from it
-	/// @param receivedData String containing the frame to read
-	/// @return What type of message was received
-	const std::string readFromWebsocketFrame(const std::string & receivedData)
-	{
-		std::string result;
+	/// Result of trying to read a frame from a buffer
+	enum class WebsocketFrameStatus { COMPLETE, INCOMPLETE, INVALID, TOO_LARGE };
 
-		//const uint8_t FIN_BITS			= 0x80;	// 0b10000000;
+	/// Header fields of a single websocket frame
+	struct WebsocketFrameHeader
+	{
+		bool isFinal = false;			/// last fragment of the message
+		uint8_t reservedBits = 0;		/// RSV1-3, must be 0 unless an extension is negotiated
+		uint8_t opCode = 0;				/// what kind of frame this is
+		bool isMasked = false;			/// if the payload is masked
+		uint8_t mask[4] = { 0, 0, 0, 0 };	/// masking key, only valid if isMasked
+		uint64_t payloadLength = 0;		/// number of payload bytes following the header
+		size_t headerLength = 0;		/// number of bytes used by the header
+	};
+
+	/// A single decoded websocket frame
+	struct WebsocketFrame
+	{
+		WebsocketFrameHeader header;	/// the frame's header fields
+		std::string payload;			/// unmasked payload data
+	};
+
+	/// Read the header of a frame, checking every length before it is used
+	/// @param data Start of the received data
+	/// @param size Number of bytes available
+	/// @param header [out] The header that was read
+	/// @return COMPLETE if the header was read, INCOMPLETE if more data is needed, INVALID if the header breaks RFC 6455
+	inline WebsocketFrameStatus readWebsocketFrameHeader(const uint8_t * data, const size_t size, WebsocketFrameHeader & header)
+	{
+		const uint8_t FIN_BITS			= 0x80;	// 0b10000000;
+		const uint8_t RESERVED_BITS		= 0x70;	// 0b01110000;
 		const uint8_t OP_BITS			= 0x0f; // 0b00001111;
 		const uint8_t IS_MASKED_BITS	= 0x80;	// 0b10000000;
 		const uint8_t LENGTH_BITS		= 0x7f; // 0b01111111;
 
-		//bool isFinal = receivedData[0] & FIN_BITS;		// is this the final frame, used to implement continuous frames
-		uint8_t opCode = receivedData[0] & OP_BITS;		// what time of op is this
-		bool isMasked = receivedData[1] & IS_MASKED_BITS;			// does this frame have a mask
+		if (size < 2)
+		{
+			return WebsocketFrameStatus::INCOMPLETE;
+		}
+
+		header.isFinal = (data[0] & FIN_BITS) != 0;
+		header.reservedBits = (data[0] & RESERVED_BITS) >> 4;
+		header.opCode = data[0] & OP_BITS;
+		header.isMasked = (data[1] & IS_MASKED_BITS) != 0;
+
+		switch (header.opCode)
+		{
+		case WebsocketOpCodes::CONTINUATION:
+		case WebsocketOpCodes::TEXT:
+		case WebsocketOpCodes::BINARY:
+		case WebsocketOpCodes::CLOSE:
+		case WebsocketOpCodes::PING:
+		case WebsocketOpCodes::PONG:
+			break;
+		default:	// reserved, the connection must be failed
+			return WebsocketFrameStatus::INVALID;
+		}
 
-		// find size of payload in bytes
-		uint8_t initialLength = receivedData[1] & LENGTH_BITS;	// get the length of the message
-		uint64_t length = initialLength;
-		unsigned int position = 2;
+		uint8_t initialLength = data[1] & LENGTH_BITS;
+		size_t position = 2;
 
-		// check for extended payload length
+		// check for extended payload length, stored in network byte order
 		if (initialLength == 126)	// length is stored in the next 16 bits
 		{
-			const uint16_t * readPointer = reinterpret_cast<const uint16_t*>(&receivedData[position]);
-			length = static_cast<uint16_t>(gaf::util::correctForNetByteOrder(*readPointer));
+			if (size < position + 2)
+			{
+				return WebsocketFrameStatus::INCOMPLETE;
+			}
+			header.payloadLength = (static_cast<uint64_t>(data[2]) << 8) | data[3];
 			position += 2;
 		}
 		else if (initialLength == 127)	// length is stored in the next 64 bits
 		{
-			const uint64_t * readPointer = reinterpret_cast<const uint64_t*>(&receivedData[position]);
-			length = gaf::util::correctForNetByteOrder(*readPointer);
+			if (size < position + 8)
+			{
+				return WebsocketFrameStatus::INCOMPLETE;
+			}
+			header.payloadLength = 0;
+			for (size_t i = 0; i < 8; i++)
+			{
+				header.payloadLength = (header.payloadLength << 8) | data[position + i];
+			}
+			if (header.payloadLength >> 63)	// most significant bit must be 0
+			{
+				return WebsocketFrameStatus::INVALID;
+			}
 			position += 8;
 		}
+		else
+		{
+			header.payloadLength = initialLength;
+		}
 
-		// If this op reads data
-		if (opCode == WebsocketOpCodes::CONTINUATION || opCode == WebsocketOpCodes::TEXT || opCode == WebsocketOpCodes::BINARY)
+		// control frames can't be fragmented and must fit in the short length
+		if (header.opCode >= WebsocketOpCodes::CLOSE && (!header.isFinal || header.payloadLength > 125))
 		{
-			result.resize(static_cast<size_t>(length));
+			return WebsocketFrameStatus::INVALID;
+		}
 
-			if (isMasked)	// read and unmask the payload
+		if (header.isMasked)
+		{
+			if (size < position + 4)
 			{
-				uint8_t mask[4] = {
-					static_cast<uint8_t>(receivedData[position]),
-					static_cast<uint8_t>(receivedData[position + 1]),
-					static_cast<uint8_t>(receivedData[position + 2]),
-					static_cast<uint8_t>(receivedData[position + 3])
-				};
-
-				position += 4;
-
-				// copy byte-by-byte, applying mask to each
-				for (unsigned int i = 0; i < length; i++)
-				{
-					result[i] = receivedData[i + position] ^ mask[i % 4];
-				}
+				return WebsocketFrameStatus::INCOMPLETE;
 			}
-			else // no mask, do a direct copy
+			for (size_t i = 0; i < 4; i++)
 			{
-				result = receivedData.substr(position, static_cast<size_t>(length));
+				header.mask[i] = data[position + i];
 			}
+			position += 4;
 		}
-		return result;
+
+		header.headerLength = position;
+		return WebsocketFrameStatus::COMPLETE;
 	}
 
-	/// Take a databuffer and encode it into a websocket frame
-	/// @param dataToWrite String containing the data to encode
-	/// @param opCode What kind of operation this frame is encoded for
-	/// @param isFinal is this the last frame for the data
-	/// @param isMasked Is the data masked. Client MUST mask, Server MUST NOT mask
-	/// @return Fully encoded frame
-	const std::string writeToWebsocketFrame(const std::string & dataToWrite, const WebsocketOpCodes opCode, const bool isFinal = true, const bool isMasked = false)
+	/// Read one frame from a buffer that may hold a partial frame or several frames.
+	/// Nothing is consumed until a whole frame is available, so the call can be repeated as more data arrives
+	/// @param data Start of the received data
+	/// @param size Number of bytes available
+	/// @param frame [out] The decoded frame, payload unmasked
+	/// @param bytesConsumed [out] Number of bytes used by the frame, 0 unless COMPLETE
+	/// @param maxPayloadLength Largest payload accepted, longer frames are TOO_LARGE
+	/// @return COMPLETE if a frame was read, INCOMPLETE if more data is needed, INVALID if the frame breaks the rules, TOO_LARGE if its payload is over the limit
+	inline WebsocketFrameStatus readWebsocketFrame(const char * data, const size_t size, WebsocketFrame & frame, size_t & bytesConsumed, const uint64_t maxPayloadLength = UINT64_MAX)
+	{
+		bytesConsumed = 0;
+		const uint8_t * bytes = reinterpret_cast<const uint8_t*>(data);
+
+		WebsocketFrameStatus status = readWebsocketFrameHeader(bytes, size, frame.header);
+		if (status != WebsocketFrameStatus::COMPLETE)
+		{
+			return status;
+		}
+
+		const WebsocketFrameHeader & header = frame.header;
+		if (header.payloadLength > maxPayloadLength)
+		{
+			return WebsocketFrameStatus::TOO_LARGE;
+		}
+		if (header.payloadLength > size - header.headerLength)	// wait for the rest of the payload
+		{
+			return WebsocketFrameStatus::INCOMPLETE;
+		}
+
+		size_t length = static_cast<size_t>(header.payloadLength);
+		const char * payload = data + header.headerLength;
+
+		if (header.isMasked)	// copy and unmask in one pass
+		{
+			frame.payload.resize(length);
+			applyWebsocketMask(reinterpret_cast<const uint8_t*>(payload), reinterpret_cast<uint8_t*>(&frame.payload[0]), length, header.mask);
+		}
+		else // no mask, do a direct copy
+		{
+			frame.payload.assign(payload, length);
+		}
+
+		bytesConsumed = header.headerLength + length;
+		return WebsocketFrameStatus::COMPLETE;
+	}
+
+	/// Get the op code of the first frame in a buffer
+	/// @param dataToRead Received data
+	/// @return The op code, CLOSE if there is no data
+	inline const uint8_t getWebsocketFrameOp(const std::string & dataToRead)
+	{
+		const uint8_t OP_MASK = 0b00001111;
+		if (dataToRead.empty())
+		{
+			return WebsocketOpCodes::CLOSE;
+		}
+		return dataToRead[0] & OP_MASK;
+	}
+
+	/// Take a websocket frame received from the network and extract data from it
+	/// @param receivedData String containing the frame to read
+	/// @return The payload of the frame. Empty if the frame is incomplete, invalid or a control frame
+	inline const std::string readFromWebsocketFrame(const std::string & receivedData)
+	{
+		WebsocketFrame frame;
+		size_t bytesConsumed;
+		if (readWebsocketFrame(receivedData.data(), receivedData.length(), frame, bytesConsumed) != WebsocketFrameStatus::COMPLETE)
+		{
+			return std::string();
+		}
+
+		// If this op reads data
+		uint8_t opCode = frame.header.opCode;
+		if (opCode == WebsocketOpCodes::CONTINUATION || opCode == WebsocketOpCodes::TEXT || opCode == WebsocketOpCodes::BINARY)
+		{
+			return frame.payload;
+		}
+		return std::string();
+	}
+
+	/// Get the number of bytes a frame header takes.
+	/// The shortest length encoding that fits is always used, as RFC 6455 section 5.2 requires
+	/// @param payloadLength Number of payload bytes
+	/// @param isMasked If the frame carries a masking key
+	/// @return The header length
+	inline size_t getWebsocketHeaderLength(const uint64_t payloadLength, const bool isMasked)
+	{
+		size_t length = 2;	// fin, op, mask flag, 7 bit length
+		if (payloadLength > 0xffff)
+		{
+			length += 8;	// 64 bit length
+		}
+		else if (payloadLength > 125)
+		{
+			length += 2;	// 16 bit length
+		}
+		return isMasked ? length + 4 : length;
+	}
+
+	/// Write a frame header backwards from the start of its payload
+	/// @param payload Start of the payload, the header is written in the bytes before it
+	/// @param payloadLength Number of payload bytes
+	/// @param opCode What kind of operation the frame is encoded for
+	/// @param isFinal If this is the last frame of the message
+	/// @param mask The masking key, nullptr if the frame isn't masked
+	/// @return Number of bytes written before the payload
+	inline size_t writeWebsocketFrameHeader(uint8_t * payload, const uint64_t payloadLength, const uint8_t opCode, const bool isFinal, const uint8_t * mask)
 	{
 		const uint8_t FIN_BITS			= 0x80;	// 0b10000000;
 		const uint8_t OP_BITS			= 0x0f; // 0b00001111;
 		const uint8_t IS_MASKED_BITS	= 0x80;	// 0b10000000;
 
-		std::string result;
-
-		//// calculate size and make room to write ////
-		int headerSize = 2;	// Fin, op, mask, length
-		uint64_t msgLength = dataToWrite.length();
-		uint8_t shortPayloadLength;	// will trunkate if message is longer than 127
+		uint8_t * position = payload;
+		if (mask != nullptr)
+		{
+			position -= 4;
+			memcpy(position, mask, 4);
+		}
 
-		if (msgLength > 125)	// more than 7 bit
+		uint8_t shortPayloadLength;
+		if (payloadLength > 0xffff)
 		{
-			headerSize += 2;
+			uint64_t correctedLength = gaf::util::correctForNetByteOrder(payloadLength);
+			position -= 8;
+			memcpy(position, &correctedLength, 8);
+			shortPayloadLength = 127;
+		}
+		else if (payloadLength > 125)
+		{
+			uint16_t correctedLength = gaf::util::correctForNetByteOrder(static_cast<uint16_t>(payloadLength));
+			position -= 2;
+			memcpy(position, &correctedLength, 2);
 			shortPayloadLength = 126;
-			if (msgLength > 0xff)	// more than 16bit
-			{
-				headerSize += 6;	// 64bit
-				shortPayloadLength = 127;
-			}
 		}
 		else
 		{
-			shortPayloadLength = static_cast<uint8_t>(msgLength);
+			shortPayloadLength = static_cast<uint8_t>(payloadLength);
 		}
 
-		if (isMasked)
+		*--position = (mask != nullptr ? IS_MASKED_BITS : 0) | shortPayloadLength;
+		*--position = (isFinal ? FIN_BITS : 0) | (OP_BITS & opCode);
+		return static_cast<size_t>(payload - position);
+	}
+
+	/// @brief Builds a frame in a single buffer without copying its payload.
+	/// Room for the header is left at the front, the payload is written after it in place,
+	/// and the header is filled in backwards from the payload when the frame is finished
+	class WebsocketFrameBuilder
+	{
+	public:
+		/// Constructor
+		/// @param expectedSize Payload size expected, picks the room left for the header. If the payload ends up needing
+		/// a header of another length it is moved once when the frame is finished. The default suits any payload over 64 kB
+		/// @param isMasked If the frame is expected to be masked, as client frames are
+		explicit WebsocketFrameBuilder(const size_t expectedSize = SIZE_MAX, const bool isMasked = false)
+			: headerRoom(getWebsocketHeaderLength(expectedSize, isMasked))
 		{
-			headerSize += 4;
+			buffer.reserve(headerRoom + (expectedSize == SIZE_MAX ? 0 : expectedSize));
+			buffer.resize(headerRoom);
 		}
 
-		result.resize(headerSize + dataToWrite.length());	// make room for the header and payload
-
-		//// write the header ////
-		int position = 0;
-		// write fin		
-		if (isFinal)
+		/// Copy data onto the end of the payload
+		/// @param data Pointer to the bytes to add
+		/// @param size Number of bytes
+		void append(const char * data, const size_t size)
 		{
-			result[position] = FIN_BITS;
+			buffer.append(data, size);
 		}
-		// write op	
-		result[position] += OP_BITS & opCode;
 
-		position++;
-		// write mask flag
-		if (isMasked)
+		/// Copy text onto the end of the payload
+		/// @param text The text to add
+		void append(const std::string_view text)
 		{
-			result[position] = IS_MASKED_BITS;
+			buffer.append(text.data(), text.length());
 		}
 
-		// write initial (7 bit) length
-		result[position] += shortPayloadLength;
-		position++;
-
-		// write extended length
-		if (shortPayloadLength == 126)
+		/// Make room at the end of the payload for the caller to write into
+		/// @param size Number of bytes to add
+		/// @return Where to write them, valid until the payload grows again
+		char * extend(const size_t size)
 		{
-			// write 2 bytes to buffer
-			uint16_t sizedLength = static_cast<uint16_t>(msgLength);	// trunkate the length
-			uint16_t correctedLength = gaf::util::correctForNetByteOrder(sizedLength);	// convert to correct byte order
-			uint16_t * writePointer = reinterpret_cast<uint16_t*>(&result[position]);	// get write pointer
-			*writePointer = correctedLength;	// write
-			position += 2;
+			size_t start = buffer.length();
+			buffer.resize(start + size);
+			return &buffer[start];
 		}
-		else if (shortPayloadLength == 127)
+
+		/// @return Start of the payload written so far
+		char * getPayload()
 		{
-			// write 8 bytes to buffer
-			uint64_t correctedLength = gaf::util::correctForNetByteOrder(msgLength);	// convert to correct byte order
-			uint64_t * writePointer = reinterpret_cast<uint64_t*>(&result[position]);	// get write pointer
-			*writePointer = correctedLength;	// write
-			position += 8;
+			return &buffer[headerRoom];
 		}
-		
-		// write mask
-		if (isMasked)
+
+		/// @return Number of payload bytes written so far
+		size_t getPayloadLength() const
 		{
-			srand(static_cast<unsigned int>(time(NULL)));	
-			const uint32_t randomValue = rand();
-			const uint8_t * mask = reinterpret_cast<const uint8_t*>(&randomValue);
+			return buffer.length() - headerRoom;
+		}
 
-			for (int i = 0; i < 4; i++)
+		/// Write the header in front of the payload and hand the frame over. The builder is empty afterwards, ready for another frame
+		/// @param opCode What kind of operation the frame is encoded for
+		/// @param isFinal If this is the last frame of the message
+		/// @param isMasked If the payload is masked. Client MUST mask, Server MUST NOT mask
+		/// @return The encoded frame
+		std::string finish(const WebsocketOpCodes opCode, const bool isFinal = true, const bool isMasked = false)
+		{
+			size_t payloadLength = getPayloadLength();
+			size_t headerLength = getWebsocketHeaderLength(payloadLength, isMasked);
+			size_t room = headerRoom;
+			if (headerLength > room)	// expected a smaller payload, make more room
 			{
-				result[position + i] = mask[i];
+				buffer.insert(0, headerLength - room, '\0');
+				room = headerLength;
 			}
-			position += 4;
 
-			// mask and write data
-			for (unsigned int i = 0; i < dataToWrite.length(); i++)
+			uint8_t mask[4];
+			uint8_t * payload = reinterpret_cast<uint8_t*>(&buffer[room]);
+			if (isMasked)
+			{
+				generateMaskKey(mask);	// a fresh, unpredictable key for every frame
+				applyWebsocketMask(payload, payload, payloadLength, mask);
+			}
+			writeWebsocketFrameHeader(payload, payloadLength, opCode, isFinal, isMasked ? mask : nullptr);
+			if (headerLength < room)	// expected a larger payload, close the gap
 			{
-				result[position + i] = dataToWrite[i] ^ mask[i % 4];
+				buffer.erase(0, room - headerLength);
 			}
+
+			std::string frame = std::move(buffer);
+			buffer.assign(headerRoom, '\0');
+			return frame;
 		}
-		else
+
+	private:
+		std::string buffer;	/// room for the header followed by the payload
+		size_t headerRoom;	/// bytes left in front of the payload
+	};
+
+	/// Take a databuffer and encode it into a websocket frame
+	/// @param data Pointer to the data to encode, text or binary
+	/// @param size Number of bytes to encode
+	/// @param opCode What kind of operation this frame is encoded for
+	/// @param isFinal is this the last frame for the data
+	/// @param isMasked Is the data masked. Client MUST mask, Server MUST NOT mask
+	/// @return Fully encoded frame
+	inline std::string writeToWebsocketFrame(const char * data, const size_t size, const WebsocketOpCodes opCode, const bool isFinal = true, const bool isMasked = false)
+	{
+		WebsocketFrameBuilder builder(size, isMasked);
+		builder.append(data, size);
+		return builder.finish(opCode, isFinal, isMasked);
+	}
+
+	/// Encode a message as consecutive fragments in one buffer, so other frames can be sent between them.
+	/// Every fragment but the last carries exactly fragmentSize bytes, see getWebsocketFragmentStride
+	/// @param data Pointer to the data to encode, text or binary
+	/// @param size Number of bytes to encode
+	/// @param opCode TEXT or BINARY, the op code of the first fragment
+	/// @param fragmentSize Largest payload of a fragment, 0 to send the message as one frame
+	/// @param isMasked Is the data masked. Client MUST mask, Server MUST NOT mask
+	/// @return The encoded fragments
+	inline std::string writeToWebsocketFragments(const char * data, const size_t size, const WebsocketOpCodes opCode, const size_t fragmentSize, const bool isMasked = false)
+	{
+		if (fragmentSize == 0 || size <= fragmentSize)
 		{
-			// append the data
-			result.replace(position, dataToWrite.length(), dataToWrite);
+			return writeToWebsocketFrame(data, size, opCode, true, isMasked);
 		}
 
-		// write message
+		size_t fragmentCount = (size + fragmentSize - 1) / fragmentSize;
+		size_t lastSize = size - (fragmentCount - 1) * fragmentSize;
+		std::string result;
+		result.reserve((fragmentCount - 1) * getWebsocketHeaderLength(fragmentSize, isMasked) + getWebsocketHeaderLength(lastSize, isMasked) + size);
+		for (size_t start = 0; start < size; start += fragmentSize)
+		{
+			size_t length = size - start < fragmentSize ? size - start : fragmentSize;
+			uint8_t mask[4];
+			if (isMasked)
+			{
+				generateMaskKey(mask);	// a fresh key for every fragment
+			}
+			uint8_t header[14];
+			size_t headerLength = writeWebsocketFrameHeader(header + sizeof(header), length, start == 0 ? opCode : WebsocketOpCodes::CONTINUATION,
+				start + length == size, isMasked ? mask : nullptr);
+			result.append(reinterpret_cast<const char*>(header + sizeof(header) - headerLength), headerLength);
+
+			size_t position = result.length();
+			result.append(data + start, length);
+			if (isMasked)
+			{
+				uint8_t * payload = reinterpret_cast<uint8_t*>(&result[position]);
+				applyWebsocketMask(payload, payload, length, mask);
+			}
+		}
 		return result;
 	}
+
+	/// Get the length of the fragments in a buffer written by writeToWebsocketFragments
+	/// @param frames The encoded message
+	/// @return Bytes taken by each fragment but the last, 0 if the message is a single frame
+	inline size_t getWebsocketFragmentStride(const std::string & frames)
+	{
+		WebsocketFrameHeader header;
+		if (readWebsocketFrameHeader(reinterpret_cast<const uint8_t*>(frames.data()), frames.length(), header) != WebsocketFrameStatus::COMPLETE || header.isFinal)
+		{
+			return 0;
+		}
+		return header.headerLength + static_cast<size_t>(header.payloadLength);
+	}
+
+	/// Take a string and encode it into a websocket frame
+	/// @param dataToWrite String containing the data to encode
+	/// @param opCode What kind of operation this frame is encoded for
+	/// @param isFinal is this the last frame for the data
+	/// @param isMasked Is the data masked. Client MUST mask, Server MUST NOT mask
+	/// @return Fully encoded frame
+	inline std::string writeToWebsocketFrame(const std::string & dataToWrite, const WebsocketOpCodes opCode, const bool isFinal = true, const bool isMasked = false)
+	{
+		return writeToWebsocketFrame(dataToWrite.data(), dataToWrite.length(), opCode, isFinal, isMasked);
+	}
+
+	/// Check if a status code may be sent in a close frame
+	/// @param code The status code
+	/// @return If the code is defined by RFC 6455 or in the range left for applications
+	inline bool isValidCloseCode(const uint16_t code)
+	{
+		return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) || (code >= 3000 && code <= 4999);
+	}
+
+	/// Build the payload of a close frame
+	/// @param code Status code, sent in network byte order
+	/// @param reason Human readable reason, shortened to fit in a control frame
+	/// @return The payload
+	inline std::string writeWebsocketClosePayload(const uint16_t code, const std::string & reason = "")
+	{
+		const size_t MAX_REASON_LENGTH = 123;	// control frames carry at most 125 bytes, 2 are used by the code
+		std::string payload;
+		payload += static_cast<char>(code >> 8);
+		payload += static_cast<char>(code & 0xff);
+		size_t length = reason.length();
+		if (length > MAX_REASON_LENGTH)
+		{
+			length = MAX_REASON_LENGTH;
+			while (length > 0 && (reason[length] & 0xc0) == 0x80)	// don't cut a character in half
+			{
+				length--;
+			}
+		}
+		payload.append(reason, 0, length);
+		return payload;
+	}
+
+	/// Read the payload of a received close frame
+	/// @param payload The unmasked payload
+	/// @param code [out] The status code, NO_STATUS_RECEIVED if the frame had none
+	/// @param reason [out] The reason given, if any
+	/// @return If the payload is valid, including the reason being UTF-8
+	inline bool readWebsocketClosePayload(const std::string & payload, uint16_t & code, std::string & reason)
+	{
+		reason.clear();
+		if (payload.empty())
+		{
+			code = WebsocketCloseCodes::NO_STATUS_RECEIVED;
+			return true;
+		}
+		if (payload.length() == 1)	// half a status code
+		{
+			return false;
+		}
+		code = static_cast<uint16_t>((static_cast<uint8_t>(payload[0]) << 8) | static_cast<uint8_t>(payload[1]));
+		reason.assign(payload, 2, std::string::npos);
+		return isValidCloseCode(code) && isValidUtf8(reason.data(), reason.length());
+	}
 }
 
 #endif // !AMS_WEBSOCKET_FRAME_HPP
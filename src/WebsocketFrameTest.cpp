@@ -78,17 +78,12 @@ TEST_CASE("Websocket Frame")
 		extraLongMessage += longMessage;
 	}
 
+	// 60000 bytes fit the 16 bit length, RFC 6455 section 5.2 requires the shortest encoding
 	string encodedExtraLong;
 	encodedExtraLong += (char)129;	// fin, opcode
-	encodedExtraLong += (char)127;	// 64bit length
-	encodedExtraLong += (char)0;	// 1
-	encodedExtraLong += (char)0;	// 2
-	encodedExtraLong += (char)0;	// 3
-	encodedExtraLong += (char)0;	// 4
-	encodedExtraLong += (char)0;	// 5
-	encodedExtraLong += (char)0;	// 6
-	encodedExtraLong += (char)0xea;	// 7 - first byte of size
-	encodedExtraLong += (char)0x60;	// 8 - second byte of size
+	encodedExtraLong += (char)126;	// 16bit length
+	encodedExtraLong += (char)0xea;	// first byte of size
+	encodedExtraLong += (char)0x60;	// second byte of size
 	encodedExtraLong += extraLongMessage;	// payload
 
 	SECTION("Write Extra Long Message")
@@ -109,4 +104,227 @@ TEST_CASE("Websocket Frame")
 		string result =	readFromWebsocketFrame(encoded);
 		REQUIRE(result.compare(extraLongMessage) == 0);
 	}
-}
\ No newline at end of file
+
+	SECTION("Length encodings")
+	{
+		REQUIRE(writeToWebsocketFrame(string(125, 'a'), WebsocketOpCodes::TEXT).length() == 2 + 125);
+		REQUIRE(writeToWebsocketFrame(string(126, 'a'), WebsocketOpCodes::TEXT).length() == 4 + 126);
+		REQUIRE(writeToWebsocketFrame(string(65535, 'a'), WebsocketOpCodes::TEXT).length() == 4 + 65535);
+
+		string encoded = writeToWebsocketFrame(string(65536, 'a'), WebsocketOpCodes::TEXT);
+		REQUIRE(encoded.length() == 10 + 65536);
+		REQUIRE((uint8_t)encoded[1] == 127);	// 64bit length
+		REQUIRE(encoded.compare(2, 8, string{ 0, 0, 0, 0, 0, 1, 0, 0 }) == 0);
+	}
+}
+
+TEST_CASE("Websocket Frame Builder")
+{
+	SECTION("Payload written in place")
+	{
+		WebsocketFrameBuilder builder(1024 * 1024);
+		char * payload = builder.extend(1024 * 1024);
+		memset(payload, 'a', 1024 * 1024);
+		string frame = builder.finish(WebsocketOpCodes::BINARY);
+		REQUIRE(frame.data() + 10 == payload);	// the header went in front, the payload never moved
+		REQUIRE(frame == writeToWebsocketFrame(string(1024 * 1024, 'a'), WebsocketOpCodes::BINARY));
+	}
+
+	SECTION("Appended pieces")
+	{
+		WebsocketFrameBuilder builder;
+		builder.append("Te", 2);
+		builder.append(std::string_view("st"));
+		REQUIRE(builder.getPayloadLength() == 4);
+		REQUIRE(builder.finish(WebsocketOpCodes::TEXT) == writeToWebsocketFrame("Test", WebsocketOpCodes::TEXT));	// smaller than expected
+
+		builder.append(string(300, 'b'));	// ready for the next frame
+		REQUIRE(builder.finish(WebsocketOpCodes::TEXT, false) == writeToWebsocketFrame(string(300, 'b'), WebsocketOpCodes::TEXT, false));
+	}
+
+	SECTION("Larger than expected")
+	{
+		WebsocketFrameBuilder builder(10);
+		builder.append(string(70000, 'c'));
+		REQUIRE(builder.finish(WebsocketOpCodes::BINARY) == writeToWebsocketFrame(string(70000, 'c'), WebsocketOpCodes::BINARY));
+	}
+
+	SECTION("Masked")
+	{
+		WebsocketFrameBuilder builder(200, true);
+		builder.append(string(200, 'd'));
+		string frame = builder.finish(WebsocketOpCodes::TEXT, true, true);
+		REQUIRE(frame.length() == 8 + 200);
+		REQUIRE(readFromWebsocketFrame(frame) == string(200, 'd'));
+	}
+}
+
+TEST_CASE("Websocket Fragments")
+{
+	string message(300, 'f');
+	WebsocketFrame frame;
+	size_t consumed = 0;
+
+	SECTION("Split into fragments")
+	{
+		string frames = writeToWebsocketFragments(message.data(), message.length(), WebsocketOpCodes::TEXT, 128);
+		REQUIRE(getWebsocketFragmentStride(frames) == 4 + 128);
+		REQUIRE(frames.length() == 2 * (4 + 128) + 2 + 44);
+
+		const WebsocketOpCodes opCodes[] = { WebsocketOpCodes::TEXT, WebsocketOpCodes::CONTINUATION, WebsocketOpCodes::CONTINUATION };
+		string payload;
+		size_t position = 0;
+		for (size_t i = 0; i < 3; i++)
+		{
+			REQUIRE(readWebsocketFrame(frames.data() + position, frames.length() - position, frame, consumed) == WebsocketFrameStatus::COMPLETE);
+			REQUIRE(frame.header.opCode == opCodes[i]);
+			REQUIRE(frame.header.isFinal == (i == 2));
+			payload += frame.payload;
+			position += consumed;
+		}
+		REQUIRE(position == frames.length());
+		REQUIRE(payload == message);
+	}
+
+	SECTION("Masked fragments")
+	{
+		string frames = writeToWebsocketFragments(message.data(), message.length(), WebsocketOpCodes::BINARY, 200, true);
+		REQUIRE(getWebsocketFragmentStride(frames) == 8 + 200);
+		REQUIRE(readWebsocketFrame(frames.data(), frames.length(), frame, consumed) == WebsocketFrameStatus::COMPLETE);
+		REQUIRE(frame.payload == message.substr(0, 200));
+		REQUIRE(readWebsocketFrame(frames.data() + consumed, frames.length() - consumed, frame, consumed) == WebsocketFrameStatus::COMPLETE);
+		REQUIRE(frame.payload == message.substr(200));
+	}
+
+	SECTION("Small message is one frame")
+	{
+		string frames = writeToWebsocketFragments(message.data(), message.length(), WebsocketOpCodes::TEXT, 300);
+		REQUIRE(frames == writeToWebsocketFrame(message, WebsocketOpCodes::TEXT));
+		REQUIRE(getWebsocketFragmentStride(frames) == 0);
+		REQUIRE(writeToWebsocketFragments(message.data(), message.length(), WebsocketOpCodes::TEXT, 0) == frames);	// never split
+	}
+}
+
+TEST_CASE("Websocket Frame Decoder")
+{
+	string first = writeToWebsocketFrame("Hello", WebsocketOpCodes::TEXT, true, true);
+	string second = writeToWebsocketFrame("World!", WebsocketOpCodes::BINARY, true, true);
+	WebsocketFrame frame;
+	size_t consumed = 0;
+
+	SECTION("Coalesced frames")
+	{
+		string buffer = first + second;
+		REQUIRE(readWebsocketFrame(buffer.data(), buffer.length(), frame, consumed) == WebsocketFrameStatus::COMPLETE);
+		REQUIRE(consumed == first.length());
+		REQUIRE(frame.payload == "Hello");
+		REQUIRE(frame.header.opCode == WebsocketOpCodes::TEXT);
+
+		REQUIRE(readWebsocketFrame(buffer.data() + consumed, buffer.length() - consumed, frame, consumed) == WebsocketFrameStatus::COMPLETE);
+		REQUIRE(consumed == second.length());
+		REQUIRE(frame.payload == "World!");
+		REQUIRE(frame.header.opCode == WebsocketOpCodes::BINARY);
+	}
+
+	SECTION("Split frame")
+	{
+		for (size_t i = 0; i < first.length(); i++)	// every possible split point
+		{
+			REQUIRE(readWebsocketFrame(first.data(), i, frame, consumed) == WebsocketFrameStatus::INCOMPLETE);
+			REQUIRE(consumed == 0);
+		}
+		REQUIRE(readWebsocketFrame(first.data(), first.length(), frame, consumed) == WebsocketFrameStatus::COMPLETE);
+	}
+
+	SECTION("Split extended length")
+	{
+		string encoded = writeToWebsocketFrame(string(300, 'a'), WebsocketOpCodes::TEXT);
+		REQUIRE(readWebsocketFrame(encoded.data(), 3, frame, consumed) == WebsocketFrameStatus::INCOMPLETE);
+		REQUIRE(readWebsocketFrame(encoded.data(), encoded.length() - 1, frame, consumed) == WebsocketFrameStatus::INCOMPLETE);
+		REQUIRE(readWebsocketFrame(encoded.data(), encoded.length(), frame, consumed) == WebsocketFrameStatus::COMPLETE);
+		REQUIRE(frame.payload.length() == 300);
+	}
+
+	SECTION("Invalid frames")
+	{
+		string tooLong = writeToWebsocketFrame(string(200, 'a'), WebsocketOpCodes::TEXT);
+		REQUIRE(readWebsocketFrame(tooLong.data(), tooLong.length(), frame, consumed, 100) == WebsocketFrameStatus::TOO_LARGE);
+
+		string hugeLength = { (char)0x81, (char)127, (char)0x80, 0, 0, 0, 0, 0, 0, 0 };	// most significant bit set
+		REQUIRE(readWebsocketFrame(hugeLength.data(), hugeLength.length(), frame, consumed) == WebsocketFrameStatus::INVALID);
+
+		string longPing = writeToWebsocketFrame(string(200, 'a'), WebsocketOpCodes::PING);
+		REQUIRE(readWebsocketFrame(longPing.data(), longPing.length(), frame, consumed) == WebsocketFrameStatus::INVALID);
+
+		string fragmentedClose = writeToWebsocketFrame("", WebsocketOpCodes::CLOSE, false);
+		REQUIRE(readWebsocketFrame(fragmentedClose.data(), fragmentedClose.length(), frame, consumed) == WebsocketFrameStatus::INVALID);
+
+		for (uint8_t opCode : { 0x3, 0x7, 0xB, 0xF })	// reserved non-control and control codes
+		{
+			string reserved = { static_cast<char>(0x80 | opCode), 0 };
+			REQUIRE(readWebsocketFrame(reserved.data(), reserved.length(), frame, consumed) == WebsocketFrameStatus::INVALID);
+		}
+	}
+
+	SECTION("Binary payload")
+	{
+		const uint8_t binary[] = { 0, 1, 2, 0xff, 0, 0x80 };
+		string encoded = writeToWebsocketFrame(reinterpret_cast<const char*>(binary), sizeof(binary), WebsocketOpCodes::BINARY, true, true);
+		REQUIRE(readWebsocketFrame(encoded.data(), encoded.length(), frame, consumed) == WebsocketFrameStatus::COMPLETE);
+		REQUIRE(frame.header.opCode == WebsocketOpCodes::BINARY);
+		REQUIRE(frame.payload == string(reinterpret_cast<const char*>(binary), sizeof(binary)));
+	}
+
+	SECTION("Get op of empty data")
+	{
+		REQUIRE(getWebsocketFrameOp("") == WebsocketOpCodes::CLOSE);
+		REQUIRE(readFromWebsocketFrame("").empty());
+	}
+}
+
+TEST_CASE("Websocket Close Payload")
+{
+	uint16_t code;
+	string reason;
+
+	SECTION("Round trip")
+	{
+		string payload = writeWebsocketClosePayload(WebsocketCloseCodes::GOING_AWAY, "Server shutting down");
+		REQUIRE(payload.substr(0, 2) == string{ 0x03, (char)0xe9 });	// 1001, network order
+		REQUIRE(readWebsocketClosePayload(payload, code, reason));
+		REQUIRE(code == WebsocketCloseCodes::GOING_AWAY);
+		REQUIRE(reason == "Server shutting down");
+	}
+
+	SECTION("Reason fits in a control frame")
+	{
+		string payload = writeWebsocketClosePayload(WebsocketCloseCodes::NORMAL_CLOSURE, string(200, 'a'));
+		REQUIRE(payload.length() == 125);
+
+		string accents;
+		for (int i = 0; i < 70; i++)
+		{
+			accents += "\xc3\xa9";	// 2 byte character
+		}
+		payload = writeWebsocketClosePayload(WebsocketCloseCodes::NORMAL_CLOSURE, accents);
+		REQUIRE(payload.length() == 2 + 122);	// 61 whole characters, not 61 and a half
+		REQUIRE(readWebsocketClosePayload(payload, code, reason));
+	}
+
+	SECTION("No status")
+	{
+		REQUIRE(readWebsocketClosePayload("", code, reason));
+		REQUIRE(code == WebsocketCloseCodes::NO_STATUS_RECEIVED);
+		REQUIRE(reason.empty());
+	}
+
+	SECTION("Invalid payloads")
+	{
+		REQUIRE_FALSE(readWebsocketClosePayload("a", code, reason));
+		REQUIRE_FALSE(readWebsocketClosePayload(writeWebsocketClosePayload(WebsocketCloseCodes::NO_STATUS_RECEIVED), code, reason));	// only used locally
+		REQUIRE_FALSE(readWebsocketClosePayload(writeWebsocketClosePayload(999), code, reason));
+		REQUIRE_FALSE(readWebsocketClosePayload(writeWebsocketClosePayload(5000), code, reason));
+		REQUIRE(readWebsocketClosePayload(writeWebsocketClosePayload(4000), code, reason));	// private use
+		REQUIRE_FALSE(readWebsocketClosePayload(writeWebsocketClosePayload(WebsocketCloseCodes::NORMAL_CLOSURE, "\xc0\xaf"), code, reason));	// reason isn't UTF-8
+	}
+}
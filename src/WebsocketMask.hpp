@@ -0,0 +1,232 @@
+/******************************
+ * @file WebsocketMask.hpp
+ * Alex's MicroServer (AMS)
+ * @author Alex Schlieck
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * Applies or removes the websocket masking key (RFC 6455 section 5.3).
+ * Uses the widest vector instructions the CPU supports, chosen once at run time
+ ******************************/
+
+#ifndef AMS_WEBSOCKET_MASK_HPP
+#define AMS_WEBSOCKET_MASK_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>	// memcpy
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	#define AMS_MASK_X86
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define AMS_TARGET(isa)
+	#else
+		#define AMS_TARGET(isa) __attribute__((target(isa)))
+	#endif
+#endif
+
+namespace ams
+{
+	/// Instruction sets the masking code can use
+	enum class MaskKernel { SCALAR, SSE2, AVX2, AVX512 };
+
+	namespace maskDetail
+	{
+		/// Get the 4 mask bytes starting at a position in the mask cycle, as they appear in memory
+		inline uint32_t rotatedMask(const uint8_t mask[4], const size_t offset)
+		{
+			uint8_t bytes[4] = { mask[offset % 4], mask[(offset + 1) % 4], mask[(offset + 2) % 4], mask[(offset + 3) % 4] };
+			uint32_t result;
+			memcpy(&result, bytes, 4);
+			return result;
+		}
+
+		/// Portable version, 8 bytes at a time
+		inline void maskScalar(const uint8_t * source, uint8_t * destination, size_t size, const uint8_t mask[4], size_t offset)
+		{
+			uint64_t mask64 = rotatedMask(mask, offset);
+			mask64 |= mask64 << 32;
+
+			size_t i = 0;
+			for (; i + 8 <= size; i += 8)	// 8 is a multiple of 4, so the mask phase doesn't change
+			{
+				uint64_t block;
+				memcpy(&block, source + i, 8);	// memcpy allows unaligned data
+				block ^= mask64;
+				memcpy(destination + i, &block, 8);
+			}
+			for (; i < size; i++)
+			{
+				destination[i] = source[i] ^ mask[(offset + i) % 4];
+			}
+		}
+
+#ifdef AMS_MASK_X86
+		/// Number of bytes to process one at a time so the destination becomes aligned
+		inline size_t getHeadSize(const uint8_t * destination, const size_t size, const size_t alignment)
+		{
+			size_t misalignment = reinterpret_cast<uintptr_t>(destination) & (alignment - 1);
+			size_t head = misalignment == 0 ? 0 : alignment - misalignment;
+			return head < size ? head : size;
+		}
+
+		inline void maskSse2(const uint8_t * source, uint8_t * destination, size_t size, const uint8_t mask[4], size_t offset)
+		{
+			size_t head = getHeadSize(destination, size, 16);
+			maskScalar(source, destination, head, mask, offset);
+
+			size_t i = head;
+			__m128i maskVector = _mm_set1_epi32(static_cast<int>(rotatedMask(mask, offset + head)));
+			for (; i + 16 <= size; i += 16)
+			{
+				__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+				_mm_store_si128(reinterpret_cast<__m128i*>(destination + i), _mm_xor_si128(block, maskVector));
+			}
+			maskScalar(source + i, destination + i, size - i, mask, offset + i);
+		}
+
+		AMS_TARGET("avx2")
+		inline void maskAvx2(const uint8_t * source, uint8_t * destination, size_t size, const uint8_t mask[4], size_t offset)
+		{
+			size_t head = getHeadSize(destination, size, 32);
+			maskScalar(source, destination, head, mask, offset);
+
+			size_t i = head;
+			__m256i maskVector = _mm256_set1_epi32(static_cast<int>(rotatedMask(mask, offset + head)));
+			for (; i + 128 <= size; i += 128)	// unrolled, keeps several loads in flight
+			{
+				for (size_t j = 0; j < 128; j += 32)
+				{
+					__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i + j));
+					_mm256_store_si256(reinterpret_cast<__m256i*>(destination + i + j), _mm256_xor_si256(block, maskVector));
+				}
+			}
+			for (; i + 32 <= size; i += 32)
+			{
+				__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+				_mm256_store_si256(reinterpret_cast<__m256i*>(destination + i), _mm256_xor_si256(block, maskVector));
+			}
+			maskScalar(source + i, destination + i, size - i, mask, offset + i);
+		}
+
+		AMS_TARGET("avx512f")
+		inline void maskAvx512(const uint8_t * source, uint8_t * destination, size_t size, const uint8_t mask[4], size_t offset)
+		{
+			size_t head = getHeadSize(destination, size, 64);
+			maskScalar(source, destination, head, mask, offset);
+
+			size_t i = head;
+			__m512i maskVector = _mm512_set1_epi32(static_cast<int>(rotatedMask(mask, offset + head)));
+			for (; i + 64 <= size; i += 64)
+			{
+				__m512i block = _mm512_loadu_si512(source + i);
+				_mm512_store_si512(destination + i, _mm512_xor_si512(block, maskVector));
+			}
+			maskScalar(source + i, destination + i, size - i, mask, offset + i);
+		}
+#endif // AMS_MASK_X86
+
+		using MaskFunction = void(*)(const uint8_t *, uint8_t *, size_t, const uint8_t[4], size_t);
+
+		/// Find the function that implements a kernel
+		inline MaskFunction getMaskFunction(const MaskKernel kernel)
+		{
+			switch (kernel)
+			{
+#ifdef AMS_MASK_X86
+				case MaskKernel::SSE2:		return maskSse2;
+				case MaskKernel::AVX2:		return maskAvx2;
+				case MaskKernel::AVX512:	return maskAvx512;
+#endif
+				default:					return maskScalar;
+			}
+		}
+	}
+
+	/// Check if the CPU (and OS) can run a kernel
+	/// @param kernel The kernel to check
+	/// @return If the kernel can be used
+	inline bool isMaskKernelSupported(const MaskKernel kernel)
+	{
+#ifdef AMS_MASK_X86
+		static const bool hasSse2 = true;	// every x86 target this library builds for has SSE2
+	#ifdef _MSC_VER
+		static const bool hasAvx2 = []()
+		{
+			int info[4];
+			__cpuid(info, 1);
+			bool osSavesAvx = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+			__cpuidex(info, 7, 0);
+			return osSavesAvx && (info[1] & (1 << 5));
+		}();
+		static const bool hasAvx512 = []()
+		{
+			int info[4];
+			__cpuid(info, 1);
+			bool osSavesAvx512 = (info[2] & (1 << 27)) && (_xgetbv(0) & 0xe6) == 0xe6;
+			__cpuidex(info, 7, 0);
+			return osSavesAvx512 && (info[1] & (1 << 16));
+		}();
+	#else
+		static const bool hasAvx2 = []() { __builtin_cpu_init(); return __builtin_cpu_supports("avx2") != 0; }();
+		static const bool hasAvx512 = []() { __builtin_cpu_init(); return __builtin_cpu_supports("avx512f") != 0; }();
+	#endif
+		switch (kernel)
+		{
+			case MaskKernel::SCALAR:	return true;
+			case MaskKernel::SSE2:		return hasSse2;
+			case MaskKernel::AVX2:		return hasAvx2;
+			case MaskKernel::AVX512:	return hasAvx512;
+		}
+		return false;
+#else
+		return kernel == MaskKernel::SCALAR;
+#endif
+	}
+
+	/// @return The fastest kernel the CPU supports
+	inline MaskKernel getBestMaskKernel()
+	{
+		static const MaskKernel best = []()
+		{
+			const MaskKernel kernels[] = { MaskKernel::AVX512, MaskKernel::AVX2, MaskKernel::SSE2 };
+			for (MaskKernel kernel : kernels)
+			{
+				if (isMaskKernelSupported(kernel))
+				{
+					return kernel;
+				}
+			}
+			return MaskKernel::SCALAR;
+		}();
+		return best;
+	}
+
+	/// Mask or unmask data with a specific kernel. Masking and unmasking are the same operation
+	/// @param source Data to read
+	/// @param destination Where to write, can be the same as source to work in place
+	/// @param size Number of bytes
+	/// @param mask The 4 byte masking key
+	/// @param offset Position of the first byte within the payload, used when a payload is processed in pieces
+	/// @param kernel Which instruction set to use, must be supported by the CPU
+	inline void applyWebsocketMask(const uint8_t * source, uint8_t * destination, const size_t size, const uint8_t mask[4], const size_t offset, const MaskKernel kernel)
+	{
+		maskDetail::getMaskFunction(kernel)(source, destination, size, mask, offset);
+	}
+
+	/// Mask or unmask data with the fastest kernel available. Masking and unmasking are the same operation
+	/// @param source Data to read
+	/// @param destination Where to write, can be the same as source to work in place
+	/// @param size Number of bytes
+	/// @param mask The 4 byte masking key
+	/// @param offset Position of the first byte within the payload, used when a payload is processed in pieces
+	inline void applyWebsocketMask(const uint8_t * source, uint8_t * destination, const size_t size, const uint8_t mask[4], const size_t offset = 0)
+	{
+		static const maskDetail::MaskFunction best = maskDetail::getMaskFunction(getBestMaskKernel());
+		best(source, destination, size, mask, offset);
+	}
+}
+
+#endif // !AMS_WEBSOCKET_MASK_HPP
@@ -0,0 +1,178 @@
+/******************************
+ * @file WebsocketMaskKey.hpp
+ * Alex's MicroServer (AMS)
+ * @author Alex Schlieck
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * Generates the unpredictable masking keys clients put on every frame (RFC 6455 section 10.3).
+ * Keys come from a ChaCha20 keystream (RFC 7539) seeded once per thread by the operating system
+ ******************************/
+
+#ifndef AMS_WEBSOCKET_MASK_KEY_HPP
+#define AMS_WEBSOCKET_MASK_KEY_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>	// memcpy
+#include <random>	// random_device
+#if defined(__linux__) && defined(__has_include)
+	#if __has_include(<sys/random.h>)
+		#define AMS_HAS_GETRANDOM
+		#include <sys/random.h>	// getrandom
+	#endif
+#endif
+
+namespace ams
+{
+	namespace maskKeyDetail
+	{
+		inline uint32_t rotateLeft(const uint32_t value, const int bits)
+		{
+			return (value << bits) | (value >> (32 - bits));
+		}
+
+		inline void quarterRound(uint32_t & a, uint32_t & b, uint32_t & c, uint32_t & d)
+		{
+			a += b; d ^= a; d = rotateLeft(d, 16);
+			c += d; b ^= c; b = rotateLeft(b, 12);
+			a += b; d ^= a; d = rotateLeft(d, 8);
+			c += d; b ^= c; b = rotateLeft(b, 7);
+		}
+
+		/// Produce one 64 byte ChaCha20 block
+		/// @param key 256 bit key
+		/// @param counter Block counter
+		/// @param nonce 96 bit nonce
+		/// @param output [out] The keystream block, serialized little endian
+		inline void chacha20Block(const uint32_t key[8], const uint32_t counter, const uint32_t nonce[3], uint8_t output[64])
+		{
+			uint32_t input[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,	// "expand 32-byte k"
+				key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+				counter, nonce[0], nonce[1], nonce[2] };
+			uint32_t x[16];
+			memcpy(x, input, sizeof(x));
+			for (int i = 0; i < 10; i++)	// 20 rounds, a column and a diagonal round each time
+			{
+				quarterRound(x[0], x[4], x[8], x[12]);
+				quarterRound(x[1], x[5], x[9], x[13]);
+				quarterRound(x[2], x[6], x[10], x[14]);
+				quarterRound(x[3], x[7], x[11], x[15]);
+				quarterRound(x[0], x[5], x[10], x[15]);
+				quarterRound(x[1], x[6], x[11], x[12]);
+				quarterRound(x[2], x[7], x[8], x[13]);
+				quarterRound(x[3], x[4], x[9], x[14]);
+			}
+			for (int i = 0; i < 16; i++)
+			{
+				uint32_t word = x[i] + input[i];
+				output[i * 4] = static_cast<uint8_t>(word);
+				output[i * 4 + 1] = static_cast<uint8_t>(word >> 8);
+				output[i * 4 + 2] = static_cast<uint8_t>(word >> 16);
+				output[i * 4 + 3] = static_cast<uint8_t>(word >> 24);
+			}
+		}
+
+		/// Fill a buffer from the operating system's entropy source
+		/// @param data Where to write
+		/// @param size Number of bytes
+		inline void fillFromSystem(uint8_t * data, const size_t size)
+		{
+			size_t filled = 0;
+#ifdef AMS_HAS_GETRANDOM
+			while (filled < size)
+			{
+				ssize_t result = getrandom(data + filled, size - filled, 0);
+				if (result <= 0)
+				{
+					break;	// not supported by the kernel, use random_device instead
+				}
+				filled += static_cast<size_t>(result);
+			}
+#endif
+			if (filled < size)
+			{
+				std::random_device device;	// the OS cryptographic generator on the supported platforms
+				for (; filled < size; filled++)
+				{
+					data[filled] = static_cast<uint8_t>(device());
+				}
+			}
+		}
+	}
+
+	/// @brief Cheap source of unpredictable bytes for masking keys and handshake nonces.
+	/// Each 64 byte block of keystream gives 16 keys, so the cost of a key is a few nanoseconds.
+	/// Not thread safe, use one per thread (see generateMaskKey)
+	class MaskKeyGenerator
+	{
+	public:
+		/// Constructor, seeds from the operating system
+		MaskKeyGenerator()
+		{
+			uint8_t seed[32];
+			maskKeyDetail::fillFromSystem(seed, sizeof(seed));
+			memcpy(key, seed, sizeof(seed));
+		}
+
+		/// Get the next 4 byte masking key
+		/// @param mask [out] The key
+		void next(uint8_t mask[4])
+		{
+			if (position + 4 <= sizeof(block))	// usual case, straight from the block
+			{
+				memcpy(mask, block + position, 4);
+				position += 4;
+				return;
+			}
+			fill(mask, 4);
+		}
+
+		/// Get any number of unpredictable bytes
+		/// @param data [out] Where to write
+		/// @param size Number of bytes
+		void fill(uint8_t * data, size_t size)
+		{
+			while (size != 0)
+			{
+				if (position == sizeof(block))	// refill a whole block at a time
+				{
+					maskKeyDetail::chacha20Block(key, counter, nonce, block);
+					if (++counter == 0)
+					{
+						nonce[0]++;
+					}
+					position = 0;
+				}
+				size_t count = size < sizeof(block) - position ? size : sizeof(block) - position;
+				memcpy(data, block + position, count);
+				position += count;
+				data += count;
+				size -= count;
+			}
+		}
+
+	private:
+		uint32_t key[8];	/// secret seed
+		uint32_t counter = 0;	/// next block
+		uint32_t nonce[3] = { 0, 0, 0 };	/// extends the counter
+		uint8_t block[64];	/// keystream not handed out yet
+		size_t position = sizeof(block);	/// next unused byte of the block
+	};
+
+	/// @return The calling thread's generator, seeded on first use
+	inline MaskKeyGenerator & getThreadMaskKeyGenerator()
+	{
+		thread_local MaskKeyGenerator generator;
+		return generator;
+	}
+
+	/// Get a masking key from the calling thread's generator
+	/// @param mask [out] The key
+	inline void generateMaskKey(uint8_t mask[4])
+	{
+		getThreadMaskKeyGenerator().next(mask);
+	}
+}
+
+#endif // !AMS_WEBSOCKET_MASK_KEY_HPP
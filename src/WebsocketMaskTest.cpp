@@ -0,0 +1,160 @@
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include "../test/catch.hpp"
+#include "WebsocketMask.hpp"
+#include "WebsocketMaskKey.hpp"
+#include "WebsocketFrame.hpp"
+
+using namespace ams;
+
+namespace
+{
+	const MaskKernel ALL_KERNELS[] = { MaskKernel::SCALAR, MaskKernel::SSE2, MaskKernel::AVX2, MaskKernel::AVX512 };
+	const char * KERNEL_NAMES[] = { "scalar", "SSE2", "AVX2", "AVX-512" };
+}
+
+TEST_CASE("Websocket Mask", "[websocket],[mask]")
+{
+	const uint8_t mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+
+	std::vector<uint8_t> source(600);
+	for (size_t i = 0; i < source.size(); i++)
+	{
+		source[i] = static_cast<uint8_t>(i * 7 + 3);
+	}
+
+	for (MaskKernel kernel : ALL_KERNELS)
+	{
+		if (!isMaskKernelSupported(kernel))
+		{
+			continue;
+		}
+
+		SECTION(std::string("Matches reference: ") + KERNEL_NAMES[static_cast<int>(kernel)])
+		{
+			// every combination of unaligned head, odd size and mask phase
+			for (size_t start = 0; start < 70; start += 3)
+			{
+				for (size_t size = 0; size + start <= source.size(); size += 37)
+				{
+					for (size_t offset = 0; offset < 4; offset++)
+					{
+						std::vector<uint8_t> result(source.size(), 0);
+						applyWebsocketMask(source.data() + start, result.data() + start, size, mask, offset, kernel);
+
+						bool isCorrect = true;
+						for (size_t i = 0; i < size; i++)
+						{
+							isCorrect &= result[start + i] == (source[start + i] ^ mask[(offset + i) % 4]);
+						}
+						REQUIRE(isCorrect);
+					}
+				}
+			}
+		}
+
+		SECTION(std::string("In place: ") + KERNEL_NAMES[static_cast<int>(kernel)])
+		{
+			std::vector<uint8_t> data = source;
+			applyWebsocketMask(data.data() + 1, data.data() + 1, data.size() - 1, mask, 0, kernel);
+			applyWebsocketMask(data.data() + 1, data.data() + 1, data.size() - 1, mask, 0, kernel);	// masking twice restores the data
+			REQUIRE(data == source);
+		}
+	}
+
+	SECTION("Resume across pieces")
+	{
+		std::vector<uint8_t> whole(source.size());
+		std::vector<uint8_t> pieces(source.size());
+		applyWebsocketMask(source.data(), whole.data(), source.size(), mask);
+		applyWebsocketMask(source.data(), pieces.data(), 101, mask, 0);
+		applyWebsocketMask(source.data() + 101, pieces.data() + 101, source.size() - 101, mask, 101);
+		REQUIRE(whole == pieces);
+	}
+}
+
+TEST_CASE("Websocket Mask Keys", "[websocket],[mask]")
+{
+	SECTION("ChaCha20 block matches RFC 7539")
+	{
+		const uint32_t key[8] = { 0x03020100, 0x07060504, 0x0b0a0908, 0x0f0e0d0c, 0x13121110, 0x17161514, 0x1b1a1918, 0x1f1e1d1c };
+		const uint32_t nonce[3] = { 0x09000000, 0x4a000000, 0 };
+		const uint8_t expected[64] = {	// test vector from section 2.3.2
+			0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15, 0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+			0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03, 0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+			0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09, 0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+			0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9, 0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e };
+		uint8_t block[64];
+		maskKeyDetail::chacha20Block(key, 1, nonce, block);
+		REQUIRE(memcmp(block, expected, sizeof(block)) == 0);
+	}
+
+	SECTION("Every frame gets its own key")
+	{
+		std::string first = writeToWebsocketFrame("same payload", WebsocketOpCodes::TEXT, true, true);
+		std::string second = writeToWebsocketFrame("same payload", WebsocketOpCodes::TEXT, true, true);
+		REQUIRE(first.substr(2, 4) != second.substr(2, 4));	// the masks differ even within the same second
+
+		WebsocketFrame frame;
+		size_t consumed;
+		REQUIRE(readWebsocketFrame(second.data(), second.length(), frame, consumed) == WebsocketFrameStatus::COMPLETE);
+		REQUIRE(frame.payload == "same payload");
+	}
+
+	SECTION("Separate generators are independent")
+	{
+		MaskKeyGenerator one;
+		MaskKeyGenerator two;
+		uint8_t bytesOne[32];
+		uint8_t bytesTwo[32];
+		one.fill(bytesOne, sizeof(bytesOne));
+		two.fill(bytesTwo, sizeof(bytesTwo));
+		REQUIRE(memcmp(bytesOne, bytesTwo, sizeof(bytesOne)) != 0);
+	}
+}
+
+// Microbenchmark, hidden from normal runs. Run with: UnitTest "[.benchmark]"
+TEST_CASE("Websocket Mask Key Generation", "[.benchmark],[mask]")
+{
+	const size_t repetitions = 10000000;
+	uint8_t mask[4];
+	uint32_t combined = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < repetitions; i++)
+	{
+		generateMaskKey(mask);
+		combined ^= mask[0] | (mask[3] << 8);
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "Mask key: " << elapsed.count() / repetitions << " ns\n";
+	CHECK(combined != 0x10000);	// keep the work from being optimised away
+}
+
+// Microbenchmark, hidden from normal runs. Run with: UnitTest "[.benchmark]"
+TEST_CASE("Websocket Mask Throughput", "[.benchmark],[mask]")
+{
+	const uint8_t mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+	const size_t payloadSize = 64 * 1024;	// typical large client upload
+	const size_t repetitions = 20000;
+	std::vector<uint8_t> buffer(payloadSize + 1, 0x5a);
+
+	for (MaskKernel kernel : ALL_KERNELS)
+	{
+		if (!isMaskKernelSupported(kernel))
+		{
+			continue;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < repetitions; i++)
+		{
+			applyWebsocketMask(buffer.data() + 1, buffer.data() + 1, payloadSize, mask, i, kernel);	// in place, unaligned
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		double gigabytesPerSecond = payloadSize * static_cast<double>(repetitions) / elapsed.count() / 1e9;
+		std::cout << KERNEL_NAMES[static_cast<int>(kernel)] << ": " << gigabytesPerSecond << " GB/s per core\n";
+		CHECK(buffer[payloadSize / 2] != 0);	// keep the work from being optimised away
+	}
+}
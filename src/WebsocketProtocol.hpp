@@ -11,66 +11,162 @@
 #define AMS_WEBSOCKET_PROTOCOL_HPP
 
 #include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <string_view>
 #include "Log.hpp"
 #include "ProtocolBase.hpp"
 #include "HelperFunctions.hpp"
-#include "SHA-1.hpp"
+#include "WebsocketAcceptKey.hpp"
 #include "WebsocketFrame.hpp"
+#include "WebsocketDeflate.hpp"
+#include "WebsocketSession.hpp"
+#include "TopicHistory.hpp"
 
 using std::string;
 using std::function;
 
 namespace ams
 {
+	/// How the server checks that quiet websocket clients are still there
+	struct HeartbeatSettings
+	{
+		std::chrono::milliseconds interval{ 30000 };	/// how long a connection may be quiet before it is pinged, 0 to disable
+		unsigned int maxMissed = 2;	/// pings in a row that may go unanswered before the connection is closed
+	};
+
+	/// Callbacks for the connections that agreed on one subprotocol. Any left empty fall back to the protocol's own
+	struct SubprotocolHandlers
+	{
+		function<void(ProtocolBase * protocol, Connection & connection)> onConnect;
+		function<void(ProtocolBase * protocol, Connection & connection, const string & data)> onReceive;
+		function<void(ProtocolBase * protocol, Connection & connection, const uint8_t * data, size_t size)> onReceiveBinary;
+		function<void(ProtocolBase * protocol, Connection & connection)> onDisconnect;
+	};
+
+	/// Pick the subprotocol for a connection from the ones a client offers
+	/// @param offers Value of the client's Sec-WebSocket-Protocol header, names separated by commas, most preferred first
+	/// @param isSupported Called with each name, returns if this end accepts it
+	/// @return The first name accepted, empty if none were
+	template <typename Predicate>
+	std::string_view chooseSubprotocol(std::string_view offers, Predicate isSupported)
+	{
+		while (!offers.empty())
+		{
+			size_t end = offers.find(',');
+			std::string_view offer = deflateDetail::trim(offers.substr(0, end));
+			offers = end == std::string_view::npos ? std::string_view() : offers.substr(end + 1);
+			if (!offer.empty() && isSupported(offer))
+			{
+				return offer;
+			}
+		}
+		return std::string_view();
+	}
+
 	/// @brief Implementation of protocol to handle websockets
 	/// Used for 2-way communication with webpage
 	class WebsocketProtocol : public ProtocolBase
 	{
 	public:
 		/// Default Constructor
-		WebsocketProtocol() : ProtocolBase(30), onConnect(nullptr), onDisconnect(nullptr), onReceive(nullptr) {}
+		/// Websocket clients may stay quiet for as long as they like, so there is no idle limit.
+		/// Instead quiet clients are pinged, and closed if they stop answering
+		WebsocketProtocol() : WebsocketProtocol(false) {}
 
 		/// Destructor
 		virtual ~WebsocketProtocol() {}
 
+	protected:
+		/// Constructor
+		/// @param isClientSide If this end opened the connections, so frames it sends are masked and frames it receives aren't
+		explicit WebsocketProtocol(const bool isClientSide) : ProtocolBase(0), onConnect(nullptr), onDisconnect(nullptr), onReceive(nullptr), onReceiveBinary(nullptr), onReceiveFragment(nullptr), onDrainCallback(nullptr), isClientSide(isClientSide)
+		{
+			resetSharedDeflate();
+
+			OutboundLimits limits;
+			limits.maxQueuedBytes = 8 * 1024 * 1024;
+			limits.drainedBytes = 1024 * 1024;
+			setOutboundLimits(limits);
+		}
+
+	public:
 		/// Add an existing connection to this pool
 		/// @param connection Existing connection that will become part of this pool
 		/// @param data Any data that was received by the socket but not processed yet
 		virtual void addConnection(Connection connection, const string & data) override
 		{
-			if (isRoomForNewConnection())
+			if (isOverloaded())	// refuse new upgrades so existing clients keep their latency
+			{
+				countShed();
+				sendRefusal(connection, getServiceUnavailableResponse());
+				CLOSE_SOCKET(connection.sock);
+			}
+			else if (isRoomForNewConnection())
 			{
 				// validate websocket
 
-				// get the client's key
-				string validationKey = readVariableFromString("Sec-WebSocket-Key:", data);
-				if (!validationKey.empty())
+				// get the client's key, 16 bytes in base64 (RFC 6455 section 4.2.1)
+				std::string_view validationKey = readHeaderFromView("Sec-WebSocket-Key", data);
+				if (validationKey.length() == WEBSOCKET_KEY_LENGTH)
 				{
-					// concantinate magic string
-					string magic = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";	// defined in RFC 6455
+					// accept compression if the client offers it
+					DeflateParameters deflateParameters;
+					DeflateSettings settings = deflateSettings;
+					if (getOutboundLimits().policy != OverflowPolicy::DISCONNECT)	// dropped messages would break a compression context
+					{
+						settings.serverNoContextTakeover = true;
+					}
+					bool isCompressed = negotiateDeflate(readHeaderList("Sec-WebSocket-Extensions", data), settings, deflateParameters);
 
-					// hash and encode
-					SHA1 hash;
-					string acceptKey = hash.hashStringAndGetBase64(validationKey + magic);
-					string response = "HTTP/1.1 101 Switching Protocols\nUpgrade: websocket\nConnection: Upgrade\nSec-WebSocket-Accept: " + acceptKey + "\r\n\r\n";
+					// the first subprotocol the client lists that has been added, if any
+					const std::pair<const string, SubprotocolHandlers> * subprotocol = nullptr;
+					if (!subprotocols.empty())
+					{
+						chooseSubprotocol(readHeaderList("Sec-WebSocket-Protocol", data), [this, &subprotocol](std::string_view name)
+						{
+							subprotocol = findSubprotocol(name);
+							return subprotocol != nullptr;
+						});
+					}
+
+					// the answer is built on the stack with the accept key hashed straight into it
+					static const char SWITCHING[] = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ";
+					char response[512];	// longest answer is under 400 bytes, with every deflate parameter and the longest subprotocol name
+					size_t length = sizeof(SWITCHING) - 1;
+					memcpy(response, SWITCHING, length);
+					writeWebsocketAcceptKey(validationKey.data(), response + length);
+					length += WEBSOCKET_ACCEPT_LENGTH;
+					if (isCompressed)
+					{
+						string extensions = "\r\nSec-WebSocket-Extensions: " + formatDeflateResponse(deflateParameters);
+						memcpy(response + length, extensions.data(), extensions.length());
+						length += extensions.length();
+					}
+					if (subprotocol != nullptr)
+					{
+						static const char PROTOCOL[] = "\r\nSec-WebSocket-Protocol: ";
+						memcpy(response + length, PROTOCOL, sizeof(PROTOCOL) - 1);
+						length += sizeof(PROTOCOL) - 1;
+						memcpy(response + length, subprotocol->first.data(), subprotocol->first.length());
+						length += subprotocol->first.length();
+					}
+					memcpy(response + length, "\r\n\r\n", 4);
+					length += 4;
 
 					// return to client
-					ProtocolBase::sendData(connection, response);
+					sendBuffer(connection, response, length);
 
 					// remember this connection
-					connections.push_back(connection);
-					FD_SET(connection.sock, &receivingSockets);
-
-					if (onConnect != nullptr)
-					{
-						onConnect(this, connection);
-					}
+					connection.pendingData.clear();	// the handshake has been handled
+					Connection & stored = storeConnection(connection);
+					openSession(stored, isCompressed ? std::make_unique<DeflateContext>(deflateParameters) : nullptr, subprotocol);
 				}
 				else // invalid connection attempt
 				{
 					// send error to client
 					string response = "HTTP/1.1 400 Bad Request\r\n\r\n";
-					ProtocolBase::sendData(connection, response);
+					sendRefusal(connection, response);
 					// close connection
 					closeConnection(connection);
 				}
@@ -87,27 +183,259 @@ namespace ams
 		/// @param data The encoded data to send to the client websocket
 		virtual const void sendData(Connection & connection, const string & data) override
 		{
-			string encoded = writeToWebsocketFrame(data, WebsocketOpCodes::TEXT);
-			ProtocolBase::sendData(connection, encoded);
+			sendMessage(connection, data.data(), data.length(), WebsocketOpCodes::TEXT);
 		}
 
 		/// Send encoded data to all websockets
 		/// @param data The encoded data to be broadcast
 		virtual void const broadcast(const string & data) override
 		{
-			string encoded = writeToWebsocketFrame(data, WebsocketOpCodes::TEXT);
-			ProtocolBase::broadcast(encoded);
+			broadcastMessage(data.data(), data.length(), WebsocketOpCodes::TEXT);
+		}
+
+		/// Send a text message to a websocket without copying it into a string first
+		/// @param connection Which client to transmit to
+		/// @param text The text to send
+		void sendText(Connection & connection, const std::string_view text)
+		{
+			sendMessage(connection, text.data(), text.length(), WebsocketOpCodes::TEXT);
+		}
+
+		/// Send a binary message to a websocket
+		/// @param connection Which client to transmit to
+		/// @param data Pointer to the bytes to send
+		/// @param size Number of bytes to send
+		void sendBinary(Connection & connection, const uint8_t * data, const size_t size)
+		{
+			sendMessage(connection, reinterpret_cast<const char*>(data), size, WebsocketOpCodes::BINARY);
+		}
+
+		/// Start a message that is written in place rather than copied in, see sendFrame
+		/// @param expectedSize Payload size expected, so the right room is left for the header
+		/// @return A builder to write the payload into
+		WebsocketFrameBuilder startFrame(const size_t expectedSize = SIZE_MAX) const
+		{
+			return WebsocketFrameBuilder(expectedSize, isClientSide);
+		}
+
+		/// Send a message that was written in place. The frame takes over the builder's buffer,
+		/// so the payload isn't copied unless it has to be compressed
+		/// @param connection Which client to transmit to
+		/// @param builder Holds the payload, empty afterwards
+		/// @param opCode TEXT or BINARY
+		void sendFrame(Connection & connection, WebsocketFrameBuilder & builder, const WebsocketOpCodes opCode)
+		{
+			size_t size = builder.getPayloadLength();
+			SharedBuffer frame = std::make_shared<const string>(builder.finish(opCode, true, isClientSide));	// masked in place on the client side
+			if (!isClientSide)	// it is the message's plain frame, compression reads the payload from it
+			{
+				OutgoingMessage message{ frame->data() + frame->length() - size, size, opCode, 0, frame };
+				frame = getFrame(connection, message);
+			}
+			else
+			{
+				auto session = sessions.find(connection.sock);
+				if (session != sessions.end() && session->second.isCloseSent)	// no data may follow a close frame
+				{
+					frame = nullptr;
+				}
+			}
+
+			if (frame != nullptr)
+			{
+				sendSharedBuffer(connection, frame);
+			}
+		}
+
+		/// Send a text message to all websockets without copying it into a string first
+		/// @param text The text to broadcast
+		void broadcastText(const std::string_view text)
+		{
+			broadcastMessage(text.data(), text.length(), WebsocketOpCodes::TEXT);
+		}
+
+		/// Send a binary message to all websockets
+		/// @param data Pointer to the bytes to broadcast
+		/// @param size Number of bytes to broadcast
+		void broadcastBinary(const uint8_t * data, const size_t size)
+		{
+			broadcastMessage(reinterpret_cast<const char*>(data), size, WebsocketOpCodes::BINARY);
+		}
+
+		/// Add a connection to a topic, so it receives everything published to that topic
+		/// @param connection The connection to subscribe
+		/// @param topic Name of the topic, created if it doesn't exist yet
+		/// @return If the connection was subscribed, false if it isn't a websocket of this protocol
+		bool subscribe(Connection & connection, const string & topic)
+		{
+			auto session = sessions.find(connection.sock);
+			if (session == sessions.end())
+			{
+				return false;
+			}
+			session->second.topics.insert(topic);
+			topics[topic].insert(connection.sock);
+			return true;
+		}
+
+		/// Remove a connection from a topic
+		/// @param connection The connection to unsubscribe
+		/// @param topic Name of the topic, removed when its last member leaves
+		void unsubscribe(Connection & connection, const string & topic)
+		{
+			auto session = sessions.find(connection.sock);
+			if (session != sessions.end())
+			{
+				session->second.topics.erase(topic);
+			}
+			removeFromTopic(connection.sock, topic);
+		}
+
+		/// Send a text message to every connection subscribed to a topic.
+		/// The frame is encoded once and shared by all members.
+		/// With OverflowPolicy::COALESCE a slow member only keeps the latest message of each topic
+		/// @param topic Name of the topic
+		/// @param data The text to send
+		/// @return The message's sequence number if the topic keeps a history, otherwise 0
+		uint64_t publish(const string & topic, const std::string_view data)
+		{
+			OutgoingMessage message{ data.data(), data.length(), WebsocketOpCodes::TEXT, getTopicKey(topic) };
+			return publishMessage(topic, message);
+		}
+
+		/// Send a binary message to every connection subscribed to a topic
+		/// @param topic Name of the topic
+		/// @param data Pointer to the bytes to send
+		/// @param size Number of bytes to send
+		/// @return The message's sequence number if the topic keeps a history, otherwise 0
+		uint64_t publishBinary(const string & topic, const uint8_t * data, const size_t size)
+		{
+			OutgoingMessage message{ reinterpret_cast<const char*>(data), size, WebsocketOpCodes::BINARY, getTopicKey(topic) };
+			return publishMessage(topic, message);
+		}
+
+		/// Keep the most recent messages published to a topic, so clients that join late or reconnect can catch up with replay.
+		/// The history is kept whether or not the topic has members. Only the server side keeps histories,
+		/// a client masks every frame differently so there is nothing to store
+		/// @param topic Name of the topic
+		/// @param capacity Number of messages kept, 0 to stop keeping them
+		/// @param filePath File the messages are also written to so they survive a restart, empty to keep them in memory only
+		/// @return If the history is kept. False if the file couldn't be used, the history is then kept in memory only
+		bool keepHistory(const string & topic, const size_t capacity, const string & filePath = "")
+		{
+			histories.erase(topic);
+			if (capacity == 0 || isClientSide)
+			{
+				return false;
+			}
+			TopicHistory & history = histories.try_emplace(topic, capacity).first->second;
+			return filePath.empty() || history.mapFile(filePath);
+		}
+
+		/// Queue the messages of a topic that a connection missed, straight from the stored frames
+		/// @param connection The connection to catch up, usually just subscribed
+		/// @param topic Name of the topic
+		/// @param lastSequence The last sequence number the client received, 0 for every message kept
+		/// @return Number of messages queued. If the client's last message is older than getOldestSequence, some were already dropped
+		size_t replay(Connection & connection, const string & topic, const uint64_t lastSequence = 0)
+		{
+			auto history = histories.find(topic);
+			auto session = sessions.find(connection.sock);
+			if (history == histories.end() || session == sessions.end() || session->second.isCloseSent)
+			{
+				return 0;
+			}
+			return history->second.forEachAfter(lastSequence, [&](const SharedBuffer & frame) { queueFrames(connection, frame); });
+		}
+
+		/// @param topic Name of the topic
+		/// @return Sequence number the topic's next message will get, 0 if the topic doesn't keep a history
+		uint64_t getNextSequence(const string & topic) const
+		{
+			auto history = histories.find(topic);
+			return history == histories.end() ? 0 : history->second.getNextSequence();
+		}
+
+		/// @param topic Name of the topic
+		/// @return Sequence number of the oldest message the topic's history still has, 0 if the topic doesn't keep a history
+		uint64_t getOldestSequence(const string & topic) const
+		{
+			auto history = histories.find(topic);
+			return history == histories.end() ? 0 : history->second.getOldestSequence();
+		}
+
+		/// @param topic Name of the topic
+		/// @return Number of connections subscribed to the topic
+		size_t getSubscriberCount(const string & topic) const
+		{
+			auto members = topics.find(topic);
+			return members == topics.end() ? 0 : members->second.size();
+		}
+
+		/// Close a connection with the websocket close handshake.
+		/// No more data is sent, and the connection closes when the client answers or after CLOSE_TIMEOUT
+		/// @param connection The connection to close
+		/// @param code Status code telling the client why
+		/// @param reason Human readable reason, at most 123 bytes are sent
+		void close(Connection & connection, const uint16_t code = WebsocketCloseCodes::NORMAL_CLOSURE, const string & reason = "")
+		{
+			auto session = sessions.find(connection.sock);
+			if (session != sessions.end() && !session->second.isCloseSent)
+			{
+				sendClose(connection, session->second, code, reason, false);	// after whatever was sent before it
+			}
+		}
+
+		/// Stop accepting websockets and tell every client the server is going away
+		void beginShutdown() override
+		{
+			ProtocolBase::beginShutdown();
+			for (auto & connection : connections)
+			{
+				close(connection, WebsocketCloseCodes::GOING_AWAY, "Server shutting down");
+			}
 		}
 
 		/// Sever the connection to client and remove it's connection from the protocol
 		/// @param connection The connection of the client to remove
 		virtual void closeConnection(Connection & connection) override
 		{
-			if (onDisconnect != nullptr)
+			SOCKET sock = connection.sock;	// the callback can add or remove connections, which moves this one
+			if (sock == dispatchingSocket)
+			{
+				isDispatchClosed = true;	// stop processing the rest of its data
+			}
+			bool isStored = findConnection(sock) != nullptr;
+			auto session = sessions.find(sock);
+			const SubprotocolHandlers * handlers = session == sessions.end() ? nullptr : session->second.handlers;
+			auto & disconnect = handlers != nullptr && handlers->onDisconnect != nullptr ? handlers->onDisconnect : onDisconnect;
+			if (disconnect != nullptr)
+			{
+				disconnect(this, connection);
+			}
+			session = sessions.find(sock);	// the callback may have changed the map
+			if (session != sessions.end())
+			{
+				if (session->second.isCloseSent)
+				{
+					pendingCloses--;
+				}
+				for (const string & topic : session->second.topics)
+				{
+					removeFromTopic(sock, topic);
+				}
+				sessions.erase(session);
+			}
+
+			Connection * stored = findConnection(sock);
+			if (stored != nullptr)
 			{
-				onDisconnect(this, connection);
+				ProtocolBase::closeConnection(*stored);
+			}
+			else if (!isStored)	// never stored, such as a refused handshake
+			{
+				ProtocolBase::closeConnection(connection);
 			}
-			ProtocolBase::closeConnection(connection);
 		}
 
 		/// Set a function to be called when a new connection is made
@@ -124,6 +452,69 @@ namespace ams
 			onReceive = callback;
 		}
 
+		/// Set a function to be called when a connection receives a binary message
+		/// @param callback The function to set
+		void setOnReceiveBinary(function<void(ProtocolBase * protocol, Connection & connection, const uint8_t * data, size_t size)> callback)
+		{
+			onReceiveBinary = callback;
+		}
+
+		/// Stream data messages instead of reassembling them.
+		/// When set, each data frame is passed on as it arrives and onReceive is no longer called,
+		/// so large fragmented messages never need to be held in memory
+		/// @param callback The function to set, nullptr to go back to whole messages
+		void setOnReceiveFragment(function<void(ProtocolBase * protocol, Connection & connection, const string & fragment, bool isBinary, bool isFinal)> callback)
+		{
+			onReceiveFragment = callback;
+		}
+
+		/// Limit the size of a reassembled message. Larger messages close the connection with 1009 Message Too Big.
+		/// In streaming mode the limit applies to each frame instead
+		/// @param size The largest message accepted, in bytes
+		void setMaxMessageSize(const uint64_t size)
+		{
+			maxMessageSize = size;
+		}
+
+		/// Split large messages into fragments, so pings, pongs and close frames can be sent between them
+		/// instead of waiting for a whole large message to be written
+		/// @param size Largest payload of a data frame, 0 to send every message as one frame
+		void setFragmentSize(const size_t size)
+		{
+			fragmentSize = size;
+		}
+
+		/// Change how messages are compressed. Applies to connections made after the change
+		/// @param settings The new settings
+		void setDeflateSettings(const DeflateSettings & settings)
+		{
+			deflateSettings = settings;
+			resetSharedDeflate();
+		}
+
+		/// Change how quiet connections are checked
+		/// @param settings The new settings
+		void setHeartbeatSettings(const HeartbeatSettings & settings)
+		{
+			heartbeatSettings = settings;
+		}
+
+		/// Get the time a connection took to answer its last heartbeat ping
+		/// @param connection The connection to check
+		/// @return The round trip time, 0 if no ping has been answered yet
+		std::chrono::microseconds getRoundTripTime(const Connection & connection) const
+		{
+			auto session = sessions.find(connection.sock);
+			return session == sessions.end() ? std::chrono::microseconds{ 0 } : session->second.roundTripTime;
+		}
+
+		/// Set a function to be called when a connection that couldn't send (see canSend) has room again
+		/// @param callback The function to set
+		void setOnDrain(function<void(ProtocolBase * protocol, Connection & connection)> callback)
+		{
+			onDrainCallback = callback;
+		}
+
 		/// Set a function to be called when a connection is terminated
 		/// @param callback The function to be set
 		void setOnDisconnect(function<void(ProtocolBase * protocol, Connection & connection)> callback)
@@ -131,6 +522,44 @@ namespace ams
 			onDisconnect = callback;
 		}
 
+		/// Accept a subprotocol (such as "chat.v1") in the handshake, with its own callbacks.
+		/// A client gets the first subprotocol it lists that has been added, or none if it lists none of them.
+		/// A client end offers every subprotocol added, in the order they were added
+		/// @param name The name clients ask for, a token of up to MAX_SUBPROTOCOL_LENGTH characters
+		/// @param handlers Callbacks for the connections that agree on it, empty ones fall back to the protocol's own
+		/// @return If the name is valid. Adding a name again replaces its callbacks
+		bool addSubprotocol(const string & name, const SubprotocolHandlers & handlers = SubprotocolHandlers())
+		{
+			if (name.empty() || name.length() > MAX_SUBPROTOCOL_LENGTH
+				|| name.find_first_not_of("!#$%&'*+-.^_`|~0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz") != string::npos)	// an HTTP token (RFC 6455 section 4.1)
+			{
+				return false;
+			}
+
+			auto added = subprotocols.emplace(name, handlers);
+			if (added.second)
+			{
+				subprotocolOffer += (subprotocolOffer.empty() ? "" : ", ") + name;
+			}
+			else
+			{
+				added.first->second = handlers;	// in place, connections already using it keep pointing at it
+			}
+			return true;
+		}
+
+		/// Get the subprotocol a connection agreed on in its handshake
+		/// @param connection The connection to check
+		/// @return The subprotocol's name, empty if there is none
+		const string & getSubprotocol(const Connection & connection) const
+		{
+			static const string NONE;
+			auto session = sessions.find(connection.sock);
+			return session == sessions.end() || session->second.subprotocol == nullptr ? NONE : *session->second.subprotocol;
+		}
+
+		static const size_t MAX_SUBPROTOCOL_LENGTH = 64;	/// longest subprotocol name, keeps the handshake answer on the stack
+
 	protected:
 
 		/// Process data received from socket.
@@ -138,35 +567,685 @@ namespace ams
 		/// @param data String containing data received by connection 
 		void receiveData(Connection & connection, const string & data) override
 		{
-			switch (getWebsocketFrameOp(data))
+			// a read can hold part of a frame or several frames, so decode from the connection's buffer
+			const string * buffer = &data;
+			if (!connection.pendingData.empty())
 			{
-				case WebsocketOpCodes::CLOSE:
+				connection.pendingData += data;
+				buffer = &connection.pendingData;
+			}
+
+			auto session = sessions.find(connection.sock);
+			if (session == sessions.end())	// not a websocket connection
+			{
+				closeConnection(connection);
+				return;
+			}
+			WebsocketSession & state = session->second;	// references stay valid if the map changes
+			state.lastReceived = std::chrono::steady_clock::now();
+
+			SOCKET sock = connection.sock;
+			Connection * current = &connection;	// callbacks can add or remove connections, which moves this one
+			size_t position = 0;
+			WebsocketFrame frame;
+			for (;;)
+			{
+				size_t bytesConsumed;
+				WebsocketFrameStatus status = readWebsocketFrame(buffer->data() + position, buffer->length() - position, frame, bytesConsumed, maxMessageSize);
+				if (status == WebsocketFrameStatus::INCOMPLETE)
 				{
-					gaf::util::Log::debug("Websocket: Close message received");
-					closeConnection(connection);
 					break;
 				}
 
-				case WebsocketOpCodes::TEXT:
+				if (status == WebsocketFrameStatus::TOO_LARGE)	// a single frame over the limit, the usual way a large message arrives
 				{
-					if (onReceive != nullptr)
+					failConnection(*current, state, WebsocketCloseCodes::MESSAGE_TOO_BIG, "message too large");
+					return;
+				}
+				if (status == WebsocketFrameStatus::INVALID || frame.header.isMasked != !isClientSide || !isReservedBitsValid(state, frame.header))	// clients must mask, servers must not
+				{
+					failConnection(*current, state, WebsocketCloseCodes::PROTOCOL_ERROR, "invalid frame");
+					return;
+				}
+
+				position += bytesConsumed;
+				if (!handleFrame(*current, state, frame))	// connection was closed
+				{
+					return;
+				}
+
+				current = findConnection(sock);
+				if (current == nullptr)
+				{
+					return;
+				}
+				if (buffer != &data)
+				{
+					buffer = &current->pendingData;
+				}
+			}
+
+			// keep any partial frame until the rest arrives
+			if (buffer == &current->pendingData)
+			{
+				current->pendingData.erase(0, position);
+			}
+			else if (position < data.length())
+			{
+				current->pendingData.assign(data, position, string::npos);
+			}
+			current->setPhase(current->pendingData.empty() ? Connection::Phase::IDLE : Connection::Phase::READING_BODY);
+		}
+
+		/// Start treating a connection as a websocket once its handshake has completed
+		/// @param connection The stored connection
+		/// @param deflate Compression state if it was negotiated, otherwise nullptr
+		/// @param subprotocol The subprotocol agreed in the handshake and its callbacks, nullptr if none
+		void openSession(Connection & connection, std::unique_ptr<DeflateContext> deflate, const std::pair<const string, SubprotocolHandlers> * subprotocol)
+		{
+			connection.setPhase(Connection::Phase::IDLE);
+			WebsocketSession & session = sessions[connection.sock];
+			session = WebsocketSession();
+			session.lastReceived = std::chrono::steady_clock::now();
+			session.deflate = std::move(deflate);
+			if (subprotocol != nullptr)
+			{
+				session.subprotocol = &subprotocol->first;
+				session.handlers = &subprotocol->second;
+			}
+
+			auto & connect = session.handlers != nullptr && session.handlers->onConnect != nullptr ? session.handlers->onConnect : onConnect;
+			if (connect != nullptr)
+			{
+				connect(this, connection);	// the stored connection, so anything queued for it is sent
+			}
+		}
+
+		/// Find a subprotocol that has been added
+		/// @param name The subprotocol's name
+		/// @return The name and its callbacks, nullptr if it wasn't added
+		const std::pair<const string, SubprotocolHandlers> * findSubprotocol(const std::string_view name) const
+		{
+			auto subprotocol = subprotocols.find(string(name));
+			return subprotocol == subprotocols.end() ? nullptr : &*subprotocol;
+		}
+
+		/// @return The value of a client's Sec-WebSocket-Protocol header, empty if no subprotocols were added
+		const string & getSubprotocolOffer() const
+		{
+			return subprotocolOffer;
+		}
+
+		/// Run the close handshake timeouts and the heartbeat
+		/// @param now The current time
+		void onTimer(const std::chrono::steady_clock::time_point now) override
+		{
+			if (pendingCloses != 0)
+			{
+				closeUnansweredConnections(now);
+			}
+			sendHeartbeats(now);
+		}
+
+	private:
+		/// Close connections that didn't answer the server's close frame in time
+		/// @param now The current time
+		void closeUnansweredConnections(const std::chrono::steady_clock::time_point now)
+		{
+			expiredSockets.clear();
+			for (auto & session : sessions)
+			{
+				if (session.second.isCloseSent && now - session.second.closeSent > CLOSE_TIMEOUT)
+				{
+					expiredSockets.push_back(session.first);
+				}
+			}
+
+			for (SOCKET sock : expiredSockets)
+			{
+				Connection * connection = findConnection(sock);
+				if (connection != nullptr)
+				{
+					gaf::util::Log::debug("Websocket: close not answered, closing connection");
+					closeConnection(*connection);
+				}
+			}
+		}
+
+		/// Ping connections that have been quiet too long, and close those that stopped answering.
+		/// All connections pinged in one pass share the same ping frame
+		/// @param now The current time
+		void sendHeartbeats(const std::chrono::steady_clock::time_point now)
+		{
+			if (heartbeatSettings.interval.count() == 0 || now < nextHeartbeat)
+			{
+				return;
+			}
+			nextHeartbeat = now + heartbeatSettings.interval / HEARTBEAT_CHECKS_PER_INTERVAL;
+
+			SharedBuffer ping;	// built when the first connection needs it
+			string pingPayload = std::to_string(++heartbeatSequence);
+			expiredSockets.clear();
+			for (auto & connection : connections)
+			{
+				auto found = sessions.find(connection.sock);
+				if (found == sessions.end() || found->second.isCloseSent)	// still handshaking, or already closing
+				{
+					continue;
+				}
+				WebsocketSession & session = found->second;
+				if (session.isAwaitingPong && session.lastReceived > session.pingSent)	// other data arrived, the client is alive
+				{
+					session.isAwaitingPong = false;
+					session.missedHeartbeats = 0;
+				}
+
+				if (session.isAwaitingPong)
+				{
+					if (now - session.pingSent < heartbeatSettings.interval)
 					{
-						string msg = readFromWebsocketFrame(data);
-						if (onReceive != nullptr)
-						{
-							onReceive(this, connection, msg);
-						}
-						gaf::util::Log::debug("Websocket received message: " + msg);
+						continue;	// still time to answer
 					}
-					break;
+					if (++session.missedHeartbeats >= heartbeatSettings.maxMissed)
+					{
+						expiredSockets.push_back(connection.sock);
+						continue;
+					}
+				}
+				else if (now - session.lastReceived < heartbeatSettings.interval)
+				{
+					continue;	// recently active
 				}
+
+				if (ping == nullptr || isClientSide)	// a client masks every frame with its own key
+				{
+					ping = std::make_shared<const string>(writeToWebsocketFrame(pingPayload, WebsocketOpCodes::PING, true, isClientSide));
+				}
+				sendControlFrame(connection, ping);
+				session.isAwaitingPong = true;
+				session.pingSequence = heartbeatSequence;
+				session.pingSent = now;
+			}
+
+			for (SOCKET sock : expiredSockets)
+			{
+				Connection * connection = findConnection(sock);
+				if (connection != nullptr)
+				{
+					gaf::util::Log::debug("Websocket: heartbeat not answered, closing connection");
+					closeConnection(*connection);
+				}
+			}
+		}
+
+	protected:
+		/// Pass the drain on to the user
+		/// @param connection The connection that has room again
+		void onDrain(Connection & connection) override
+		{
+			if (onDrainCallback != nullptr)
+			{
+				onDrainCallback(this, connection);
 			}
 		}
 
 	private:
+		/// A message being sent, with its frames built the first time a recipient needs them
+		struct OutgoingMessage
+		{
+			const char * data;		/// the message
+			size_t size;			/// number of bytes
+			WebsocketOpCodes opCode;	/// TEXT or BINARY
+			uint64_t key;			/// identifies messages that supersede each other, 0 for none
+			SharedBuffer plainFrame;	/// uncompressed frame
+			SharedBuffer sharedCompressedFrame;	/// frame compressed once for every connection without context takeover
+		};
+
+		/// Check the reserved bits of a frame against the negotiated extensions
+		/// @param session Websocket state of the connection
+		/// @param header The frame's header
+		/// @return If the bits are allowed
+		static bool isReservedBitsValid(const WebsocketSession & session, const WebsocketFrameHeader & header)
+		{
+			if (header.reservedBits == 0)
+			{
+				return true;
+			}
+			// only the first frame of a compressed data message is marked
+			return header.reservedBits == DEFLATE_RESERVED_BIT && session.deflate != nullptr
+				&& (header.opCode == WebsocketOpCodes::TEXT || header.opCode == WebsocketOpCodes::BINARY);
+		}
+
+		/// Get the frame a connection should receive for a message, compressed if it was negotiated
+		/// @param connection The connection the frame is for
+		/// @param message The message, keeps frames that can be shared with other connections
+		/// @return The encoded frame, nullptr if nothing may be sent to the connection
+		SharedBuffer getFrame(const Connection & connection, OutgoingMessage & message)
+		{
+			auto session = sessions.find(connection.sock);
+			if (session != sessions.end() && session->second.isCloseSent)	// no data may follow a close frame
+			{
+				return nullptr;
+			}
+			if (isClientSide)	// a client masks every frame with its own key, so frames are never shared
+			{
+				return std::make_shared<const string>(writeToWebsocketFragments(message.data, message.size, message.opCode, fragmentSize, true));
+			}
+			DeflateContext * deflate = (session == sessions.end() || message.size < deflateSettings.minimumSize) ? nullptr : session->second.deflate.get();
+			if (deflate != nullptr)
+			{
+				const DeflateParameters & parameters = deflate->getParameters();
+				if (sharedDeflate != nullptr && parameters.serverNoContextTakeover
+					&& parameters.serverWindowBits >= sharedDeflate->getParameters().serverWindowBits)	// the client can decompress the shared frame
+				{
+					if (message.sharedCompressedFrame == nullptr)
+					{
+						message.sharedCompressedFrame = writeCompressedFrame(*sharedDeflate, message);
+					}
+					if (message.sharedCompressedFrame != nullptr)
+					{
+						return message.sharedCompressedFrame;
+					}
+				}
+				else
+				{
+					SharedBuffer frame = writeCompressedFrame(*deflate, message);
+					if (frame != nullptr)
+					{
+						return frame;
+					}
+				}
+			}
+
+			if (message.plainFrame == nullptr)
+			{
+				message.plainFrame = std::make_shared<const string>(writeToWebsocketFragments(message.data, message.size, message.opCode, fragmentSize));
+			}
+			return message.plainFrame;
+		}
+
+		/// Compress a message and encode it into a frame
+		/// @param deflate The compression state to use
+		/// @param message The message
+		/// @return The encoded frame, nullptr if compression failed
+		SharedBuffer writeCompressedFrame(DeflateContext & deflate, const OutgoingMessage & message)
+		{
+			if (!deflate.compress(message.data, message.size, compressionBuffer))
+			{
+				return nullptr;
+			}
+			string frame = writeToWebsocketFragments(compressionBuffer.data(), compressionBuffer.length(), message.opCode, fragmentSize);
+			frame[0] |= static_cast<char>(DEFLATE_RESERVED_BIT << 4);	// RSV1 on the first fragment marks the message as compressed
+			return std::make_shared<const string>(std::move(frame));
+		}
+
+		/// Send a message to one connection
+		/// @param connection Which client to transmit to
+		/// @param data The message
+		/// @param size Number of bytes
+		/// @param opCode TEXT or BINARY
+		void sendMessage(Connection & connection, const char * data, const size_t size, const WebsocketOpCodes opCode)
+		{
+			OutgoingMessage message{ data, size, opCode, 0 };
+			SharedBuffer frame = getFrame(connection, message);
+			if (frame != nullptr)
+			{
+				sendSharedBuffer(connection, frame, getWebsocketFragmentStride(*frame));
+			}
+		}
+
+		/// Answer a handshake that is refused. The connection is never stored and its socket is closed straight after,
+		/// so the answer is written to the socket rather than queued or held for write coalescing
+		/// @param connection The connection being refused
+		/// @param response The HTTP response
+		void sendRefusal(const Connection & connection, const string & response)
+		{
+			send(connection.sock, response.data(), static_cast<int>(response.length()), SEND_FLAGS);	// a short answer fits in the empty socket buffer
+		}
+
+		/// Queue an encoded message, letting control frames go between its fragments
+		/// @param connection Which client to transmit to
+		/// @param frames The message's frames
+		/// @param key Identifies messages that supersede each other, 0 for none
+		void queueFrames(Connection & connection, const SharedBuffer & frames, const uint64_t key = 0)
+		{
+			queueBuffer(connection, frames, key, getWebsocketFragmentStride(*frames));
+		}
+
+		/// Send a control frame ahead of any data queued for the connection, so heartbeats and the close handshake never wait behind a large message
+		/// @param connection Which client to transmit to
+		/// @param frame The encoded control frame
+		void sendControlFrame(Connection & connection, const SharedBuffer & frame)
+		{
+			sendPriorityBuffer(connection, frame);
+		}
+
+		/// Queue a message on every connection, encoding each kind of frame only once
+		/// @param data The message
+		/// @param size Number of bytes
+		/// @param opCode TEXT or BINARY
+		void broadcastMessage(const char * data, const size_t size, const WebsocketOpCodes opCode)
+		{
+			OutgoingMessage message{ data, size, opCode, 0 };
+			for (auto & connection : connections)
+			{
+				SharedBuffer frame = getFrame(connection, message);
+				if (frame != nullptr)
+				{
+					queueFrames(connection, frame);
+				}
+			}
+		}
+
+		/// Build the compressor shared by connections without context takeover
+		void resetSharedDeflate()
+		{
+			DeflateParameters parameters;
+			if (negotiateDeflate("permessage-deflate", deflateSettings, parameters))	// what a client without preferences gets
+			{
+				parameters.serverNoContextTakeover = true;
+				sharedDeflate = std::make_unique<DeflateContext>(parameters);
+			}
+			else
+			{
+				sharedDeflate.reset();
+			}
+		}
+
+		/// Act on a single decoded frame
+		/// @param connection Connection that received the frame
+		/// @param session Websocket state of the connection
+		/// @param frame The decoded frame
+		/// @return If the connection is still open
+		bool handleFrame(Connection & connection, WebsocketSession & session, WebsocketFrame & frame)
+		{
+			switch (frame.header.opCode)
+			{
+				case WebsocketOpCodes::CLOSE:
+				{
+					gaf::util::Log::debug("Websocket: Close message received");
+					uint16_t code;
+					string reason;
+					if (!readWebsocketClosePayload(frame.payload, code, reason))
+					{
+						failConnection(connection, session, WebsocketCloseCodes::PROTOCOL_ERROR, "invalid close frame");
+						return false;
+					}
+					if (!session.isCloseSent)	// the client started the handshake, answer it
+					{
+						sendClose(connection, session, code == WebsocketCloseCodes::NO_STATUS_RECEIVED ? WebsocketCloseCodes::NORMAL_CLOSURE : code, "", true);
+					}
+					closeWhenSent(connection);	// handshake complete, the server closes the TCP connection
+					return false;
+				}
+
+				case WebsocketOpCodes::PING:
+				{
+					if (!session.isCloseSent)
+					{
+						sendControlFrame(connection, std::make_shared<const string>(writeToWebsocketFrame(frame.payload, WebsocketOpCodes::PONG, true, isClientSide)));	// echo the ping's payload
+					}
+					return true;
+				}
+
+				case WebsocketOpCodes::PONG:
+				{
+					if (session.isAwaitingPong && frame.payload == std::to_string(session.pingSequence))	// unsolicited pongs are allowed and ignored
+					{
+						session.roundTripTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - session.pingSent);
+						session.isAwaitingPong = false;
+						session.missedHeartbeats = 0;
+					}
+					return true;
+				}
+
+				case WebsocketOpCodes::TEXT:
+				case WebsocketOpCodes::BINARY:
+				case WebsocketOpCodes::CONTINUATION:
+				{
+					return handleDataFrame(connection, session, frame);
+				}
+			}
+			return true;
+		}
+
+		/// Reassemble (or stream) the fragments of a data message
+		/// @param connection Connection that received the frame
+		/// @param session Websocket state of the connection
+		/// @param frame A TEXT, BINARY or CONTINUATION frame
+		/// @return If the connection is still open
+		bool handleDataFrame(Connection & connection, WebsocketSession & session, WebsocketFrame & frame)
+		{
+			bool isContinuation = frame.header.opCode == WebsocketOpCodes::CONTINUATION;
+			if (isContinuation != session.isReceivingMessage)	// continuation without a start, or a new message before the last finished
+			{
+				failConnection(connection, session, WebsocketCloseCodes::PROTOCOL_ERROR, "unexpected fragment");
+				return false;
+			}
+
+			session.isReceivingMessage = !frame.header.isFinal;	// kept while closing, the client may still finish a message
+			if (session.isCloseSent)	// closing, the rest of the data isn't wanted
+			{
+				return true;
+			}
+
+			if (!isContinuation)
+			{
+				session.messageOpCode = frame.header.opCode;
+				session.isCompressedMessage = frame.header.reservedBits == DEFLATE_RESERVED_BIT;
+				session.utf8.reset();
+			}
+
+			if (session.isCompressedMessage)
+			{
+				uint64_t limit = onReceiveFragment != nullptr ? maxMessageSize : maxMessageSize - session.message.length();
+				if (!session.deflate->decompress(frame.payload.data(), frame.payload.length(), frame.header.isFinal, decompressionBuffer, limit))
+				{
+					failConnection(connection, session, WebsocketCloseCodes::MESSAGE_TOO_BIG, "invalid or oversized compressed message");
+					return false;
+				}
+				frame.payload.swap(decompressionBuffer);
+			}
+
+			// checked per fragment while the payload is still in cache, so bad text is rejected before any of it is delivered
+			if (session.messageOpCode == WebsocketOpCodes::TEXT && !session.utf8.update(frame.payload.data(), frame.payload.length(), frame.header.isFinal))
+			{
+				failConnection(connection, session, WebsocketCloseCodes::INVALID_PAYLOAD, "invalid UTF-8 in text message");
+				return false;
+			}
+
+			if (onReceiveFragment != nullptr)	// streaming, pass each fragment straight on
+			{
+				return dispatch(connection, [&]() { onReceiveFragment(this, connection, frame.payload, session.messageOpCode == WebsocketOpCodes::BINARY, frame.header.isFinal); });
+			}
+
+			if (!isContinuation && frame.header.isFinal)	// unfragmented, no need to copy
+			{
+				return deliverMessage(connection, session, frame.payload);
+			}
+
+			if (session.message.length() + frame.payload.length() > maxMessageSize)
+			{
+				failConnection(connection, session, WebsocketCloseCodes::MESSAGE_TOO_BIG, "message too large");
+				return false;
+			}
+			session.message += frame.payload;
+
+			if (frame.header.isFinal)
+			{
+				string message = std::move(session.message);
+				session.message.clear();
+				return deliverMessage(connection, session, message);
+			}
+			return true;
+		}
+
+		/// Send a close frame, after which no more data is sent
+		/// @param connection The connection to close
+		/// @param session Websocket state of the connection
+		/// @param code Status code telling the client why
+		/// @param reason Human readable reason
+		/// @param isUrgent If data still queued isn't wanted, so it is dropped and the close frame goes out next. Otherwise the close frame follows it
+		void sendClose(Connection & connection, WebsocketSession & session, const uint16_t code, const string & reason, const bool isUrgent)
+		{
+			SharedBuffer frame = std::make_shared<const string>(writeToWebsocketFrame(writeWebsocketClosePayload(code, reason), WebsocketOpCodes::CLOSE, true, isClientSide));
+			if (isUrgent)
+			{
+				connection.outbound.dropUnstarted();	// data frames may not follow the close frame
+				sendControlFrame(connection, frame);
+			}
+			else
+			{
+				sendSharedBuffer(connection, frame);
+			}
+			session.isCloseSent = true;
+			session.closeSent = std::chrono::steady_clock::now();
+			pendingCloses++;
+		}
+
+		/// Close a connection that broke the protocol, telling the client why.
+		/// The client isn't waited for
+		/// @param connection The connection to close
+		/// @param session Websocket state of the connection
+		/// @param code Status code telling the client why
+		/// @param reason Human readable reason, also logged
+		void failConnection(Connection & connection, WebsocketSession & session, const uint16_t code, const string & reason)
+		{
+			gaf::util::Log::warning("Websocket: " + reason + ", closing connection");
+			if (!session.isCloseSent)
+			{
+				sendClose(connection, session, code, reason, true);
+			}
+			closeWhenSent(connection);
+		}
+
+		/// Pass a complete message on to the user
+		/// @param connection Connection that received the message
+		/// @param session Websocket state of the connection, which picks the callbacks
+		/// @param message The message data
+		/// @return If the connection is still open
+		bool deliverMessage(Connection & connection, const WebsocketSession & session, const string & message)
+		{
+			const SubprotocolHandlers * handlers = session.handlers;	// chosen in the handshake, nothing to look up per message
+			if (session.messageOpCode == WebsocketOpCodes::TEXT)
+			{
+				gaf::util::Log::debug("Websocket received message: " + message);
+				auto & receive = handlers != nullptr && handlers->onReceive != nullptr ? handlers->onReceive : onReceive;
+				if (receive != nullptr)
+				{
+					return dispatch(connection, [&]() { receive(this, connection, message); });
+				}
+			}
+			else if (session.messageOpCode == WebsocketOpCodes::BINARY)
+			{
+				auto & receiveBinary = handlers != nullptr && handlers->onReceiveBinary != nullptr ? handlers->onReceiveBinary : onReceiveBinary;
+				if (receiveBinary != nullptr)
+				{
+					return dispatch(connection, [&]() { receiveBinary(this, connection, reinterpret_cast<const uint8_t*>(message.data()), message.length()); });
+				}
+			}
+			return true;
+		}
+
+		/// Record a message in its topic's history and queue it on the topic's members
+		/// @param topic Name of the topic
+		/// @param message The message to send
+		/// @return The message's sequence number, 0 if the topic doesn't keep a history
+		uint64_t publishMessage(const string & topic, OutgoingMessage & message)
+		{
+			uint64_t sequence = 0;
+			auto history = histories.find(topic);
+			if (history != histories.end())	// stored uncompressed, any client can take it
+			{
+				if (message.plainFrame == nullptr)
+				{
+					message.plainFrame = std::make_shared<const string>(writeToWebsocketFragments(message.data, message.size, message.opCode, fragmentSize));
+				}
+				sequence = history->second.add(message.plainFrame);
+			}
+
+			auto members = topics.find(topic);
+			if (members == topics.end())
+			{
+				return sequence;
+			}
+			for (SOCKET sock : members->second)
+			{
+				Connection * connection = findConnection(sock);
+				SharedBuffer frame = connection == nullptr ? nullptr : getFrame(*connection, message);
+				if (frame != nullptr)
+				{
+					queueFrames(*connection, frame, message.key);
+				}
+			}
+			return sequence;
+		}
+
+		/// Get the key that lets a topic's messages supersede each other
+		/// @param topic Name of the topic
+		/// @return The key, never 0
+		static uint64_t getTopicKey(const string & topic)
+		{
+			return static_cast<uint64_t>(std::hash<string>()(topic)) | 1;
+		}
+
+		/// Remove a socket from a topic's members, dropping the topic when it becomes empty
+		/// @param sock The socket to remove
+		/// @param topic Name of the topic
+		void removeFromTopic(const SOCKET sock, const string & topic)
+		{
+			auto members = topics.find(topic);
+			if (members != topics.end())
+			{
+				members->second.erase(sock);
+				if (members->second.empty())
+				{
+					topics.erase(members);
+				}
+			}
+		}
+
+		/// Call a user function that might close the connection it was given
+		/// @param connection The connection passed to the function
+		/// @param callback Calls the user function
+		/// @return If the connection is still open
+		template <typename Callback>
+		bool dispatch(Connection & connection, Callback callback)
+		{
+			dispatchingSocket = connection.sock;
+			isDispatchClosed = false;
+			callback();
+			dispatchingSocket = INVALID_SOCKET;
+			return !isDispatchClosed;
+		}
+
 		function<void(ProtocolBase * protocol, Connection & connection)>onConnect;
 		function<void(ProtocolBase * protocol, Connection & connection)> onDisconnect;
 		function<void(ProtocolBase * protocol, Connection & connection, const string & data)> onReceive;
+		function<void(ProtocolBase * protocol, Connection & connection, const uint8_t * data, size_t size)> onReceiveBinary;
+		function<void(ProtocolBase * protocol, Connection & connection, const string & fragment, bool isBinary, bool isFinal)> onReceiveFragment;
+		function<void(ProtocolBase * protocol, Connection & connection)> onDrainCallback;
+		const bool isClientSide;	/// if this end opened the connections, and so masks what it sends
+		uint64_t maxMessageSize = 16 * 1024 * 1024;	/// largest message accepted from a client
+		size_t fragmentSize = 64 * 1024;	/// largest payload of a data frame sent, larger messages are fragmented
+		std::unordered_map<SOCKET, WebsocketSession> sessions;	/// websocket state of each connection
+		std::unordered_map<string, std::unordered_set<SOCKET>> topics;	/// members of each topic
+		std::unordered_map<string, TopicHistory> histories;	/// recent messages of the topics that keep them
+		std::unordered_map<string, SubprotocolHandlers> subprotocols;	/// callbacks of each subprotocol accepted, sessions point into it
+		string subprotocolOffer;	/// names of the subprotocols separated by commas, in the order they were added
+		DeflateSettings deflateSettings;	/// how messages are compressed
+		std::unique_ptr<DeflateContext> sharedDeflate;	/// compresses messages shared by several connections
+		string compressionBuffer;	/// scratch space for compressed messages, kept to avoid allocations
+		string decompressionBuffer;	/// scratch space for decompressed frames, kept to avoid allocations
+		HeartbeatSettings heartbeatSettings;	/// when quiet connections are pinged
+		static constexpr int HEARTBEAT_CHECKS_PER_INTERVAL = 4;	/// how often per interval connections are checked, sets the accuracy of the heartbeat
+		std::chrono::steady_clock::time_point nextHeartbeat;	/// when connections are next checked
+		uint64_t heartbeatSequence = 0;	/// identifies the pings sent in each check
+		std::vector<SOCKET> expiredSockets;	/// scratch list of connections to close, kept to avoid allocations
+		static constexpr std::chrono::seconds CLOSE_TIMEOUT{ 5 };	/// how long a client has to answer the server's close frame
+		size_t pendingCloses = 0;	/// connections waiting for the client's close frame
+		SOCKET dispatchingSocket = INVALID_SOCKET;	/// connection currently handed to a user function
+		bool isDispatchClosed = false;	/// if that connection was closed by the user function
 	};
 }
 
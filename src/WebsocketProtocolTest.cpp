@@ -0,0 +1,433 @@
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../test/catch.hpp"
+#include "Server.hpp"
+#include "ThreadedServer.hpp"
+#include "HttpProtocol.hpp"
+#include "WebsocketProtocol.hpp"
+
+using namespace ams;
+
+namespace
+{
+	/// Run the loop until a condition is met or a second has passed
+	template <typename Condition>
+	bool loopUntil(Server & server, Condition condition)
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+		while (!condition() && std::chrono::steady_clock::now() < deadline)
+		{
+			server.loop();
+		}
+		return condition();
+	}
+
+	/// Wait for a condition while a server runs on its own thread, at most a second
+	template <typename Condition>
+	bool waitUntil(Condition condition)
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+		while (!condition() && std::chrono::steady_clock::now() < deadline)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return condition();
+	}
+
+	const char HANDSHAKE[] = "GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+
+	/// A bare TCP client, so tests can send exactly the bytes they want
+	class RawClient
+	{
+	public:
+		/// Connect to a port on this machine
+		explicit RawClient(const unsigned int port) : sock(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP))
+		{
+			sockaddr_in address{};
+			address.sin_family = AF_INET;
+			address.sin_port = htons(static_cast<uint16_t>(port));
+			address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			::connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address));	// the listener's backlog accepts it before the loop runs
+			SET_NON_BLOCKING(sock);	// the loop runs on this thread, reading must not wait for it
+		}
+
+		~RawClient()
+		{
+			CLOSE_SOCKET(sock);
+		}
+
+		RawClient(const RawClient &) = delete;
+		RawClient & operator = (const RawClient &) = delete;
+
+		/// Send bytes to the server
+		void send(const std::string & data)
+		{
+			::send(sock, data.data(), static_cast<int>(data.length()), SEND_FLAGS);
+		}
+
+		/// Move whatever has arrived into received
+		/// @return If the server closed the connection
+		bool read()
+		{
+			char buffer[4096];
+			for (;;)
+			{
+				SSIZE_T count = recv(sock, buffer, sizeof(buffer), 0);
+				if (count <= 0)
+				{
+					return count == 0;
+				}
+				received.append(buffer, static_cast<size_t>(count));
+			}
+		}
+
+		/// Check if the server answered the websocket handshake, removing the answer so only frames are left
+		bool isHandshakeAnswered()
+		{
+			read();
+			size_t end = received.find("\r\n\r\n");
+			if (!isUpgraded && end != std::string::npos && received.compare(0, 12, "HTTP/1.1 101") == 0)
+			{
+				received.erase(0, end + 4);
+				isUpgraded = true;
+			}
+			return isUpgraded;
+		}
+
+		/// Send a masked frame, as a client must
+		void sendFrame(const std::string & payload, const WebsocketOpCodes opCode, const bool isFinal = true)
+		{
+			send(writeToWebsocketFrame(payload, opCode, isFinal, true));
+		}
+
+		/// @return The complete frames received after the handshake
+		std::vector<WebsocketFrame> getFrames() const
+		{
+			std::vector<WebsocketFrame> frames;
+			size_t position = 0;
+			WebsocketFrame frame;
+			size_t consumed;
+			while (readWebsocketFrame(received.data() + position, received.length() - position, frame, consumed) == WebsocketFrameStatus::COMPLETE)
+			{
+				frames.push_back(frame);
+				position += consumed;
+			}
+			return frames;
+		}
+
+		/// @return The status code of the close frame received, 0 if there was none
+		uint16_t getCloseCode() const
+		{
+			for (const WebsocketFrame & frame : getFrames())
+			{
+				uint16_t code;
+				std::string reason;
+				if (frame.header.opCode == WebsocketOpCodes::CLOSE && readWebsocketClosePayload(frame.payload, code, reason))
+				{
+					return code;
+				}
+			}
+			return 0;
+		}
+
+		std::string received;	/// everything the server sent so far
+
+	private:
+		SOCKET sock;
+		bool isUpgraded = false;	/// if the handshake answer was received and removed
+	};
+}
+
+// one case per port, a listening port can't be bound again straight away
+TEST_CASE("Websocket Refused Handshakes", "[websocket]")
+{
+	const unsigned int port = 8644;
+	Server server;
+	HttpProtocol http(port);
+	WebsocketProtocol websocket;
+	http.addUpgradeProtocol("websocket", &websocket);
+	server.addProtocol(&http);
+	server.addProtocol(&websocket);
+
+	WriteCoalescing coalescing;
+	coalescing.isEnabled = true;	// the answers are small enough to be held
+	websocket.setWriteCoalescing(coalescing);
+
+	// no key
+	RawClient invalid(port);
+	invalid.send("GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\n");
+	REQUIRE(loopUntil(server, [&]() { return invalid.read(); }));
+	REQUIRE(invalid.received == "HTTP/1.1 400 Bad Request\r\n\r\n");
+	REQUIRE(websocket.isDrained());
+
+	// shutting down, the answer is built when the limits are set
+	AdmissionLimits limits;
+	limits.retryAfterSeconds = 5;
+	websocket.setAdmissionLimits(limits);
+	websocket.beginShutdown();
+	RawClient refused(port);
+	refused.send("GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n");
+	REQUIRE(loopUntil(server, [&]() { return refused.read(); }));
+	REQUIRE(refused.received == "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 5\r\nContent-Length: 0\r\n\r\n");
+	REQUIRE(websocket.getShedCount() == 1);
+}
+
+TEST_CASE("Websocket Handshake Headers", "[websocket]")
+{
+	const unsigned int port = 8651;
+	Server server;
+	HttpProtocol http(port);
+	WebsocketProtocol websocket;
+	http.addUpgradeProtocol("websocket", &websocket);
+	server.addProtocol(&http);
+	server.addProtocol(&websocket);
+	REQUIRE(websocket.addSubprotocol("chat"));
+	REQUIRE(websocket.addSubprotocol("telemetry"));
+
+	// names in any case, lists split over several lines, and a header name inside another header's value is ignored
+	RawClient client(port);
+	client.send("GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nsec-websocket-key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		"sec-websocket-protocol: other\r\nSec-WebSocket-Protocol: chat\r\nX-Note: Sec-WebSocket-Protocol: telemetry\r\n"
+		"sec-websocket-extensions: x-unknown\r\nSec-WebSocket-Extensions: permessage-deflate\r\nSec-WebSocket-Version: 13\r\n\r\n");
+	REQUIRE(loopUntil(server, [&]() { client.read(); return client.received.find("\r\n\r\n") != std::string::npos; }));
+	REQUIRE(client.received.compare(0, 12, "HTTP/1.1 101") == 0);
+	REQUIRE(client.received.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != std::string::npos);
+	REQUIRE(client.received.find("Sec-WebSocket-Protocol: chat\r\n") != std::string::npos);
+#ifdef AMS_USE_ZLIB
+	REQUIRE(client.received.find("Sec-WebSocket-Extensions: permessage-deflate") != std::string::npos);
+#endif
+}
+
+TEST_CASE("Websocket Shutdown", "[websocket],[shutdown]")
+{
+	const unsigned int port = 8645;
+	Server server;
+	HttpProtocol http(port);
+	WebsocketProtocol websocket;
+	http.addUpgradeProtocol("websocket", &websocket);
+	server.addProtocol(&http);
+	server.addProtocol(&websocket);
+	std::string received;
+	websocket.setOnReceive([&received](ProtocolBase *, Connection &, const std::string & data) { received = data; });
+
+	RawClient client(port);
+	client.send(HANDSHAKE);
+	REQUIRE(loopUntil(server, [&]() { return client.isHandshakeAnswered(); }));
+
+	// a message is half sent when the server starts closing
+	client.sendFrame("hel", WebsocketOpCodes::TEXT, false);
+	websocket.beginShutdown();
+	REQUIRE(loopUntil(server, [&]() { client.read(); return client.getCloseCode() != 0; }));
+	REQUIRE(client.getCloseCode() == WebsocketCloseCodes::GOING_AWAY);
+
+	// the rest of it is ignored, not an error, and the server waits for the close handshake
+	client.sendFrame("lo", WebsocketOpCodes::CONTINUATION);
+	auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+	bool isClosed = false;
+	loopUntil(server, [&]() { isClosed = client.read(); return isClosed || std::chrono::steady_clock::now() > end; });
+	REQUIRE(!isClosed);
+	REQUIRE(!websocket.isDrained());
+	REQUIRE(client.getFrames().size() == 1);	// nothing after the close frame
+	REQUIRE(received.empty());
+
+	client.sendFrame(writeWebsocketClosePayload(WebsocketCloseCodes::GOING_AWAY), WebsocketOpCodes::CLOSE);
+	REQUIRE(loopUntil(server, [&]() { return client.read(); }));	// closed by the server
+	REQUIRE(websocket.isDrained());
+}
+
+TEST_CASE("Threaded Server Stop", "[websocket],[shutdown]")
+{
+	const unsigned int port = 8646;
+	ThreadedServer server;
+	HttpProtocol http(port);
+	WebsocketProtocol websocket;
+	http.addUpgradeProtocol("websocket", &websocket);
+	server.addProtocol(&http);
+	server.addProtocol(&websocket);
+	server.start();
+
+	RawClient client(port);	// never answers the close frame
+	client.send(HANDSHAKE);
+	REQUIRE(waitUntil([&]() { return client.isHandshakeAnswered(); }));
+
+	auto start = std::chrono::steady_clock::now();
+	server.stop(std::chrono::milliseconds(200));
+	auto duration = std::chrono::steady_clock::now() - start;
+	REQUIRE(duration >= std::chrono::milliseconds(200));	// waited for the client
+	REQUIRE(duration < std::chrono::seconds(2));	// but not for the close timeout
+
+	REQUIRE(client.read());	// closed once the time ran out
+	REQUIRE(client.getCloseCode() == WebsocketCloseCodes::GOING_AWAY);
+	REQUIRE(websocket.isDrained());
+}
+
+TEST_CASE("Websocket Messages", "[websocket]")
+{
+	const unsigned int port = 8647;
+	Server server;
+	HttpProtocol http(port);
+	WebsocketProtocol websocket;
+	http.addUpgradeProtocol("websocket", &websocket);
+	server.addProtocol(&http);
+	server.addProtocol(&websocket);
+	std::vector<std::string> received;
+	websocket.setOnReceive([&received](ProtocolBase *, Connection &, const std::string & data) { received.push_back(data); });
+
+	// fragments are put back together, with a ping answered in between
+	RawClient fragmented(port);
+	fragmented.send(HANDSHAKE);
+	REQUIRE(loopUntil(server, [&]() { return fragmented.isHandshakeAnswered(); }));
+	fragmented.sendFrame("Hel", WebsocketOpCodes::TEXT, false);
+	fragmented.sendFrame("are you there", WebsocketOpCodes::PING);
+	fragmented.sendFrame("lo", WebsocketOpCodes::CONTINUATION);
+	REQUIRE(loopUntil(server, [&]() { fragmented.read(); return !received.empty() && !fragmented.getFrames().empty(); }));
+	REQUIRE(received == std::vector<std::string>{ "Hello" });
+	REQUIRE(fragmented.getFrames().front().header.opCode == WebsocketOpCodes::PONG);
+	REQUIRE(fragmented.getFrames().front().payload == "are you there");	// the ping's payload is echoed
+
+	// a continuation with no message to continue
+	RawClient unexpected(port);
+	unexpected.send(HANDSHAKE);
+	REQUIRE(loopUntil(server, [&]() { return unexpected.isHandshakeAnswered(); }));
+	unexpected.sendFrame("lo", WebsocketOpCodes::CONTINUATION);
+	REQUIRE(loopUntil(server, [&]() { return unexpected.read(); }));
+	REQUIRE(unexpected.getCloseCode() == WebsocketCloseCodes::PROTOCOL_ERROR);
+
+	// a fragment ending part way through a surrogate, which no later fragment can make valid
+	RawClient surrogate(port);
+	surrogate.send(HANDSHAKE);
+	REQUIRE(loopUntil(server, [&]() { return surrogate.isHandshakeAnswered(); }));
+	surrogate.sendFrame("a\xed\xa0", WebsocketOpCodes::TEXT, false);
+	REQUIRE(loopUntil(server, [&]() { return surrogate.read(); }));
+	REQUIRE(surrogate.getCloseCode() == WebsocketCloseCodes::INVALID_PAYLOAD);
+
+	// an opcode reserved for future use
+	RawClient reserved(port);
+	reserved.send(HANDSHAKE);
+	REQUIRE(loopUntil(server, [&]() { return reserved.isHandshakeAnswered(); }));
+	reserved.sendFrame("?", static_cast<WebsocketOpCodes>(0x3));
+	REQUIRE(loopUntil(server, [&]() { return reserved.read(); }));
+	REQUIRE(reserved.getCloseCode() == WebsocketCloseCodes::PROTOCOL_ERROR);
+
+	// the limit applies to the whole message, not each fragment
+	websocket.setMaxMessageSize(8);
+	RawClient tooLarge(port);
+	tooLarge.send(HANDSHAKE);
+	REQUIRE(loopUntil(server, [&]() { return tooLarge.isHandshakeAnswered(); }));
+	tooLarge.sendFrame("12345", WebsocketOpCodes::TEXT, false);
+	tooLarge.sendFrame("6789", WebsocketOpCodes::CONTINUATION);
+	REQUIRE(loopUntil(server, [&]() { return tooLarge.read(); }));
+	REQUIRE(tooLarge.getCloseCode() == WebsocketCloseCodes::MESSAGE_TOO_BIG);
+	REQUIRE(received.size() == 1);
+
+	// and to a message sent whole
+	RawClient tooLargeFrame(port);
+	tooLargeFrame.send(HANDSHAKE);
+	REQUIRE(loopUntil(server, [&]() { return tooLargeFrame.isHandshakeAnswered(); }));
+	tooLargeFrame.sendFrame("123456789", WebsocketOpCodes::TEXT);
+	REQUIRE(loopUntil(server, [&]() { return tooLargeFrame.read(); }));
+	REQUIRE(tooLargeFrame.getCloseCode() == WebsocketCloseCodes::MESSAGE_TOO_BIG);
+	REQUIRE(received.size() == 1);
+
+	// streamed, each fragment is passed on as it arrives
+	std::vector<std::pair<std::string, bool>> fragments;
+	websocket.setOnReceiveFragment([&fragments](ProtocolBase *, Connection &, const std::string & fragment, bool isBinary, bool isFinal)
+	{
+		REQUIRE(isBinary);
+		fragments.emplace_back(fragment, isFinal);
+	});
+	RawClient streamed(port);
+	streamed.send(HANDSHAKE);
+	REQUIRE(loopUntil(server, [&]() { return streamed.isHandshakeAnswered(); }));
+	streamed.sendFrame("12345", WebsocketOpCodes::BINARY, false);
+	streamed.sendFrame("6789", WebsocketOpCodes::CONTINUATION);	// larger than the limit altogether, each frame is within it
+	REQUIRE(loopUntil(server, [&]() { return fragments.size() == 2; }));
+	REQUIRE(fragments[0] == std::make_pair(std::string("12345"), false));
+	REQUIRE(fragments[1] == std::make_pair(std::string("6789"), true));
+	REQUIRE(received.size() == 1);	// not reassembled
+}
+
+TEST_CASE("Websocket Topics", "[websocket],[topic]")
+{
+	const unsigned int port = 8648;
+	Server server;
+	HttpProtocol http(port);
+	WebsocketProtocol websocket;
+	http.addUpgradeProtocol("websocket", &websocket);
+	server.addProtocol(&http);
+	server.addProtocol(&websocket);
+	websocket.setOnConnect([&websocket](ProtocolBase *, Connection & connection) { REQUIRE(websocket.subscribe(connection, "news")); });
+	websocket.setOnReceive([&websocket](ProtocolBase *, Connection & connection, const std::string & data)
+	{
+		if (data == "leave")
+		{
+			websocket.unsubscribe(connection, "news");
+		}
+	});
+
+	RawClient staying(port);
+	staying.send(HANDSHAKE);
+	REQUIRE(loopUntil(server, [&]() { return staying.isHandshakeAnswered(); }));
+	{
+		RawClient leaving(port);
+		leaving.send(HANDSHAKE);
+		REQUIRE(loopUntil(server, [&]() { return leaving.isHandshakeAnswered(); }));
+		REQUIRE(websocket.getSubscriberCount("news") == 2);
+
+		websocket.publish("news", "first");
+		REQUIRE(loopUntil(server, [&]() { staying.read(); leaving.read(); return staying.getFrames().size() == 1 && leaving.getFrames().size() == 1; }));
+		REQUIRE(leaving.getFrames().front().payload == "first");
+
+		leaving.sendFrame("leave", WebsocketOpCodes::TEXT);
+		REQUIRE(loopUntil(server, [&]() { return websocket.getSubscriberCount("news") == 1; }));
+		websocket.publish("news", "second");
+		REQUIRE(loopUntil(server, [&]() { staying.read(); return staying.getFrames().size() == 2; }));
+		REQUIRE(staying.getFrames().back().payload == "second");
+		leaving.read();
+		REQUIRE(leaving.getFrames().size() == 1);	// left before it was published
+	}
+
+	// members that disconnect are removed, and the topic with the last of them
+	websocket.publish("other", "nobody listens");
+	REQUIRE(websocket.getSubscriberCount("other") == 0);
+	staying.sendFrame("", WebsocketOpCodes::CLOSE);
+	REQUIRE(loopUntil(server, [&]() { return websocket.isDrained(); }));
+	REQUIRE(websocket.getSubscriberCount("news") == 0);
+}
+
+TEST_CASE("Websocket Heartbeat", "[websocket]")
+{
+	const unsigned int port = 8649;
+	Server server;
+	HttpProtocol http(port);
+	WebsocketProtocol websocket;
+	http.addUpgradeProtocol("websocket", &websocket);
+	server.addProtocol(&http);
+	server.addProtocol(&websocket);
+	HeartbeatSettings heartbeat;
+	heartbeat.interval = std::chrono::milliseconds(100);
+	heartbeat.maxMissed = 2;
+	websocket.setHeartbeatSettings(heartbeat);
+	std::chrono::microseconds roundTripTime{ 0 };
+	websocket.setOnReceive([&](ProtocolBase *, Connection & connection, const std::string &) { roundTripTime = websocket.getRoundTripTime(connection); });
+
+	RawClient client(port);
+	client.send(HANDSHAKE);
+	REQUIRE(loopUntil(server, [&]() { return client.isHandshakeAnswered(); }));
+
+	// a quiet client is pinged, and the answer gives the round trip time
+	REQUIRE(loopUntil(server, [&]() { client.read(); return !client.getFrames().empty(); }));
+	WebsocketFrame ping = client.getFrames().front();
+	REQUIRE(ping.header.opCode == WebsocketOpCodes::PING);
+	client.sendFrame(ping.payload, WebsocketOpCodes::PONG);
+	client.sendFrame("ask", WebsocketOpCodes::TEXT);
+	REQUIRE(loopUntil(server, [&]() { return roundTripTime.count() != 0; }));
+
+	// a client that stops answering is closed after the pings it may miss
+	size_t answered = client.getFrames().size();
+	REQUIRE(loopUntil(server, [&]() { return client.read(); }));
+	REQUIRE(client.getFrames().size() - answered == heartbeat.maxMissed);	// each ping went unanswered
+	REQUIRE(websocket.isDrained());
+}
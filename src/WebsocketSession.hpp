@@ -0,0 +1,48 @@
+/******************************
+ * @file WebsocketSession.hpp
+ * Alex's MicroServer (AMS)
+ * @author Alex Schlieck
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ ******************************/
+
+#ifndef AMS_WEBSOCKET_SESSION_HPP
+#define AMS_WEBSOCKET_SESSION_HPP
+
+#include <string>
+#include <unordered_set>
+#include <memory>	// unique_ptr
+#include <chrono>
+#include <stdint.h>
+#include "WebsocketDeflate.hpp"
+#include "WebsocketUtf8.hpp"
+
+namespace ams
+{
+	struct SubprotocolHandlers;
+
+	/// Websocket specific state of a single connection
+	struct WebsocketSession
+	{
+		std::string message;			/// fragments of the message being received
+		uint8_t messageOpCode = 0;		/// op code of the first fragment (TEXT or BINARY)
+		bool isReceivingMessage = false;	/// if a fragmented message has been started and not finished
+		bool isCompressedMessage = false;	/// if the message being received is compressed
+		Utf8Validator utf8;				/// checks text messages as their fragments arrive
+		std::unique_ptr<DeflateContext> deflate;	/// compression state, nullptr if compression wasn't negotiated
+		std::chrono::steady_clock::time_point lastReceived;	/// when the client last sent anything, sending to it doesn't count
+		bool isAwaitingPong = false;	/// if a heartbeat ping hasn't been answered yet
+		uint64_t pingSequence = 0;		/// payload of the last heartbeat ping
+		std::chrono::steady_clock::time_point pingSent;	/// when the last heartbeat ping was sent
+		unsigned int missedHeartbeats = 0;	/// pings in a row that weren't answered in time
+		std::chrono::microseconds roundTripTime{ 0 };	/// time taken to answer the last ping, 0 until one is answered
+		bool isCloseSent = false;	/// if the server has started the close handshake, no more data may be sent
+		std::chrono::steady_clock::time_point closeSent;	/// when the server's close frame was sent
+		std::unordered_set<std::string> topics;	/// topics the connection is subscribed to
+		const std::string * subprotocol = nullptr;	/// name of the subprotocol agreed in the handshake, owned by the protocol, nullptr if none
+		const SubprotocolHandlers * handlers = nullptr;	/// callbacks of that subprotocol, owned by the protocol, nullptr if none
+	};
+}
+
+#endif // !AMS_WEBSOCKET_SESSION_HPP
@@ -0,0 +1,386 @@
+/******************************
+ * @file WebsocketUtf8.hpp
+ * Alex's MicroServer (AMS)
+ * @author Alex Schlieck
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * Checks that text messages are valid UTF-8 (RFC 6455 section 8.1, RFC 3629).
+ * The AVX2 kernel uses the lookup algorithm by Keiser and Lemire,
+ * "Validating UTF-8 In Less Than One Instruction Per Byte" (2021)
+ ******************************/
+
+#ifndef AMS_WEBSOCKET_UTF8_HPP
+#define AMS_WEBSOCKET_UTF8_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>	// memcpy
+#include "WebsocketMask.hpp"	// CPU detection and target macros
+
+namespace ams
+{
+	/// Instruction sets the UTF-8 validation can use
+	enum class Utf8Kernel { SCALAR, AVX2 };
+
+	namespace utf8Detail
+	{
+		/// Get the length of the sequence a lead byte starts
+		/// @param lead First byte of the sequence
+		/// @return 1 to 4, or 0 if the byte can't start a sequence
+		inline size_t getSequenceLength(const uint8_t lead)
+		{
+			if (lead < 0x80) return 1;
+			if (lead < 0xc2) return 0;	// continuation byte, or overlong 2 byte lead
+			if (lead < 0xe0) return 2;
+			if (lead < 0xf0) return 3;
+			if (lead < 0xf5) return 4;
+			return 0;					// above U+10FFFF
+		}
+
+		/// Check the start of a multi-byte sequence, which may be all of it
+		/// @param data Start of the sequence
+		/// @param size Number of bytes to check, no more than the sequence's length
+		/// @return If the bytes could begin a valid character
+		inline bool isValidPrefix(const uint8_t * data, const size_t size)
+		{
+			// the second byte has a narrower range for some leads, ruling out overlongs, surrogates and values above U+10FFFF
+			uint8_t low = 0x80;
+			uint8_t high = 0xbf;
+			switch (data[0])
+			{
+				case 0xe0: low = 0xa0; break;
+				case 0xed: high = 0x9f; break;
+				case 0xf0: low = 0x90; break;
+				case 0xf4: high = 0x8f; break;
+			}
+			if (size > 1 && (data[1] < low || data[1] > high))
+			{
+				return false;
+			}
+			for (size_t i = 2; i < size; i++)
+			{
+				if ((data[i] & 0xc0) != 0x80)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/// Check a single multi-byte sequence
+		/// @param data Start of the sequence
+		/// @param size Number of bytes available
+		/// @return Length of the sequence, 0 if it is invalid or cut short
+		inline size_t readSequence(const uint8_t * data, const size_t size)
+		{
+			size_t length = getSequenceLength(data[0]);
+			if (length == 0 || length > size || !isValidPrefix(data, length))
+			{
+				return 0;
+			}
+			return length;
+		}
+
+		/// Portable version, skips ASCII 8 bytes at a time
+		inline bool validateScalar(const uint8_t * data, const size_t size)
+		{
+			size_t i = 0;
+			while (i < size)
+			{
+				if (i + 8 <= size)
+				{
+					uint64_t block;
+					memcpy(&block, data + i, 8);
+					if ((block & 0x8080808080808080ull) == 0)
+					{
+						i += 8;
+						continue;
+					}
+				}
+				if (data[i] < 0x80)
+				{
+					i++;
+					continue;
+				}
+
+				size_t length = readSequence(data + i, size - i);
+				if (length == 0)
+				{
+					return false;
+				}
+				i += length;
+			}
+			return true;
+		}
+
+#ifdef AMS_MASK_X86
+		/// Error bits set by the lookup tables, a byte pair is invalid if all three tables agree on a bit
+		enum : uint8_t
+		{
+			TOO_SHORT = 1 << 0,		// lead not followed by a continuation
+			TOO_LONG = 1 << 1,		// ASCII followed by a continuation
+			OVERLONG_3 = 1 << 2,	// 3 byte sequence that fits in 2
+			TOO_LARGE = 1 << 3,		// above U+10FFFF
+			SURROGATE = 1 << 4,		// U+D800 to U+DFFF
+			OVERLONG_2 = 1 << 5,	// 2 byte sequence that fits in 1
+			TOO_LARGE_1000 = 1 << 6,	// above U+10FFFF, second byte 1000____
+			OVERLONG_4 = 1 << 6,	// 4 byte sequence that fits in 3, shares the bit because the leads differ
+			TWO_CONTS = 1 << 7,		// continuation after a complete sequence (checked against the length rules)
+			CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS	// errors that only depend on the high nibble of the first byte
+		};
+
+		/// Look up 16 entry tables for the high nibble of the previous byte, its low nibble, and the high nibble of the current byte
+		AMS_TARGET("avx2")
+		inline __m256i checkSpecialCases(const __m256i input, const __m256i previous1)
+		{
+			const __m256i LOW_NIBBLE = _mm256_set1_epi8(0x0f);
+			const __m256i byte1High = _mm256_shuffle_epi8(_mm256_setr_epi8(
+				// 0_______ ASCII
+				TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+				// 10______ continuation
+				TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+				// 1100____ 1101____ 2 byte leads
+				TOO_SHORT | OVERLONG_2, TOO_SHORT,
+				// 1110____ 3 byte lead
+				TOO_SHORT | OVERLONG_3 | SURROGATE,
+				// 1111____ 4 byte lead
+				static_cast<char>(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4),
+				// second lane, the same table
+				TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+				TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+				TOO_SHORT | OVERLONG_2, TOO_SHORT,
+				TOO_SHORT | OVERLONG_3 | SURROGATE,
+				static_cast<char>(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4)),
+				_mm256_and_si256(_mm256_srli_epi16(previous1, 4), LOW_NIBBLE));
+
+			const char LARGE = static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000);
+			const __m256i byte1Low = _mm256_shuffle_epi8(_mm256_setr_epi8(
+				// ____0000 ____0001
+				CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2,
+				// ____001_
+				CARRY, CARRY,
+				// ____0100 ____0101 ____011_
+				CARRY | TOO_LARGE, LARGE, LARGE, LARGE,
+				// ____1___, ____1101 can be a surrogate
+				LARGE, LARGE, LARGE, LARGE, LARGE, static_cast<char>(LARGE | SURROGATE), LARGE, LARGE,
+				// second lane, the same table
+				CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2,
+				CARRY, CARRY,
+				CARRY | TOO_LARGE, LARGE, LARGE, LARGE,
+				LARGE, LARGE, LARGE, LARGE, LARGE, static_cast<char>(LARGE | SURROGATE), LARGE, LARGE),
+				_mm256_and_si256(previous1, LOW_NIBBLE));
+
+			const char CONTINUATION_1000 = static_cast<char>(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4);
+			const char CONTINUATION_1001 = static_cast<char>(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE);
+			const char CONTINUATION_101 = static_cast<char>(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE);
+			const __m256i byte2High = _mm256_shuffle_epi8(_mm256_setr_epi8(
+				// 0_______ ASCII
+				TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+				// 1000____ 1001____ 101_____ continuations
+				CONTINUATION_1000, CONTINUATION_1001, CONTINUATION_101, CONTINUATION_101,
+				// 11______ leads
+				TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+				// second lane, the same table
+				TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+				CONTINUATION_1000, CONTINUATION_1001, CONTINUATION_101, CONTINUATION_101,
+				TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT),
+				_mm256_and_si256(_mm256_srli_epi16(input, 4), LOW_NIBBLE));
+
+			return _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+		}
+
+		/// Get the block shifted so each byte lines up with the one N positions before it
+		template <int N>
+		AMS_TARGET("avx2")
+		inline __m256i getPreviousBytes(const __m256i input, const __m256i previousInput)
+		{
+			return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(previousInput, input, 0x21), 16 - N);
+		}
+
+		/// Find every error in a 32 byte block
+		/// @param input The block
+		/// @param previousInput The block before it, so sequences can cross blocks
+		/// @return Non zero bytes where there are errors
+		AMS_TARGET("avx2")
+		inline __m256i checkBlock(const __m256i input, const __m256i previousInput)
+		{
+			__m256i previous1 = getPreviousBytes<1>(input, previousInput);
+			__m256i specialCases = checkSpecialCases(input, previous1);
+
+			// the 3rd and 4th bytes of a sequence must be continuations, and nothing else may be
+			__m256i previous2 = getPreviousBytes<2>(input, previousInput);
+			__m256i previous3 = getPreviousBytes<3>(input, previousInput);
+			__m256i isThirdByte = _mm256_subs_epu8(previous2, _mm256_set1_epi8(static_cast<char>(0xe0 - 0x80)));	// only 111_____ reaches 0x80
+			__m256i isFourthByte = _mm256_subs_epu8(previous3, _mm256_set1_epi8(static_cast<char>(0xf0 - 0x80)));	// only 1111____ reaches 0x80
+			__m256i mustBeContinuation = _mm256_and_si256(_mm256_or_si256(isThirdByte, isFourthByte), _mm256_set1_epi8(static_cast<char>(0x80)));
+			return _mm256_xor_si256(mustBeContinuation, specialCases);
+		}
+
+		/// Find leads at the end of a block that need bytes from the next block
+		AMS_TARGET("avx2")
+		inline __m256i getIncomplete(const __m256i input)
+		{
+			const __m256i MAX_COMPLETE = _mm256_setr_epi8(
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				static_cast<char>(0xf0 - 1), static_cast<char>(0xe0 - 1), static_cast<char>(0xc0 - 1));
+			return _mm256_subs_epu8(input, MAX_COMPLETE);
+		}
+
+		AMS_TARGET("avx2")
+		inline bool validateAvx2(const uint8_t * data, const size_t size)
+		{
+			__m256i error = _mm256_setzero_si256();
+			__m256i previousInput = _mm256_setzero_si256();
+			__m256i previousIncomplete = _mm256_setzero_si256();
+
+			size_t i = 0;
+			for (; i + 32 <= size; i += 32)
+			{
+				__m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+				if (_mm256_movemask_epi8(input) == 0)	// ASCII, only an unfinished sequence from the last block can be wrong
+				{
+					error = _mm256_or_si256(error, previousIncomplete);
+				}
+				else
+				{
+					error = _mm256_or_si256(error, checkBlock(input, previousInput));
+					previousIncomplete = getIncomplete(input);
+				}
+				previousInput = input;
+			}
+
+			// pad the tail with zeros, which also shows any sequence still unfinished
+			uint8_t tail[32] = {};
+			memcpy(tail, data + i, size - i);
+			__m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail));
+			error = _mm256_or_si256(error, checkBlock(input, previousInput));
+			error = _mm256_or_si256(error, getIncomplete(input));
+			return _mm256_testz_si256(error, error) != 0;
+		}
+#endif // AMS_MASK_X86
+
+		using ValidateFunction = bool(*)(const uint8_t *, size_t);
+
+		/// Find the function that implements a kernel
+		inline ValidateFunction getValidateFunction(const Utf8Kernel kernel)
+		{
+			switch (kernel)
+			{
+#ifdef AMS_MASK_X86
+				case Utf8Kernel::AVX2:	return validateAvx2;
+#endif
+				default:				return validateScalar;
+			}
+		}
+	}
+
+	/// Check if the CPU (and OS) can run a kernel
+	/// @param kernel The kernel to check
+	/// @return If the kernel can be used
+	inline bool isUtf8KernelSupported(const Utf8Kernel kernel)
+	{
+		switch (kernel)
+		{
+			case Utf8Kernel::AVX2:	return isMaskKernelSupported(MaskKernel::AVX2);
+			default:				return true;
+		}
+	}
+
+	/// Check that data is complete, valid UTF-8 with a specific kernel
+	/// @param data Start of the data
+	/// @param size Number of bytes
+	/// @param kernel Which instruction set to use, must be supported by the CPU
+	/// @return If the data is valid
+	inline bool isValidUtf8(const uint8_t * data, const size_t size, const Utf8Kernel kernel)
+	{
+		return utf8Detail::getValidateFunction(kernel)(data, size);
+	}
+
+	/// Check that data is complete, valid UTF-8 with the fastest kernel available
+	/// @param data Start of the data
+	/// @param size Number of bytes
+	/// @return If the data is valid
+	inline bool isValidUtf8(const char * data, const size_t size)
+	{
+		static const utf8Detail::ValidateFunction best = utf8Detail::getValidateFunction(
+			isUtf8KernelSupported(Utf8Kernel::AVX2) ? Utf8Kernel::AVX2 : Utf8Kernel::SCALAR);
+		return best(reinterpret_cast<const uint8_t*>(data), size);
+	}
+
+	/// @brief Validates a message that arrives in pieces.
+	/// A character split between fragments is held back until the rest of it arrives
+	class Utf8Validator
+	{
+	public:
+		/// Check the next piece of the message
+		/// @param data Start of the piece
+		/// @param size Number of bytes
+		/// @param isFinal If this is the last piece, which must not end part way through a character
+		/// @return If the message is valid so far, false once it can never be
+		bool update(const char * data, const size_t size, const bool isFinal)
+		{
+			const uint8_t * bytes = reinterpret_cast<const uint8_t*>(data);
+			size_t start = 0;
+			if (pendingSize != 0)	// finish the character left over from the last piece
+			{
+				size_t length = utf8Detail::getSequenceLength(pending[0]);
+				if (length == 0)
+				{
+					return false;
+				}
+				while (pendingSize < length && start < size)
+				{
+					pending[pendingSize++] = bytes[start++];
+				}
+				if (pendingSize < length)	// still unfinished, but what there is must be able to start a valid character
+				{
+					return !isFinal && utf8Detail::isValidPrefix(pending, pendingSize);
+				}
+				if (utf8Detail::readSequence(pending, pendingSize) != length)
+				{
+					return false;
+				}
+				pendingSize = 0;
+			}
+
+			size_t end = isFinal ? size : start + getCompleteLength(bytes + start, size - start);
+			if (!isValidUtf8(data + start, end - start))
+			{
+				return false;
+			}
+			pendingSize = size - end;
+			memcpy(pending, bytes + end, pendingSize);
+			return pendingSize == 0 || utf8Detail::isValidPrefix(pending, pendingSize);	// fail now rather than when, or if, the rest arrives
+		}
+
+		/// Forget any held back bytes, ready for a new message
+		void reset()
+		{
+			pendingSize = 0;
+		}
+
+	private:
+		/// Find where a character starts that needs more bytes than are available
+		/// @return Number of bytes before the unfinished character, size if there isn't one
+		static size_t getCompleteLength(const uint8_t * data, const size_t size)
+		{
+			for (size_t back = 1; back <= 3 && back <= size; back++)
+			{
+				uint8_t byte = data[size - back];
+				if ((byte & 0xc0) != 0x80)	// found the lead, or ASCII
+				{
+					size_t length = utf8Detail::getSequenceLength(byte);	// 0 for an invalid lead, which the validation rejects
+					return length > back ? size - back : size;
+				}
+			}
+			return size;	// only continuations, the validation decides
+		}
+
+		uint8_t pending[4] = {};	/// start of a character split across pieces
+		size_t pendingSize = 0;		/// number of bytes in pending
+	};
+}
+
+#endif // !AMS_WEBSOCKET_UTF8_HPP
@@ -0,0 +1,177 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../test/catch.hpp"
+#include "WebsocketUtf8.hpp"
+
+using namespace ams;
+
+namespace
+{
+	const Utf8Kernel ALL_KERNELS[] = { Utf8Kernel::SCALAR, Utf8Kernel::AVX2 };
+	const char * KERNEL_NAMES[] = { "scalar", "AVX2" };
+
+	/// Straightforward decoder to check the kernels against
+	bool isValidReference(const std::vector<uint8_t> & data)
+	{
+		size_t i = 0;
+		while (i < data.size())
+		{
+			uint8_t lead = data[i];
+			size_t length = lead < 0x80 ? 1 : (lead & 0xe0) == 0xc0 ? 2 : (lead & 0xf0) == 0xe0 ? 3 : (lead & 0xf8) == 0xf0 ? 4 : 0;
+			if (length == 0 || i + length > data.size())
+			{
+				return false;
+			}
+
+			uint32_t codePoint = length == 1 ? lead : lead & (0xff >> (length + 1));
+			for (size_t j = 1; j < length; j++)
+			{
+				if ((data[i + j] & 0xc0) != 0x80)
+				{
+					return false;
+				}
+				codePoint = (codePoint << 6) | (data[i + j] & 0x3f);
+			}
+
+			const uint32_t smallest[] = { 0, 0, 0x80, 0x800, 0x10000 };
+			if (codePoint < smallest[length] || codePoint > 0x10ffff || (codePoint >= 0xd800 && codePoint <= 0xdfff))
+			{
+				return false;
+			}
+			i += length;
+		}
+		return true;
+	}
+}
+
+TEST_CASE("Websocket UTF-8", "[websocket],[utf8]")
+{
+	for (Utf8Kernel kernel : ALL_KERNELS)
+	{
+		if (!isUtf8KernelSupported(kernel))
+		{
+			continue;
+		}
+
+		SECTION(std::string("Known strings: ") + KERNEL_NAMES[static_cast<int>(kernel)])
+		{
+			auto isValid = [kernel](const std::string & text) { return isValidUtf8(reinterpret_cast<const uint8_t*>(text.data()), text.length(), kernel); };
+			REQUIRE(isValid(""));
+			REQUIRE(isValid("plain ascii text that is longer than one vector block"));
+			REQUIRE(isValid("\xce\xba\xe1\xbd\xb9\xcf\x83\xce\xbc\xce\xb5"));	// "kosme" in Greek, from the Autobahn test suite
+			REQUIRE(isValid("\xf0\x9f\x98\x80 \xf4\x8f\xbf\xbf"));	// emoji, U+10FFFF
+			REQUIRE_FALSE(isValid("\xc0\xaf"));			// overlong '/'
+			REQUIRE_FALSE(isValid("\xed\xa0\x80"));		// surrogate
+			REQUIRE_FALSE(isValid("\xf4\x90\x80\x80"));	// above U+10FFFF
+			REQUIRE_FALSE(isValid("\xe2\x82"));			// cut short
+			REQUIRE_FALSE(isValid(std::string(40, 'a') + "\x80"));	// stray continuation after a vector block
+		}
+
+		SECTION(std::string("Matches reference: ") + KERNEL_NAMES[static_cast<int>(kernel)])
+		{
+			// every pair of leading bytes with a selection of following bytes, placed across a 32 byte block boundary
+			const uint8_t followers[] = { 0x00, 0x41, 0x7f, 0x80, 0x8f, 0x90, 0x9f, 0xa0, 0xbf, 0xc2, 0xe0, 0xf0 };
+			std::vector<uint8_t> data(40, 'a');
+			const size_t position = 30;
+			size_t mismatches = 0;
+			for (int first = 0; first < 256; first++)
+			{
+				for (int second = 0; second < 256; second++)
+				{
+					for (uint8_t third : followers)
+					{
+						for (uint8_t fourth : { 0x41, 0x80, 0xbf })
+						{
+							data[position] = static_cast<uint8_t>(first);
+							data[position + 1] = static_cast<uint8_t>(second);
+							data[position + 2] = third;
+							data[position + 3] = fourth;
+							mismatches += isValidUtf8(data.data(), data.size(), kernel) != isValidReference(data);
+							mismatches += isValidUtf8(data.data(), position + 2, kernel) != isValidReference(std::vector<uint8_t>(data.begin(), data.begin() + position + 2));
+						}
+					}
+				}
+			}
+			REQUIRE(mismatches == 0);
+		}
+	}
+
+	SECTION("Split across pieces")
+	{
+		const std::string text = std::string(50, 'a') + "\xf0\x9f\x98\x80\xe2\x82\xac" + std::string(20, 'b');
+		for (size_t split = 0; split <= text.length(); split++)
+		{
+			Utf8Validator validator;
+			REQUIRE(validator.update(text.data(), split, false));
+			REQUIRE(validator.update(text.data() + split, text.length() - split, true));
+		}
+
+		Utf8Validator oneByteAtATime;
+		for (size_t i = 0; i < text.length(); i++)
+		{
+			REQUIRE(oneByteAtATime.update(text.data() + i, 1, i + 1 == text.length()));
+		}
+	}
+
+	SECTION("Invalid pieces")
+	{
+		Utf8Validator unfinished;
+		REQUIRE(unfinished.update("\xe2\x82", 2, false));	// might still be finished
+		REQUIRE_FALSE(unfinished.update("", 0, true));
+
+		Utf8Validator badContinuation;
+		REQUIRE(badContinuation.update("a\xe2", 2, false));
+		REQUIRE_FALSE(badContinuation.update("\x82" "a", 2, false));
+
+		Utf8Validator badLead;
+		REQUIRE_FALSE(badLead.update("\xf8", 1, false));
+
+		// held back characters that can never be valid fail straight away
+		Utf8Validator surrogate;
+		REQUIRE_FALSE(surrogate.update("a\xed\xa0", 3, false));
+
+		Utf8Validator tooLarge;
+		REQUIRE_FALSE(tooLarge.update("a\xf4\x90", 3, false));
+
+		Utf8Validator overlong;
+		REQUIRE(overlong.update("a\xe0", 2, false));
+		REQUIRE_FALSE(overlong.update("\x80", 1, false));	// still short of a whole character
+
+		Utf8Validator badThirdByte;
+		REQUIRE(badThirdByte.update("\xf0", 1, false));
+		REQUIRE_FALSE(badThirdByte.update("\x90" "a", 2, false));
+	}
+}
+
+// Microbenchmark, hidden from normal runs. Run with: UnitTest "[.benchmark]"
+TEST_CASE("Websocket UTF-8 Throughput", "[.benchmark],[utf8]")
+{
+	const size_t repetitions = 20000;
+	std::string text;
+	while (text.length() < 64 * 1024)	// mostly ASCII with some accented and wide characters, like chat traffic
+	{
+		text += "Hello w\xc3\xb6rld, this is a chat message \xe2\x82\xac\xf0\x9f\x98\x80. ";
+	}
+
+	for (Utf8Kernel kernel : ALL_KERNELS)
+	{
+		if (!isUtf8KernelSupported(kernel))
+		{
+			continue;
+		}
+
+		size_t validCount = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < repetitions; i++)
+		{
+			validCount += isValidUtf8(reinterpret_cast<const uint8_t*>(text.data()), text.length() - (i & 1), kernel);
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		double gigabytesPerSecond = text.length() * static_cast<double>(repetitions) / elapsed.count() / 1e9;
+		std::cout << KERNEL_NAMES[static_cast<int>(kernel)] << ": " << gigabytesPerSecond << " GB/s per core\n";
+		CHECK(validCount == repetitions);	// every cut lands between characters
+	}
+}
@@ -0,0 +1,199 @@
+/******************************
+ * @file AssetPacker.cpp
+ * Alex's MicroServer (AMS)
+ * @author Alex Schlieck
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * Build step that turns a pages directory into a header that can be compiled into the server.
+ * Requires C++17 (std::filesystem)
+ *
+ * Usage: AssetPacker <pages directory> <output header> [pack name]
+ * Then: http.setEmbeddedAssets(&ams::assets::<pack name>);
+ ******************************/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+#include <algorithm>
+#include <map>
+#include "../src/EmbeddedAssets.hpp"
+
+namespace fs = std::filesystem;
+
+/// Pick the content type sent for a file
+/// @param extension The file extension, including the dot
+/// @return MIME type of the file
+std::string getMimeType(std::string extension)
+{
+	static const std::map<std::string, std::string> types = {
+		{ ".html", "text/html; charset=utf-8" },
+		{ ".htm", "text/html; charset=utf-8" },
+		{ ".css", "text/css; charset=utf-8" },
+		{ ".js", "application/javascript; charset=utf-8" },
+		{ ".json", "application/json" },
+		{ ".txt", "text/plain; charset=utf-8" },
+		{ ".svg", "image/svg+xml" },
+		{ ".png", "image/png" },
+		{ ".jpg", "image/jpeg" },
+		{ ".jpeg", "image/jpeg" },
+		{ ".gif", "image/gif" },
+		{ ".ico", "image/x-icon" },
+		{ ".wasm", "application/wasm" }
+	};
+
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	auto type = types.find(extension);
+	return type != types.end() ? type->second : "application/octet-stream";
+}
+
+/// Calculate the entity tag of the file contents
+/// @param data The contents of the file
+/// @return Quoted 64 bit FNV-1a hash of the contents
+std::string getEtag(const std::string & data)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : data)
+	{
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	std::ostringstream ss;
+	ss << '"' << std::hex << std::setw(16) << std::setfill('0') << hash << '"';
+	return ss.str();
+}
+
+/// Escape a string so it can be written as a C++ string literal
+/// Bytes outside printable ASCII become three digit octal escapes, which never take in the characters after them,
+/// and a ? following another is escaped so the pair can't start a trigraph
+std::string escape(const std::string & text)
+{
+	std::string result;
+	char previous = 0;
+	for (char c : text)
+	{
+		unsigned char byte = static_cast<unsigned char>(c);
+		if (byte < 0x20 || byte > 0x7e)
+		{
+			result += '\\';
+			result += static_cast<char>('0' + (byte >> 6));
+			result += static_cast<char>('0' + ((byte >> 3) & 7));
+			result += static_cast<char>('0' + (byte & 7));
+		}
+		else
+		{
+			if (c == '"' || c == '\\' || (c == '?' && previous == '?'))
+			{
+				result += '\\';
+			}
+			result += c;
+		}
+		previous = c;
+	}
+	return result;
+}
+
+int main(int argc, char * argv[])
+{
+	if (argc < 3)
+	{
+		std::cerr << "Usage: AssetPacker <pages directory> <output header> [pack name]\n";
+		return 1;
+	}
+
+	fs::path root(argv[1]);
+	std::string packName = argc > 3 ? argv[3] : "pages";
+
+	if (!fs::is_directory(root))
+	{
+		std::cerr << "Not a directory: " << root << '\n';
+		return 1;
+	}
+
+	// collect every file, sorted so the output is reproducible
+	std::vector<fs::path> files;
+	for (auto & entry : fs::recursive_directory_iterator(root))
+	{
+		if (entry.is_regular_file())
+		{
+			files.push_back(entry.path());
+		}
+	}
+	std::sort(files.begin(), files.end());
+
+	std::vector<std::string> paths;
+	for (auto & file : files)
+	{
+		paths.push_back("/" + fs::relative(file, root).generic_string());
+	}
+
+	uint32_t seed;
+	std::vector<int32_t> slots = ams::buildAssetSlots(paths, seed);
+
+	std::ofstream out(argv[2], std::ios::binary);
+	if (!out.is_open())
+	{
+		std::cerr << "Unable to write " << argv[2] << '\n';
+		return 1;
+	}
+
+	out << "// Generated by AssetPacker from " << root.generic_string() << ". Do not edit.\n\n"
+		<< "#pragma once\n\n"
+		<< "#include \"EmbeddedAssets.hpp\"\n\n"
+		<< "namespace ams\n{\n\tnamespace assets\n\t{\n";
+
+	std::vector<std::string> etags;
+	std::vector<std::string> mimeTypes;
+	std::vector<size_t> sizes;
+
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		std::ifstream file(files[i], std::ios::binary);
+		std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+		etags.push_back(getEtag(contents));
+		mimeTypes.push_back(getMimeType(files[i].extension().string()));
+
+		// the full response is stored so serving it is a single send
+		std::string response = "HTTP/1.1 200 OK\r\nContent-Type: " + mimeTypes[i]
+			+ "\r\nContent-Length: " + std::to_string(contents.size())
+			+ "\r\nETag: " + etags[i] + "\r\n\r\n" + contents;
+		sizes.push_back(response.size());
+
+		out << "\t\t// \"" << escape(paths[i]) << "\"\n"	// quoted, so a path ending in a backslash can't continue the comment
+			<< "\t\tconstexpr uint8_t " << packName << "Data" << i << "[] = {";
+		for (size_t b = 0; b < response.size(); b++)
+		{
+			out << (b % 24 == 0 ? "\n\t\t\t" : "") << static_cast<unsigned int>(static_cast<uint8_t>(response[b])) << ',';
+		}
+		out << "\n\t\t};\n\n";
+	}
+
+	out << "\t\tconstexpr EmbeddedAsset " << packName << "Assets[] = {\n";
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		out << "\t\t\t{ \"" << escape(paths[i]) << "\", " << packName << "Data" << i << ", " << sizes[i]
+			<< ", \"" << escape(etags[i]) << "\", \"" << mimeTypes[i] << "\" },\n";
+	}
+	if (files.empty())
+	{
+		out << "\t\t\t{ \"\", nullptr, 0, \"\", \"\" },\n";
+	}
+	out << "\t\t};\n\n";
+
+	out << "\t\tconstexpr int32_t " << packName << "Slots[] = {";
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		out << (i % 16 == 0 ? "\n\t\t\t" : " ") << slots[i] << ',';
+	}
+	out << "\n\t\t};\n\n";
+
+	out << "\t\tconstexpr EmbeddedAssetPack " << packName << " = { " << packName << "Assets, " << files.size() << ", "
+		<< packName << "Slots, " << slots.size() << ", " << seed << "u };\n"
+		<< "\t}\n}\n";
+
+	std::cout << "Packed " << files.size() << " files into " << argv[2] << '\n';
+	return 0;
+}